@@ -0,0 +1,272 @@
+/**
+*  @file bench_json.cpp
+*
+*  @brief Microbenchmark of the Home Assistant ambient payload serializers.
+*
+*  Compares the jsoncpp StreamWriterBuilder, as used by mqtt_pub_ha_sub before, with the
+*  serializer writing into a reusable buffer. First the outputs of both serializers are
+*  compared for random readings over the whole range of double values, then both are timed
+*  with realistic sensor readings. Each step prints one line of JSON on the standard output.
+*
+*  Exernal dependences:
+*   - libjsoncpp (https://github.com/open-source-parsers/jsoncpp)
+*
+*  @date 17-Oct-2026
+*  @copyright GNU General Public License v3
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <unistd.h> // For getopt()
+#include <time.h>
+
+#include "json/json.h"
+
+extern "C" {
+#include "ha_json.h"
+}
+
+
+static unsigned long allocations = 0;      /**< Calls of the global operator new. */
+
+
+void *operator new(std::size_t size)
+{
+    void *memory = std::malloc(size ? size : 1);
+
+    if (!memory)
+    {
+        throw std::bad_alloc();
+    }
+
+    allocations++;
+
+    return memory;
+}
+
+
+void operator delete(void *memory) noexcept
+{
+    std::free(memory);
+}
+
+
+void operator delete(void *memory, std::size_t) noexcept
+{
+    std::free(memory);
+}
+
+
+struct Reading {
+    double temperature;
+    double pressure;
+    double humidity;
+};
+
+
+/**
+ * @brief Returns the monotonic time in ns.
+ */
+static inline uint64_t now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+
+/**
+ * @brief The jsoncpp serializer of mqtt_pub_ha_sub, the reference for the output.
+ */
+static std::string jsoncpp_payload(const Reading &reading)
+{
+    Json::Value ha_json;
+    Json::StreamWriterBuilder builder;
+
+    // Configure the JSON as string writer
+    builder["indentation"] = "";
+    builder["precision"] = 2;
+    builder["precisionType"] = "decimal";
+
+    // Build the JSON document
+    ha_json["temperature"] = reading.temperature;
+    ha_json["pressure"] = reading.pressure;
+    ha_json["humidity"] = reading.humidity;
+
+    // Convert the JSON to a string
+    return Json::writeString(builder, ha_json);
+}
+
+
+/**
+ * @brief Returns a value with a random sign, mantissa and decimal exponent, or one of the
+ * values which need special care.
+ */
+static double random_value(std::mt19937_64 &generator)
+{
+    static const double special[] = { 0.0, -0.0, 0.005, -0.005, 0.015, 1.005, 2.675, 0.125, 99.995,
+                                      1e9, -1e9, 999999999.995, 1e300, -1e300, NAN, INFINITY, -INFINITY };
+    std::uniform_real_distribution<double> mantissa(-10.0, 10.0);
+    std::uniform_int_distribution<int> exponent(-4, 12);
+    std::uniform_int_distribution<unsigned int> kind(0, 99);
+
+    if (!kind(generator))
+    {
+        return special[generator() % (sizeof(special) / sizeof(special[0]))];
+    }
+
+    return mantissa(generator) * std::pow(10.0, exponent(generator));
+}
+
+
+/**
+ * @brief Compares the outputs of both serializers.
+ *
+ * @return 0 if all outputs are identical, -1 otherwise
+ */
+static int verify(unsigned long readings)
+{
+    std::mt19937_64 generator(1);
+    char payload[HA_JSON_MAX_LENGTH];
+    unsigned long mismatches = 0;
+    Reading reading;
+    std::string reference;
+
+    for (unsigned long i = 0; i < readings; i++)
+    {
+        reading.temperature = random_value(generator);
+        reading.pressure = random_value(generator);
+        reading.humidity = random_value(generator);
+
+        reference = jsoncpp_payload(reading);
+
+        if ((ha_json_ambient(payload, sizeof(payload), reading.temperature, reading.pressure, reading.humidity) != (int) reference.length()) ||
+            reference.compare(payload))
+        {
+            if (!mismatches)
+            {
+                fprintf(stderr, "Mismatch: jsoncpp %s, ha_json %s\n", reference.c_str(), payload);
+            }
+
+            mismatches++;
+        }
+    }
+
+    printf("{\"bench\":\"json_verify\",\"readings\":%lu,\"mismatches\":%lu}\n", readings, mismatches);
+    fflush(stdout);
+
+    return mismatches ? -1 : 0;
+}
+
+
+/**
+ * @brief Prints the result of timing one serializer.
+ */
+static void print_run(const char *serializer, unsigned long readings, uint64_t time, unsigned long run_allocations, unsigned long bytes)
+{
+    printf("{\"bench\":\"json\",\"serializer\":\"%s\",\"readings\":%lu,\"seconds\":%.6f,\"ns_per_payload\":%.1f,"
+           "\"payloads_per_second\":%.0f,\"allocations_per_payload\":%.2f,\"bytes\":%lu}\n",
+           serializer, readings, time / 1e9, (double) time / readings,
+           readings / (time / 1e9), (double) run_allocations / readings, bytes);
+    fflush(stdout);
+}
+
+
+/**
+ * @brief Times both serializers with the same readings in the range of the Sense HAT sensors.
+ */
+static void measure(unsigned long readings)
+{
+    std::mt19937_64 generator(2);
+    std::uniform_real_distribution<double> temperature(-40.0, 120.0);
+    std::uniform_real_distribution<double> pressure(260.0, 1260.0);
+    std::uniform_real_distribution<double> humidity(0.0, 100.0);
+    std::vector<Reading> samples(1024);
+    char payload[HA_JSON_MAX_LENGTH];
+    unsigned long bytes, run_allocations;
+    uint64_t start;
+
+    for (Reading &sample : samples)
+    {
+        sample = { temperature(generator), pressure(generator), humidity(generator) };
+    }
+
+    bytes = 0;
+    run_allocations = allocations;
+    start = now_ns();
+
+    for (unsigned long i = 0; i < readings; i++)
+    {
+        bytes += jsoncpp_payload(samples[i % samples.size()]).length();
+    }
+
+    print_run("jsoncpp", readings, now_ns() - start, allocations - run_allocations, bytes);
+
+    bytes = 0;
+    run_allocations = allocations;
+    start = now_ns();
+
+    for (unsigned long i = 0; i < readings; i++)
+    {
+        const Reading &sample = samples[i % samples.size()];
+
+        bytes += ha_json_ambient(payload, sizeof(payload), sample.temperature, sample.pressure, sample.humidity);
+    }
+
+    print_run("ha_json", readings, now_ns() - start, allocations - run_allocations, bytes);
+}
+
+
+static void usage(const char *name)
+{
+    printf("Usage: %s [-v readings to verify] [-n readings to time]\n", name);
+}
+
+
+int main(int argc, char *argv[])
+{
+    unsigned long verify_readings = 1000000;
+    unsigned long readings = 1000000;
+    int opt;
+
+    while((opt = getopt(argc, argv, "v:n:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'v':
+            verify_readings = strtoul(optarg, NULL, 10);
+            break;
+        case 'n':
+            readings = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (!readings)
+    {
+        usage(argv[0]);
+        return -1;
+    }
+
+    if (verify(verify_readings))
+    {
+        return -1;
+    }
+
+    measure(readings);
+
+    return 0;
+}
@@ -0,0 +1,358 @@
+ /**
+  * @file bench_worker.c
+  *
+  * @brief Microbenchmark of the worker thread and its FIFO queue.
+  *
+  * Every combination of the given queue modes, producer counts, entry sizes, queue sizes and
+  * handler costs is measured in a separate run. Each run prints one line of JSON on the standard
+  * output, so the results can be collected and compared across builds.
+  *
+  * @date 17-Oct-2026
+  * @copyright GNU General Public License v3
+  *
+  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "mqtt_userdefs.h"
+#include "worker.h"
+
+
+#define MAX_LIST_SIZE 16        /**< Maximal number of values in one command line list. */
+
+
+/**
+ * @brief Values of one benchmark parameter.
+ */
+typedef struct {
+    unsigned int value[MAX_LIST_SIZE];
+    unsigned int size;
+} value_list_t;
+
+/**
+ * @brief Parameters of one benchmark run.
+ */
+typedef struct {
+    working_queue_mode_t queue_mode;
+    unsigned int producers;
+    unsigned int entry_size;
+    unsigned int queue_size;
+    unsigned int handler_ns;
+    unsigned long entries;
+} bench_run_t;
+
+/**
+ * @brief Arguments of a producer thread.
+ */
+typedef struct {
+    worker_t *worker;
+    pthread_barrier_t *start;
+    unsigned long entries;
+} producer_arg_t;
+
+
+static histogram_t latency;              /**< Enqueue to process latency of the current run in ns. */
+static unsigned int handler_cost_ns;     /**< Busy time of the handler for every entry in the current run. */
+
+
+/**
+ * @brief Returns the monotonic time in ns.
+ */
+static inline uint64_t now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+
+/**
+ * @brief Handler called by the worker thread for every entry. Records the time since the producer
+ * stamped the entry and then simulates the processing cost.
+ */
+static int bench_do_work(void *entry)
+{
+    uint64_t now = now_ns();
+    uint64_t enqueued;
+
+    memcpy(&enqueued, entry, sizeof(enqueued));
+    histogram_record(&latency, now - enqueued);
+
+    if (handler_cost_ns)
+    {
+        uint64_t deadline = now + handler_cost_ns;
+
+        while (now_ns() < deadline);
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief Producer thread. Adds the entries stamped with the monotonic time to the worker queue.
+ */
+static void *producer_thread(void *producer_thread_arguments)
+{
+    producer_arg_t *producer = (producer_arg_t *) producer_thread_arguments;
+    working_queue_t *working_queue = &(producer->worker->working_queue);
+    void *entry = calloc(1, working_queue->entry_size);
+    unsigned long i;
+    uint64_t now;
+
+    pthread_barrier_wait(producer->start);
+
+    for (i = 0; entry && (i < producer->entries); i++)
+    {
+        now = now_ns();
+        memcpy(entry, &now, sizeof(now));
+        add_work_entry(working_queue, entry);
+    }
+
+    free(entry);
+
+    return NULL;
+}
+
+
+/**
+ * @brief Parses a comma separated list of unsigned numbers.
+ *
+ * @return 0 on success, -1 for empty or too long list
+ */
+static int parse_list(const char *text, value_list_t *list)
+{
+    char *end;
+
+    list->size = 0;
+
+    while (*text && (list->size < MAX_LIST_SIZE))
+    {
+        list->value[list->size] = (unsigned int) strtoul(text, &end, 10);
+
+        if (end == text)
+        {
+            return -1;
+        }
+
+        list->size++;
+        text = (*end == ',') ? end + 1 : end;
+    }
+
+    return (list->size && !*text) ? 0 : -1;
+}
+
+
+/**
+ * @brief Runs one benchmark configuration and prints the result as a JSON line.
+ *
+ * @return 0 on success, -1 if the worker or the producers could not be created
+ */
+static int bench_run(const bench_run_t *run)
+{
+    static worker_stats_t stats;        /**< Too big for the stack. */
+
+    worker_t *worker = NULL;
+    worker_attr_t attr;
+    pthread_t producers[run->producers];
+    producer_arg_t producer_arg[run->producers];
+    pthread_barrier_t start;
+    struct rusage usage_start, usage_end;
+    uint64_t time_start, time_end;
+    unsigned long total = 0;
+    unsigned int i;
+    int rc = 0;
+
+    worker_attr_init(&attr);
+    attr.working_queue_size = run->queue_size;
+    attr.working_queue_entry_size = run->entry_size;
+    attr.do_work = bench_do_work;
+    attr.queue_mode = run->queue_mode;
+
+    histogram_init(&latency);
+    handler_cost_ns = run->handler_ns;
+
+    if (create_worker_with_attr(&worker, &attr))
+    {
+        return -1;
+    }
+
+    pthread_barrier_init(&start, NULL, run->producers + 1);
+
+    for (i = 0; i < run->producers; i++)
+    {
+        producer_arg[i].worker = worker;
+        producer_arg[i].start = &start;
+        producer_arg[i].entries = run->entries / run->producers + (i < run->entries % run->producers);
+        total += producer_arg[i].entries;
+
+        if (pthread_create(&producers[i], NULL, producer_thread, &producer_arg[i]))
+        {
+            //Producers already waiting at the barrier can not be released
+            printf("Error: creating producer thread failed\n");
+            exit(-1);
+        }
+    }
+
+    getrusage(RUSAGE_SELF, &usage_start);
+    time_start = now_ns();
+
+    pthread_barrier_wait(&start);
+
+    for (i = 0; i < run->producers; i++)
+    {
+        pthread_join(producers[i], NULL);
+    }
+
+    //Stopping the worker waits for the queue to drain
+    stop_worker(worker);
+
+    time_end = now_ns();
+    getrusage(RUSAGE_SELF, &usage_end);
+
+    get_worker_stats(worker, &stats);
+
+    printf("{\"bench\":\"worker\",\"queue_mode\":\"%s\",\"producers\":%u,\"entry_size\":%u,\"queue_size\":%u,\"handler_ns\":%u,"
+           "\"entries\":%lu,\"seconds\":%.6f,\"entries_per_second\":%.0f,"
+           "\"latency_ns\":{\"p50\":%llu,\"p99\":%llu,\"p999\":%llu,\"max\":%llu},"
+           "\"producer_blocked\":%lu,\"voluntary_context_switches\":%ld,\"involuntary_context_switches\":%ld}\n",
+           run->queue_mode == WORKING_QUEUE_MODE_SPSC ? "spsc" : "locked",
+           run->producers, run->entry_size, worker->working_queue.max_queue_size, run->handler_ns,
+           total, (time_end - time_start) / 1e9, total / ((time_end - time_start) / 1e9),
+           (unsigned long long) histogram_percentile(&latency, 50),
+           (unsigned long long) histogram_percentile(&latency, 99),
+           (unsigned long long) histogram_percentile(&latency, 99.9),
+           (unsigned long long) latency.max,
+           stats.blocked,
+           usage_end.ru_nvcsw - usage_start.ru_nvcsw,
+           usage_end.ru_nivcsw - usage_start.ru_nivcsw);
+    fflush(stdout);
+
+    if (stats.dequeued != total)
+    {
+        rc = -1;
+    }
+
+    pthread_barrier_destroy(&start);
+    worker_clean_up(&worker);
+
+    return rc;
+}
+
+
+static void usage(const char *name)
+{
+    printf("Usage: %s [-m locked,spsc] [-p producers] [-e entry sizes] [-q queue sizes] [-w handler ns] [-n entries]\n"
+           "Lists are comma separated, every combination is measured. The SPSC queue is measured with one producer only.\n",
+           name);
+}
+
+
+int main(int argc, char *argv[])
+{
+    value_list_t producers, entry_sizes, queue_sizes, handler_costs;
+    bool mode_locked = true, mode_spsc = true;
+    bench_run_t run = { .entries = 1000000 };
+    unsigned int m, p, e, q, w;
+    int opt;
+    int rc = 0;
+
+    char default_entry_sizes[64];
+
+    //The queue entry of the subscriber and the legacy payload it replaced
+    snprintf(default_entry_sizes, sizeof(default_entry_sizes), "8,%zu,%zu,1024", sizeof(reading_t), sizeof(ambient_t));
+
+    parse_list("1,2,4", &producers);
+    parse_list(default_entry_sizes, &entry_sizes);
+    parse_list("32,1024", &queue_sizes);
+    parse_list("0,1000", &handler_costs);
+
+    while((opt = getopt(argc, argv, "m:p:e:q:w:n:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'm':
+            mode_locked = (strstr(optarg, "locked") != NULL);
+            mode_spsc = (strstr(optarg, "spsc") != NULL);
+            break;
+        case 'p':
+            rc |= parse_list(optarg, &producers);
+            break;
+        case 'e':
+            rc |= parse_list(optarg, &entry_sizes);
+            break;
+        case 'q':
+            rc |= parse_list(optarg, &queue_sizes);
+            break;
+        case 'w':
+            rc |= parse_list(optarg, &handler_costs);
+            break;
+        case 'n':
+            run.entries = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            rc = -1;
+            break;
+        }
+    }
+
+    if (rc || !run.entries || !(mode_locked || mode_spsc))
+    {
+        usage(argv[0]);
+        return -1;
+    }
+
+    for (m = 0; m < 2; m++)
+    {
+        run.queue_mode = m ? WORKING_QUEUE_MODE_SPSC : WORKING_QUEUE_MODE_LOCKED;
+
+        if ((m && !mode_spsc) || (!m && !mode_locked))
+        {
+            continue;
+        }
+
+        for (p = 0; p < producers.size; p++)
+        {
+            run.producers = producers.value[p];
+
+            //The SPSC ring accepts entries from one thread only
+            if (!run.producers || ((run.queue_mode == WORKING_QUEUE_MODE_SPSC) && (run.producers > 1)))
+            {
+                continue;
+            }
+
+            for (e = 0; e < entry_sizes.size; e++)
+            {
+                //The entry carries the enqueue timestamp
+                run.entry_size = entry_sizes.value[e] < sizeof(uint64_t) ? sizeof(uint64_t) : entry_sizes.value[e];
+
+                for (q = 0; q < queue_sizes.size; q++)
+                {
+                    run.queue_size = queue_sizes.value[q];
+
+                    for (w = 0; w < handler_costs.size; w++)
+                    {
+                        run.handler_ns = handler_costs.value[w];
+
+                        if (bench_run(&run))
+                        {
+                            printf("Error: benchmark run failed\n");
+                            rc = -1;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    return rc;
+}
@@ -0,0 +1,300 @@
+/**
+* @file aggregator.c
+*
+* @brief Implementation of the rolling window statistics of the readings.
+*
+* @date 17-Oct-2026
+* @copyright GNU General Public License v3
+*
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "aggregator.h"
+
+
+int aggregator_windows_from_string(const char *list, unsigned int window_seconds[AGGREGATOR_MAX_WINDOWS])
+{
+    unsigned long seconds;
+    char *end;
+    int number_of_windows = 0;
+
+    if (!list[0])
+    {
+        list = AGGREGATOR_DEFAULT_WINDOWS;
+    }
+
+    while (1)
+    {
+        seconds = strtoul(list, &end, 10);
+
+        if ((end == list) || !seconds || (seconds > 86400) || (number_of_windows == AGGREGATOR_MAX_WINDOWS))
+        {
+            return -1;
+        }
+
+        window_seconds[number_of_windows++] = (unsigned int) seconds;
+
+        if (!*end)
+        {
+            return number_of_windows;
+        }
+
+        if (*end != ',')
+        {
+            return -1;
+        }
+
+        list = end + 1;
+    }
+}
+
+
+int aggregator_init(aggregator_t *aggregator, const unsigned int *window_seconds, unsigned int number_of_windows)
+{
+    unsigned int i;
+
+    memset(aggregator, 0, sizeof(aggregator_t));
+
+    if (!number_of_windows || (number_of_windows > AGGREGATOR_MAX_WINDOWS))
+    {
+        return -1;
+    }
+
+    aggregator->number_of_windows = number_of_windows;
+
+    for (i = 0; i < number_of_windows; i++)
+    {
+        aggregator->window_seconds[i] = window_seconds[i];
+        aggregator->slot_ns[i] = window_seconds[i] * 1000000000ull / AGGREGATOR_SLOTS;
+    }
+
+    aggregator->locations_capacity = 64;
+    aggregator->locations = calloc(aggregator->locations_capacity, sizeof(aggregator_location_t *));
+
+    if (!aggregator->locations)
+    {
+        return -1;
+    }
+
+    //Start one day earlier, so the zeroed slots of a new location, with round 0, are never valid.
+    //The unsigned differences to the start time stay correct also shortly after boot.
+    aggregator->start_time = monotonic_time_ns() - 1000000000ull * 86400;
+
+    pthread_mutex_init(&(aggregator->lock), NULL);
+
+    return 0;
+}
+
+
+/**
+ * @brief Returns the windows of the location. The windows of a new location are allocated.
+ *
+ * @return windows of the location, NULL if memory could not be allocated
+ */
+static aggregator_location_t *find_location(aggregator_t *aggregator, uint32_t location_id)
+{
+    aggregator_location_t **locations;
+    uint32_t capacity = aggregator->locations_capacity;
+
+    if ((location_id < capacity) && aggregator->locations[location_id])
+    {
+        return aggregator->locations[location_id];
+    }
+
+    if (location_id >= capacity)
+    {
+        while (capacity <= location_id)
+        {
+            capacity *= 2;
+        }
+
+        locations = realloc(aggregator->locations, capacity * sizeof(aggregator_location_t *));
+
+        if (!locations)
+        {
+            return NULL;
+        }
+
+        memset(locations + aggregator->locations_capacity, 0, (capacity - aggregator->locations_capacity) * sizeof(aggregator_location_t *));
+        aggregator->locations = locations;
+        aggregator->locations_capacity = capacity;
+    }
+
+    aggregator->locations[location_id] = calloc(1, sizeof(aggregator_location_t));
+
+    return aggregator->locations[location_id];
+}
+
+
+/**
+ * @brief Adds the values of a reading to the slot of the current round, clearing the slot when
+ * it was left from an earlier round.
+ */
+static void window_add(aggregator_window_t *window, uint64_t round, const double values[AGGREGATOR_VALUES])
+{
+    unsigned int slot = round % AGGREGATOR_SLOTS;
+    unsigned int v;
+
+    if (window->round[slot] != round)
+    {
+        window->round[slot] = round;
+        window->count[slot] = 0;
+
+        for (v = 0; v < AGGREGATOR_VALUES; v++)
+        {
+            window->sum[v][slot] = 0;
+            window->sum_of_squares[v][slot] = 0;
+            window->min[v][slot] = INFINITY;
+            window->max[v][slot] = -INFINITY;
+        }
+    }
+
+    window->count[slot]++;
+
+    for (v = 0; v < AGGREGATOR_VALUES; v++)
+    {
+        window->sum[v][slot] += values[v];
+        window->sum_of_squares[v][slot] += values[v] * values[v];
+        window->min[v][slot] = values[v] < window->min[v][slot] ? values[v] : window->min[v][slot];
+        window->max[v][slot] = values[v] > window->max[v][slot] ? values[v] : window->max[v][slot];
+    }
+}
+
+
+int aggregator_add(aggregator_t *aggregator, const void *readings, unsigned int number_of_readings, size_t entry_size)
+{
+    const reading_t *reading;
+    aggregator_location_t *location;
+    uint64_t rounds[AGGREGATOR_MAX_WINDOWS];
+    uint64_t elapsed = monotonic_time_ns() - aggregator->start_time;
+    double values[AGGREGATOR_VALUES];
+    unsigned int w;
+    int rc = 0;
+
+    for (w = 0; w < aggregator->number_of_windows; w++)
+    {
+        rounds[w] = elapsed / aggregator->slot_ns[w];
+    }
+
+    pthread_mutex_lock(&(aggregator->lock));
+
+    for (; number_of_readings; number_of_readings--, readings = (const char *) readings + entry_size)
+    {
+        reading = (const reading_t *) readings;
+        location = find_location(aggregator, reading->location_id);
+
+        if (!location)
+        {
+            rc = -1;
+            continue;
+        }
+
+        values[0] = reading->temperature;
+        values[1] = reading->pressure;
+        values[2] = reading->humidity;
+
+        for (w = 0; w < aggregator->number_of_windows; w++)
+        {
+            window_add(&(location->windows[w]), rounds[w], values);
+        }
+    }
+
+    pthread_mutex_unlock(&(aggregator->lock));
+
+    return rc;
+}
+
+
+/**
+ * @brief Reduces the valid slots of a window. The slots of the invalid rounds contribute the
+ * neutral element, so every loop runs over the whole arrays without branches.
+ */
+static void window_reduce(const aggregator_window_t *window, uint64_t round, aggregate_t *aggregate)
+{
+    double valid[AGGREGATOR_SLOTS];
+    double count = 0, sum, sum_of_squares, min, max, variance;
+    unsigned int s, v;
+
+    for (s = 0; s < AGGREGATOR_SLOTS; s++)
+    {
+        valid[s] = (window->round[s] + AGGREGATOR_SLOTS > round) ? 1.0 : 0.0;
+        count += valid[s] * window->count[s];
+    }
+
+    aggregate->count = (unsigned long) count;
+
+    for (v = 0; v < AGGREGATOR_VALUES; v++)
+    {
+        sum = 0;
+        sum_of_squares = 0;
+        min = INFINITY;
+        max = -INFINITY;
+
+        for (s = 0; s < AGGREGATOR_SLOTS; s++)
+        {
+            sum += valid[s] * window->sum[v][s];
+            sum_of_squares += valid[s] * window->sum_of_squares[v][s];
+            min = (valid[s] != 0.0) && (window->min[v][s] < min) ? window->min[v][s] : min;
+            max = (valid[s] != 0.0) && (window->max[v][s] > max) ? window->max[v][s] : max;
+        }
+
+        if (!count)
+        {
+            aggregate->min[v] = aggregate->max[v] = aggregate->mean[v] = aggregate->stddev[v] = 0;
+            continue;
+        }
+
+        variance = sum_of_squares / count - (sum / count) * (sum / count);
+
+        aggregate->min[v] = min;
+        aggregate->max[v] = max;
+        aggregate->mean[v] = sum / count;
+        aggregate->stddev[v] = variance > 0 ? sqrt(variance) : 0;
+    }
+}
+
+
+int aggregator_get(aggregator_t *aggregator, uint32_t location_id, aggregate_t aggregates[AGGREGATOR_MAX_WINDOWS])
+{
+    uint64_t elapsed = monotonic_time_ns() - aggregator->start_time;
+    unsigned int w;
+
+    pthread_mutex_lock(&(aggregator->lock));
+
+    if ((location_id >= aggregator->locations_capacity) || !aggregator->locations[location_id])
+    {
+        pthread_mutex_unlock(&(aggregator->lock));
+        return -1;
+    }
+
+    for (w = 0; w < aggregator->number_of_windows; w++)
+    {
+        aggregates[w].seconds = aggregator->window_seconds[w];
+        window_reduce(&(aggregator->locations[location_id]->windows[w]), elapsed / aggregator->slot_ns[w], &aggregates[w]);
+    }
+
+    pthread_mutex_unlock(&(aggregator->lock));
+
+    return 0;
+}
+
+
+void aggregator_clean_up(aggregator_t *aggregator)
+{
+    uint32_t i;
+
+    for (i = 0; i < aggregator->locations_capacity; i++)
+    {
+        free(aggregator->locations[i]);
+    }
+
+    free(aggregator->locations);
+    aggregator->locations = NULL;
+    aggregator->locations_capacity = 0;
+
+    pthread_mutex_destroy(&(aggregator->lock));
+}
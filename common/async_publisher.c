@@ -0,0 +1,396 @@
+/**
+* @file async_publisher.c
+*
+* @brief Implementation of the asynchronous MQTT publisher.
+*
+* @date 17-Oct-2026
+* @copyright GNU General Public License v3
+*
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "mqtt_userdefs.h"
+#include "async_publisher.h"
+
+#define ASYNC_PUBLISHER_CONNECT_TIMEOUT 10     /**< Seconds to wait for the broker to accept the first connection. */
+
+
+/**
+ * @brief Libmosquitto calls this function from the network thread when the broker answered the
+ * connection request.
+ */
+static void on_connect(struct mosquitto *mosq, void *userdata, int result)
+{
+    async_publisher_t *publisher = (async_publisher_t *) userdata;
+
+    if (result)
+    {
+        //Network thread keeps trying to reconnect
+        return;
+    }
+
+    __atomic_store_n(&(publisher->is_connected), true, __ATOMIC_RELAXED);
+
+    if (__atomic_add_fetch(&(publisher->connections), 1, __ATOMIC_RELAXED) == 1)
+    {
+        sem_post(&(publisher->connected));
+    }
+}
+
+
+/**
+ * @brief Libmosquitto calls this function from the network thread when the connection is closed.
+ */
+static void on_disconnect(struct mosquitto *mosq, void *userdata, int result)
+{
+    async_publisher_t *publisher = (async_publisher_t *) userdata;
+
+    __atomic_store_n(&(publisher->is_connected), false, __ATOMIC_RELAXED);
+}
+
+
+/**
+ * @brief Returns the first slot of the message id in the in-flight table.
+ */
+static inline unsigned int in_flight_slot(const async_publisher_t *publisher, int mid)
+{
+    return (unsigned int) (mid < 0 ? -mid : mid) & (publisher->in_flight_size - 1);
+}
+
+
+/**
+ * @brief Looks the message up in the in-flight table. Caller holds in_flight_lock.
+ *
+ * @param[in] publisher publisher object
+ * @param[in] mid message id, negative for a message completed before its publish time was stored
+ *
+ * @return slot of the message, NULL if it is not in the table
+ */
+static in_flight_message_t *in_flight_find(async_publisher_t *publisher, int mid)
+{
+    unsigned int mask = publisher->in_flight_size - 1;
+    unsigned int i;
+
+    for (i = in_flight_slot(publisher, mid); publisher->in_flight[i].mid; i = (i + 1) & mask)
+    {
+        if (publisher->in_flight[i].mid == mid)
+        {
+            return &(publisher->in_flight[i]);
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief Adds the message to the in-flight table, which is kept at most half full. Caller holds
+ * in_flight_lock.
+ *
+ * @return 0 on success, -1 if the table could not grow; the time of the message is not recorded then
+ */
+static int in_flight_insert(async_publisher_t *publisher, int mid, uint64_t publish_time)
+{
+    in_flight_message_t *in_flight = publisher->in_flight;
+    unsigned int size = publisher->in_flight_size;
+    unsigned int mask, i, j;
+
+    if (2 * (publisher->in_flight_count + 1) > size)
+    {
+        //QoS 0 messages have no window, the table grows with the messages waiting in libmosquitto
+        publisher->in_flight = calloc(2 * size, sizeof(in_flight_message_t));
+
+        if (!publisher->in_flight)
+        {
+            publisher->in_flight = in_flight;
+            return -1;
+        }
+
+        publisher->in_flight_size = 2 * size;
+        mask = publisher->in_flight_size - 1;
+
+        for (i = 0; i < size; i++)
+        {
+            if (!in_flight[i].mid)
+            {
+                continue;
+            }
+
+            for (j = in_flight_slot(publisher, in_flight[i].mid); publisher->in_flight[j].mid; j = (j + 1) & mask);
+
+            publisher->in_flight[j] = in_flight[i];
+        }
+
+        free(in_flight);
+    }
+
+    mask = publisher->in_flight_size - 1;
+
+    for (i = in_flight_slot(publisher, mid); publisher->in_flight[i].mid; i = (i + 1) & mask);
+
+    publisher->in_flight[i].mid = mid;
+    publisher->in_flight[i].publish_time = publish_time;
+    publisher->in_flight_count++;
+
+    return 0;
+}
+
+
+/**
+ * @brief Removes the message from the in-flight table. The following slots of the probe
+ * sequence are shifted back, so lookups need no tombstones. Caller holds in_flight_lock.
+ */
+static void in_flight_remove(async_publisher_t *publisher, in_flight_message_t *message)
+{
+    in_flight_message_t *in_flight = publisher->in_flight;
+    unsigned int mask = publisher->in_flight_size - 1;
+    unsigned int i = (unsigned int) (message - in_flight);
+    unsigned int j;
+
+    for (j = (i + 1) & mask; in_flight[j].mid; j = (j + 1) & mask)
+    {
+        //Move the slot into the hole unless the hole lies before its home slot
+        if (((j - in_flight_slot(publisher, in_flight[j].mid)) & mask) >= ((j - i) & mask))
+        {
+            in_flight[i] = in_flight[j];
+            i = j;
+        }
+    }
+
+    in_flight[i].mid = 0;
+    publisher->in_flight_count--;
+}
+
+
+/**
+ * @brief Libmosquitto calls this function from the network thread when the broker acknowledged a
+ * QoS 1/2 message, or when a QoS 0 message was written to the socket.
+ */
+static void on_publish(struct mosquitto *mosq, void *userdata, int mid)
+{
+    async_publisher_t *publisher = (async_publisher_t *) userdata;
+    in_flight_message_t *message;
+
+    pthread_mutex_lock(&(publisher->in_flight_lock));
+
+    message = in_flight_find(publisher, mid);
+
+    if (message)
+    {
+        histogram_record(&(publisher->time_to_ack), monotonic_time_ns() - message->publish_time);
+        in_flight_remove(publisher, message);
+    }
+    else
+    {
+        //Completed before async_publish() stored the publish time. It records the time instead.
+        in_flight_insert(publisher, -mid, 0);
+    }
+
+    pthread_mutex_unlock(&(publisher->in_flight_lock));
+
+    __atomic_add_fetch(&(publisher->completed), 1, __ATOMIC_RELAXED);
+
+    if (publisher->qos)
+    {
+        sem_post(&(publisher->free_slots));
+    }
+}
+
+
+/**
+ * @brief Initializes the publisher and creates its libmosquitto client.
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int init_publisher(async_publisher_t *publisher, int qos, unsigned int window)
+{
+    memset(publisher, 0, sizeof(async_publisher_t));
+
+    publisher->qos = qos;
+    publisher->window = window ? window : ASYNC_PUBLISHER_DEFAULT_WINDOW;
+
+    //Room for a window of messages with the table half full, it grows for more
+    for (publisher->in_flight_size = 1; publisher->in_flight_size < 4 * publisher->window; publisher->in_flight_size <<= 1);
+
+    publisher->in_flight = calloc(publisher->in_flight_size, sizeof(in_flight_message_t));
+    if (!publisher->in_flight)
+    {
+        return -1;
+    }
+
+    histogram_init(&(publisher->time_to_ack));
+    pthread_mutex_init(&(publisher->in_flight_lock), NULL);
+    sem_init(&(publisher->free_slots), 0, publisher->window);
+    sem_init(&(publisher->connected), 0, 0);
+
+    publisher->mosq = mosquitto_new(NULL, true, publisher);
+
+    if (!publisher->mosq)
+    {
+        async_publisher_stop(publisher, 0);
+        return -1;
+    }
+
+    mosquitto_connect_callback_set(publisher->mosq, on_connect);
+    mosquitto_disconnect_callback_set(publisher->mosq, on_disconnect);
+    mosquitto_publish_callback_set(publisher->mosq, on_publish);
+    mosquitto_max_inflight_messages_set(publisher->mosq, publisher->window);
+
+    return 0;
+}
+
+
+int async_publisher_start(async_publisher_t *publisher, const char *hostname, int port, int qos, unsigned int window)
+{
+    struct timespec deadline;
+
+    if (init_publisher(publisher, qos, window))
+    {
+        return -1;
+    }
+
+    //The network thread completes the connection and reconnects when it is lost
+    if ((mosquitto_connect_async(publisher->mosq, hostname, port, 60) != MOSQ_ERR_SUCCESS) || (mosquitto_loop_start(publisher->mosq) != MOSQ_ERR_SUCCESS))
+    {
+        async_publisher_stop(publisher, 0);
+        return -1;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += ASYNC_PUBLISHER_CONNECT_TIMEOUT;
+
+    while (sem_timedwait(&(publisher->connected), &deadline))
+    {
+        if (errno != EINTR)
+        {
+            async_publisher_stop(publisher, 0);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+int async_publisher_attach(async_publisher_t *publisher, event_loop_t *loop, const char *hostname, int port, int qos, unsigned int window)
+{
+    if (init_publisher(publisher, qos, window))
+    {
+        return -1;
+    }
+
+    //The CONNECT packet is sent at once, the loop reads the answer of the broker
+    if ((mosquitto_connect(publisher->mosq, hostname, port, 60) != MOSQ_ERR_SUCCESS) ||
+        event_loop_add_client(loop, &(publisher->source), publisher->mosq))
+    {
+        async_publisher_stop(publisher, 0);
+        return -1;
+    }
+
+    publisher->loop = loop;
+
+    return 0;
+}
+
+
+bool async_publisher_idle(const async_publisher_t *publisher)
+{
+    return __atomic_load_n(&(publisher->completed), __ATOMIC_RELAXED) >= __atomic_load_n(&(publisher->published), __ATOMIC_RELAXED);
+}
+
+
+int async_publish(async_publisher_t *publisher, const char *topic, const void *payload, int payload_length)
+{
+    in_flight_message_t *message;
+    uint64_t publish_time = monotonic_time_ns();
+    int mid;
+    int rc;
+
+    //Wait for a free slot in the in-flight window. The loop thread must not wait for itself.
+    if (publisher->qos && publisher->loop)
+    {
+        if (sem_trywait(&(publisher->free_slots)))
+        {
+            __atomic_add_fetch(&(publisher->window_full), 1, __ATOMIC_RELAXED);
+            return MOSQ_ERR_NOMEM;
+        }
+    }
+    else if (publisher->qos)
+    {
+        while (sem_wait(&(publisher->free_slots)) && (errno == EINTR));
+    }
+
+    rc = mosquitto_publish(publisher->mosq, &mid, topic, payload_length, payload, publisher->qos, false);
+
+    if (rc != MOSQ_ERR_SUCCESS)
+    {
+        __atomic_add_fetch(&(publisher->failed), 1, __ATOMIC_RELAXED);
+
+        if (publisher->qos)
+        {
+            sem_post(&(publisher->free_slots));
+        }
+
+        return rc;
+    }
+
+    __atomic_add_fetch(&(publisher->published), 1, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&(publisher->in_flight_lock));
+
+    message = in_flight_find(publisher, -mid);
+
+    if (message)
+    {
+        histogram_record(&(publisher->time_to_ack), monotonic_time_ns() - publish_time);
+        in_flight_remove(publisher, message);
+    }
+    else
+    {
+        in_flight_insert(publisher, mid, publish_time);
+    }
+
+    pthread_mutex_unlock(&(publisher->in_flight_lock));
+
+    return MOSQ_ERR_SUCCESS;
+}
+
+
+void async_publisher_stop(async_publisher_t *publisher, unsigned int timeout_ms)
+{
+    struct timespec wait = { .tv_sec = 0, .tv_nsec = 1000000L };
+    unsigned int waited_ms;
+
+    //Give the network thread time to complete the outstanding messages
+    for (waited_ms = 0; !publisher->loop && (waited_ms < timeout_ms) && !async_publisher_idle(publisher); waited_ms++)
+    {
+        nanosleep(&wait, NULL);
+    }
+
+    if (publisher->loop)
+    {
+        event_loop_remove(publisher->loop, &(publisher->source));
+        mosquitto_disconnect(publisher->mosq);
+        mosquitto_destroy(publisher->mosq);
+        publisher->mosq = NULL;
+        publisher->loop = NULL;
+    }
+    else if (publisher->mosq)
+    {
+        mosquitto_disconnect(publisher->mosq);
+        mosquitto_loop_stop(publisher->mosq, false);
+        mosquitto_destroy(publisher->mosq);
+        publisher->mosq = NULL;
+    }
+
+    sem_destroy(&(publisher->connected));
+    sem_destroy(&(publisher->free_slots));
+    pthread_mutex_destroy(&(publisher->in_flight_lock));
+
+    free(publisher->in_flight);
+    publisher->in_flight = NULL;
+}
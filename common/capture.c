@@ -0,0 +1,169 @@
+/**
+* @file capture.c
+*
+* @brief Implementation of the capture file of received MQTT messages.
+*
+* @date 17-Oct-2026
+* @copyright GNU General Public License v3
+*
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <endian.h>
+
+#include "mqtt_userdefs.h"
+#include "capture.h"
+
+
+/**
+ * @brief Opens the file with a large stdio buffer.
+ */
+static int capture_file_open(capture_t *capture, const char *path, const char *mode)
+{
+    memset(capture, 0, sizeof(capture_t));
+
+    capture->file = fopen(path, mode);
+
+    if (!capture->file)
+    {
+        return -1;
+    }
+
+    capture->buffer = malloc(CAPTURE_BUFFER_SIZE);
+
+    if (capture->buffer)
+    {
+        setvbuf(capture->file, capture->buffer, _IOFBF, CAPTURE_BUFFER_SIZE);
+    }
+
+    return 0;
+}
+
+
+int capture_create(capture_t *capture, const char *path)
+{
+    capture_file_header_t header;
+    struct timespec now;
+
+    if (capture_file_open(capture, path, "wb"))
+    {
+        return -1;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    capture->start_time = monotonic_time_ns();
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CAPTURE_MAGIC, sizeof(header.magic));
+    header.version = htole32(CAPTURE_VERSION);
+    header.start_time = htole64((uint64_t) now.tv_sec * 1000000000ull + now.tv_nsec);
+
+    if (fwrite(&header, sizeof(header), 1, capture->file) != 1)
+    {
+        capture_close(capture);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+int capture_write(capture_t *capture, const char *topic, const void *payload, uint32_t payload_length)
+{
+    capture_record_header_t header;
+    size_t topic_length = strlen(topic);
+
+    if ((topic_length > CAPTURE_MAX_TOPIC_LENGTH) || (payload_length > CAPTURE_MAX_PAYLOAD_LENGTH))
+    {
+        return -1;
+    }
+
+    header.time = htole64(monotonic_time_ns() - capture->start_time);
+    header.topic_length = htole16((uint16_t) topic_length);
+    header.reserved = 0;
+    header.payload_length = htole32(payload_length);
+
+    if ((fwrite(&header, sizeof(header), 1, capture->file) != 1) ||
+        (fwrite(topic, 1, topic_length, capture->file) != topic_length) ||
+        (fwrite(payload, 1, payload_length, capture->file) != payload_length))
+    {
+        return -1;
+    }
+
+    capture->messages++;
+
+    return 0;
+}
+
+
+int capture_open(capture_t *capture, const char *path)
+{
+    capture_file_header_t header;
+
+    if (capture_file_open(capture, path, "rb"))
+    {
+        return -1;
+    }
+
+    capture->payload = malloc(CAPTURE_MAX_PAYLOAD_LENGTH);
+
+    if (!capture->payload ||
+        (fread(&header, sizeof(header), 1, capture->file) != 1) ||
+        memcmp(header.magic, CAPTURE_MAGIC, sizeof(header.magic)) ||
+        (le32toh(header.version) < 1))
+    {
+        capture_close(capture);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+int capture_read(capture_t *capture)
+{
+    capture_record_header_t header;
+    size_t topic_length;
+    size_t length;
+
+    length = fread(&header, 1, sizeof(header), capture->file);
+
+    if (length != sizeof(header))
+    {
+        //The capture ends between records, a header cut off by the end of the file is damaged
+        return (!length && feof(capture->file)) ? 0 : -1;
+    }
+
+    topic_length = le16toh(header.topic_length);
+    capture->payload_length = le32toh(header.payload_length);
+    capture->time = le64toh(header.time);
+
+    if ((capture->payload_length > CAPTURE_MAX_PAYLOAD_LENGTH) ||
+        (fread(capture->topic, 1, topic_length, capture->file) != topic_length) ||
+        (fread(capture->payload, 1, capture->payload_length, capture->file) != capture->payload_length))
+    {
+        return -1;
+    }
+
+    capture->topic[topic_length] = '\0';
+    capture->messages++;
+
+    return 1;
+}
+
+
+void capture_close(capture_t *capture)
+{
+    if (capture->file)
+    {
+        fclose(capture->file);
+        capture->file = NULL;
+    }
+
+    free(capture->buffer);
+    free(capture->payload);
+    capture->buffer = NULL;
+    capture->payload = NULL;
+}
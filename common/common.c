@@ -12,7 +12,9 @@
 #include <getopt.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 #include <unistd.h>
+#include <time.h>
 #include <sys/types.h>
 
 #include "mqtt_userdefs.h"
@@ -24,7 +26,7 @@ int process_arguments(int argc, char *argv[], start_arg_t *start_arg)
 
     snprintf(start_arg->location, sizeof(start_arg->location), "%s_%d", "location", getpid());
 
-    while((opt = getopt(argc, argv, "b:p:l:")) != -1)
+    while((opt = getopt(argc, argv, "b:p:l:w:q:o:s:cn:r:t:mf:a:d:Q:I:O:S:C:x:A:W:P:e:v:k:K:R:")) != -1)
     {
         switch (opt)
         {
@@ -37,6 +39,84 @@ int process_arguments(int argc, char *argv[], start_arg_t *start_arg)
         case 'l':
             snprintf(start_arg->location, sizeof(start_arg->location), "%s", optarg);
             break;
+        case 'w':
+            start_arg->number_of_workers = (unsigned int) atoi(optarg);
+            break;
+        case 'q':
+            start_arg->queue_size = (unsigned int) atoi(optarg);
+            break;
+        case 'o':
+            snprintf(start_arg->overflow_policy, sizeof(start_arg->overflow_policy), "%s", optarg);
+            break;
+        case 's':
+            start_arg->stats_interval = (unsigned int) atoi(optarg);
+            break;
+        case 'c':
+            start_arg->conflate = true;
+            break;
+        case 'n':
+            start_arg->number_of_publishers = (unsigned int) atoi(optarg);
+            break;
+        case 'r':
+            start_arg->publish_rate = (unsigned int) atoi(optarg);
+            break;
+        case 't':
+            start_arg->duration = (unsigned int) atoi(optarg);
+            break;
+        case 'm':
+            start_arg->measure = true;
+            break;
+        case 'f':
+            snprintf(start_arg->payload_format, sizeof(start_arg->payload_format), "%s", optarg);
+            break;
+        case 'a':
+            start_arg->batch_size = (unsigned int) atoi(optarg);
+            break;
+        case 'd':
+            start_arg->batch_latency_ms = (unsigned int) atoi(optarg);
+            break;
+        case 'Q':
+            start_arg->qos = (unsigned int) atoi(optarg) > MQTT_QOS_2 ? MQTT_QOS_2 : (unsigned int) atoi(optarg);
+            break;
+        case 'I':
+            start_arg->max_inflight = (unsigned int) atoi(optarg);
+            break;
+        case 'O':
+            snprintf(start_arg->output, sizeof(start_arg->output), "%s", optarg);
+            break;
+        case 'S':
+            snprintf(start_arg->store_directory, sizeof(start_arg->store_directory), "%s", optarg);
+            break;
+        case 'C':
+            snprintf(start_arg->capture_file, sizeof(start_arg->capture_file), "%s", optarg);
+            break;
+        case 'x':
+            start_arg->replay_speed = atof(optarg);
+            break;
+        case 'A':
+            start_arg->aggregate_interval = (unsigned int) atoi(optarg);
+            break;
+        case 'W':
+            snprintf(start_arg->aggregate_windows, sizeof(start_arg->aggregate_windows), "%s", optarg);
+            break;
+        case 'P':
+            start_arg->sample_period_ms = (unsigned int) atoi(optarg);
+            break;
+        case 'e':
+            snprintf(start_arg->sensor, sizeof(start_arg->sensor), "%s", optarg);
+            break;
+        case 'v':
+            start_arg->number_of_devices = (unsigned int) atoi(optarg);
+            break;
+        case 'k':
+            snprintf(start_arg->worker_cpus, sizeof(start_arg->worker_cpus), "%s", optarg);
+            break;
+        case 'K':
+            snprintf(start_arg->network_cpus, sizeof(start_arg->network_cpus), "%s", optarg);
+            break;
+        case 'R':
+            snprintf(start_arg->scheduling, sizeof(start_arg->scheduling), "%s", optarg);
+            break;
         default:
             break;
         }
@@ -44,3 +124,34 @@ int process_arguments(int argc, char *argv[], start_arg_t *start_arg)
 
     return 0;
 }
+
+
+uint32_t location_hash(const char *location)
+{
+    return location_hash_n(location, strlen(location));
+}
+
+
+uint32_t location_hash_n(const char *text, size_t length)
+{
+    uint32_t hash = 2166136261u;
+    size_t i;
+
+    for (i = 0; i < length; i++)
+    {
+        hash ^= (uint8_t) text[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+
+uint64_t monotonic_time_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * 1000000000ull + now.tv_nsec;
+}
@@ -0,0 +1,357 @@
+/**
+* @file event_loop.c
+*
+* @brief Implementation of the epoll event loop.
+*
+* @date 17-Oct-2026
+* @copyright GNU General Public License v3
+*
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#include "event_loop.h"
+
+
+/**
+ * @brief Registers the source with epoll, or changes its events.
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int watch(event_loop_t *loop, event_loop_source_t *source, uint32_t events, int operation)
+{
+    struct epoll_event event;
+
+    memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.ptr = source;
+
+    if (epoll_ctl(loop->epoll_fd, operation, source->fd, &event))
+    {
+        return -1;
+    }
+
+    source->events = events;
+
+    return 0;
+}
+
+
+/**
+ * @brief Follows the socket of the client: registers a new socket after a reconnect and watches
+ * for writability only while libmosquitto has output pending.
+ *
+ * Called after every libmosquitto call that can close or replace the socket, so a closed socket
+ * is forgotten before its number can be reused.
+ */
+static void sync_client(event_loop_t *loop, event_loop_source_t *client)
+{
+    int socket = mosquitto_socket(client->mosq);
+    uint32_t events;
+
+    if (socket != client->fd)
+    {
+        //A closed socket left the epoll set by itself, the error is expected
+        if (client->fd >= 0)
+        {
+            epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+        }
+
+        client->fd = socket;
+        client->events = 0;
+    }
+
+    if (client->fd < 0)
+    {
+        return;
+    }
+
+    events = EPOLLIN | (mosquitto_want_write(client->mosq) ? EPOLLOUT : 0);
+
+    if (events != client->events)
+    {
+        watch(loop, client, events, client->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD);
+    }
+}
+
+
+/**
+ * @brief Reads or writes the socket of the client.
+ */
+static void service_client(event_loop_t *loop, event_loop_source_t *client, uint32_t events)
+{
+    int rc = MOSQ_ERR_SUCCESS;
+
+    if (events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+    {
+        rc = mosquitto_loop_read(client->mosq, 1);
+        loop->reads++;
+    }
+
+    if ((rc == MOSQ_ERR_SUCCESS) && (events & EPOLLOUT) && (mosquitto_socket(client->mosq) == client->fd))
+    {
+        mosquitto_loop_write(client->mosq, 1);
+        loop->writes++;
+    }
+
+    sync_client(loop, client);
+}
+
+
+/**
+ * @brief Sends the keepalives and reconnects the lost clients, once per second.
+ */
+static void check_clients(event_loop_t *loop, event_loop_source_t *source, uint32_t events)
+{
+    event_loop_source_t *client;
+
+    for (client = loop->clients; client; client = client->next)
+    {
+        mosquitto_loop_misc(client->mosq);
+        sync_client(loop, client);
+
+        //At most one attempt per second, a broker that is down is not polled in a busy loop.
+        //The connection completes in the loop, an unreachable broker does not block the others.
+        if (client->fd < 0)
+        {
+            mosquitto_reconnect_async(client->mosq);
+            loop->reconnects++;
+            sync_client(loop, client);
+        }
+    }
+}
+
+
+/**
+ * @brief Consumes the wakeup of event_loop_stop().
+ */
+static void wake_up(event_loop_t *loop, event_loop_source_t *source, uint32_t events)
+{
+    uint64_t value;
+
+    while (read(source->fd, &value, sizeof(value)) < 0 && (errno == EINTR));
+}
+
+
+int event_loop_init(event_loop_t *loop)
+{
+    memset(loop, 0, sizeof(event_loop_t));
+    loop->wake.fd = -1;
+    loop->misc.fd = -1;
+
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epoll_fd < 0)
+    {
+        return -1;
+    }
+
+    if (event_loop_add_fd(loop, &(loop->wake), eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC), EPOLLIN, wake_up, NULL) ||
+        event_loop_add_timer(loop, &(loop->misc), 0, 0, check_clients, NULL))
+    {
+        event_loop_clean_up(loop);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+int event_loop_add_fd(event_loop_t *loop, event_loop_source_t *source, int fd, uint32_t events, event_loop_handler_f handler, void *context)
+{
+    memset(source, 0, sizeof(event_loop_source_t));
+    source->type = EVENT_LOOP_SOURCE_FD;
+    source->fd = fd;
+    source->handler = handler;
+    source->context = context;
+
+    if ((fd < 0) || watch(loop, source, events, EPOLL_CTL_ADD))
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+int event_loop_add_timer(event_loop_t *loop, event_loop_source_t *source, uint64_t due, uint64_t period_ns, event_loop_handler_f handler, void *context)
+{
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    if (event_loop_add_fd(loop, source, fd, EPOLLIN, handler, context))
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+
+        source->fd = -1;
+        return -1;
+    }
+
+    source->type = EVENT_LOOP_SOURCE_TIMER;
+
+    return due ? event_loop_set_timer(source, due, period_ns) : 0;
+}
+
+
+int event_loop_set_timer(event_loop_source_t *source, uint64_t due, uint64_t period_ns)
+{
+    struct itimerspec timer;
+
+    //Zero it_value disarms the timer, so a due time of 0 is only allowed for disarming
+    timer.it_value.tv_sec = due / 1000000000ull;
+    timer.it_value.tv_nsec = due % 1000000000ull;
+    timer.it_interval.tv_sec = period_ns / 1000000000ull;
+    timer.it_interval.tv_nsec = period_ns % 1000000000ull;
+
+    return timerfd_settime(source->fd, TFD_TIMER_ABSTIME, &timer, NULL) ? -1 : 0;
+}
+
+
+int event_loop_add_client(event_loop_t *loop, event_loop_source_t *source, struct mosquitto *mosq)
+{
+    struct timespec now;
+
+    memset(source, 0, sizeof(event_loop_source_t));
+    source->type = EVENT_LOOP_SOURCE_CLIENT;
+    source->fd = -1;
+    source->mosq = mosq;
+
+    sync_client(loop, source);
+
+    source->next = loop->clients;
+    loop->clients = source;
+
+    //The keepalive checks start with the first client
+    if (!source->next)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        event_loop_set_timer(&(loop->misc), now.tv_sec * 1000000000ull + now.tv_nsec + EVENT_LOOP_MISC_PERIOD_NS, EVENT_LOOP_MISC_PERIOD_NS);
+    }
+
+    return 0;
+}
+
+
+void event_loop_remove(event_loop_t *loop, event_loop_source_t *source)
+{
+    event_loop_source_t **link;
+
+    if (source->fd >= 0)
+    {
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, source->fd, NULL);
+    }
+
+    if (source->type == EVENT_LOOP_SOURCE_CLIENT)
+    {
+        for (link = &(loop->clients); *link && (*link != source); link = &((*link)->next));
+
+        if (*link)
+        {
+            *link = source->next;
+        }
+
+        source->next = NULL;
+    }
+    else if ((source->type == EVENT_LOOP_SOURCE_TIMER) && (source->fd >= 0))
+    {
+        close(source->fd);
+    }
+
+    source->fd = -1;
+    source->events = 0;
+}
+
+
+int event_loop_run(event_loop_t *loop)
+{
+    struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+    event_loop_source_t *source;
+    int number_of_events, i;
+
+    while (!__atomic_load_n(&(loop->stop), __ATOMIC_ACQUIRE))
+    {
+        //The handlers may have published, so the output of every client is checked before sleeping
+        for (source = loop->clients; source; source = source->next)
+        {
+            sync_client(loop, source);
+        }
+
+        number_of_events = epoll_wait(loop->epoll_fd, events, EVENT_LOOP_MAX_EVENTS, -1);
+
+        if (number_of_events < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            printf("Error: epoll_wait failed: %s\n", strerror(errno));
+            return -1;
+        }
+
+        loop->wakeups++;
+
+        for (i = 0; i < number_of_events; i++)
+        {
+            source = (event_loop_source_t *) events[i].data.ptr;
+
+            switch (source->type)
+            {
+            case EVENT_LOOP_SOURCE_CLIENT:
+                service_client(loop, source, events[i].events);
+                break;
+            case EVENT_LOOP_SOURCE_TIMER:
+                if (read(source->fd, &(source->expirations), sizeof(source->expirations)) != sizeof(source->expirations))
+                {
+                    //Rearmed by an earlier handler of the same round, no expiration left
+                    break;
+                }
+
+                source->handler(loop, source, events[i].events);
+                break;
+            default:
+                source->handler(loop, source, events[i].events);
+                break;
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+void event_loop_stop(event_loop_t *loop)
+{
+    uint64_t value = 1;
+    ssize_t written;
+
+    __atomic_store_n(&(loop->stop), true, __ATOMIC_RELEASE);
+
+    written = write(loop->wake.fd, &value, sizeof(value));
+    (void) written;
+}
+
+
+void event_loop_clean_up(event_loop_t *loop)
+{
+    event_loop_remove(loop, &(loop->misc));
+
+    if (loop->wake.fd >= 0)
+    {
+        close(loop->wake.fd);
+        loop->wake.fd = -1;
+    }
+
+    if (loop->epoll_fd >= 0)
+    {
+        close(loop->epoll_fd);
+        loop->epoll_fd = -1;
+    }
+}
@@ -0,0 +1,161 @@
+/**
+* @file ha_json.c
+*
+* @brief Implementation of the Home Assistant ambient payload serializer.
+*
+* @date 17-Oct-2026
+* @copyright GNU General Public License v3
+*
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "ha_json.h"
+
+#define HA_JSON_FAST_LIMIT 1e9          /**< Values below the limit are rounded with integer arithmetic. */
+#define HA_JSON_TIE_MARGIN 1e-4         /**< Distance in hundredths from a tie below which snprintf rounds. */
+
+
+/**
+ * @brief Writes the rounded value with the trailing zeros of the decimals removed, keeping
+ * one digit after the decimal point. The digits are written backwards from the end of the
+ * buffer.
+ *
+ * @return start of the formatted value in the buffer
+ */
+static const char *format_hundredths(char number[HA_JSON_NUMBER_LENGTH], uint64_t hundredths, int negative, size_t *length)
+{
+    char *end = number + HA_JSON_NUMBER_LENGTH;
+    char *start = end;
+    uint64_t integer = hundredths / 100;
+    unsigned int decimals = hundredths % 100;
+
+    if (decimals % 10)
+    {
+        *--start = '0' + decimals % 10;
+    }
+
+    *--start = '0' + decimals / 10;
+    *--start = '.';
+
+    do
+    {
+        *--start = '0' + integer % 10;
+        integer /= 10;
+    } while (integer);
+
+    //"%.2f" keeps the sign of the negative values rounded to zero
+    if (negative)
+    {
+        *--start = '-';
+    }
+
+    *length = end - start;
+
+    return start;
+}
+
+
+/**
+ * @brief Formats the value like jsoncpp does with precision 2 in decimal mode: "%.2f" without
+ * the trailing zeros, keeping one digit after the decimal point.
+ *
+ * The value times 100 has an error of less than 1e-5 below HA_JSON_FAST_LIMIT, so it rounds to
+ * the same hundredths as the exact value, unless the exact value is close to a tie. The rare
+ * values close to a tie and the large values are rounded by snprintf, like in jsoncpp.
+ *
+ * @param[out] number buffer for the formatted value
+ * @param[in] value value to format
+ * @param[out] length length of the formatted value
+ *
+ * @return start of the formatted value, in the buffer or a constant string
+ */
+static const char *format_number(char number[HA_JSON_NUMBER_LENGTH], double value, size_t *length)
+{
+    const char *special;
+    double magnitude = fabs(value);
+    double scaled, fraction;
+    uint64_t hundredths;
+
+    if (!isfinite(value))
+    {
+        //jsoncpp writes the special values as these strings, when useSpecialFloats is off
+        special = isnan(value) ? "null" : (value < 0) ? "-1e+9999" : "1e+9999";
+        *length = strlen(special);
+        return special;
+    }
+
+    if (magnitude < HA_JSON_FAST_LIMIT)
+    {
+        scaled = magnitude * 100;
+        hundredths = (uint64_t) scaled;
+        fraction = scaled - hundredths;
+
+        if (fabs(fraction - 0.5) >= HA_JSON_TIE_MARGIN)
+        {
+            return format_hundredths(number, hundredths + (fraction > 0.5), signbit(value), length);
+        }
+    }
+
+    *length = snprintf(number, HA_JSON_NUMBER_LENGTH, "%.2f", value);
+
+    //Only one of the two decimals can be removed
+    if ((number[*length - 1] == '0') && (number[*length - 2] != '.'))
+    {
+        (*length)--;
+    }
+
+    return number;
+}
+
+
+/**
+ * @brief Appends the key and the formatted value.
+ *
+ * @return new end of the payload, NULL if the buffer is too small
+ */
+static char *append_member(char *position, const char *buffer_end, const char *key, size_t key_length, double value)
+{
+    char number[HA_JSON_NUMBER_LENGTH];
+    const char *formatted;
+    size_t length;
+
+    formatted = format_number(number, value, &length);
+
+    if ((size_t) (buffer_end - position) < key_length + length)
+    {
+        return NULL;
+    }
+
+    memcpy(position, key, key_length);
+    memcpy(position + key_length, formatted, length);
+
+    return position + key_length + length;
+}
+
+
+int ha_json_ambient(char *buffer, size_t size, double temperature, double pressure, double humidity)
+{
+    static const char humidity_key[] = "{\"humidity\":";
+    static const char pressure_key[] = ",\"pressure\":";
+    static const char temperature_key[] = ",\"temperature\":";
+    const char *buffer_end = buffer + size;
+    char *position = buffer;
+
+    //jsoncpp writes the members of an object in the alphabetical order of the keys
+    if (!(position = append_member(position, buffer_end, humidity_key, sizeof(humidity_key) - 1, humidity)) ||
+        !(position = append_member(position, buffer_end, pressure_key, sizeof(pressure_key) - 1, pressure)) ||
+        !(position = append_member(position, buffer_end, temperature_key, sizeof(temperature_key) - 1, temperature)) ||
+        (buffer_end - position < 2))
+    {
+        return -1;
+    }
+
+    *position++ = '}';
+    *position = '\0';
+
+    return (int) (position - buffer);
+}
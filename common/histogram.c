@@ -0,0 +1,143 @@
+/**
+* @file histogram.c
+*
+* @brief Implementation of the lock-free log-linear histogram.
+*
+* @date 17-Oct-2026
+* @copyright GNU General Public License v3
+*
+*/
+
+#include <string.h>
+#include <stdbool.h>
+
+#include "histogram.h"
+
+
+/**
+ * @brief Returns the bucket of the value.
+ */
+static inline unsigned int bucket_index(uint64_t value)
+{
+    unsigned int exponent;
+
+    if (value < HISTOGRAM_SUB_BUCKETS)
+    {
+        return (unsigned int) value;
+    }
+
+    exponent = 63 - __builtin_clzll(value);
+
+    return ((exponent - HISTOGRAM_SUB_BUCKET_BITS + 1) << HISTOGRAM_SUB_BUCKET_BITS) + ((value >> (exponent - HISTOGRAM_SUB_BUCKET_BITS)) & (HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+
+/**
+ * @brief Returns the largest value that falls in the bucket.
+ */
+static inline uint64_t bucket_upper_bound(unsigned int index)
+{
+    unsigned int shift;
+
+    if (index < HISTOGRAM_SUB_BUCKETS)
+    {
+        return index;
+    }
+
+    shift = (index >> HISTOGRAM_SUB_BUCKET_BITS) - 1;
+
+    return ((((uint64_t) HISTOGRAM_SUB_BUCKETS + (index & (HISTOGRAM_SUB_BUCKETS - 1)) + 1) << shift) - 1);
+}
+
+
+void histogram_init(histogram_t *histogram)
+{
+    memset(histogram, 0, sizeof(histogram_t));
+}
+
+
+void histogram_record(histogram_t *histogram, uint64_t value)
+{
+    uint64_t max = __atomic_load_n(&(histogram->max), __ATOMIC_RELAXED);
+
+    __atomic_add_fetch(&(histogram->counts[bucket_index(value)]), 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&(histogram->total), 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&(histogram->sum), value, __ATOMIC_RELAXED);
+
+    while ((value > max) && !__atomic_compare_exchange_n(&(histogram->max), &max, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+
+void histogram_snapshot(const histogram_t *histogram, histogram_t *copy)
+{
+    unsigned int i;
+
+    copy->total = 0;
+
+    //The total is taken from the copied buckets, so the percentiles always add up
+    for (i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        copy->counts[i] = __atomic_load_n(&(histogram->counts[i]), __ATOMIC_RELAXED);
+        copy->total += copy->counts[i];
+    }
+
+    copy->sum = __atomic_load_n(&(histogram->sum), __ATOMIC_RELAXED);
+    copy->max = __atomic_load_n(&(histogram->max), __ATOMIC_RELAXED);
+}
+
+
+void histogram_merge(histogram_t *histogram, const histogram_t *other)
+{
+    unsigned int i;
+
+    for (i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        histogram->counts[i] += other->counts[i];
+    }
+
+    histogram->total += other->total;
+    histogram->sum += other->sum;
+
+    if (other->max > histogram->max)
+    {
+        histogram->max = other->max;
+    }
+}
+
+
+uint64_t histogram_percentile(const histogram_t *histogram, double percentile)
+{
+    uint64_t rank;
+    uint64_t seen = 0;
+    unsigned int i;
+
+    if (!histogram->total)
+    {
+        return 0;
+    }
+
+    rank = (uint64_t)((percentile / 100.0) * histogram->total + 0.5);
+    if (rank < 1)
+    {
+        rank = 1;
+    }
+
+    for (i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        seen += histogram->counts[i];
+
+        if (seen >= rank)
+        {
+            //The bucket bound can be above the largest value recorded so far
+            return bucket_upper_bound(i) < histogram->max ? bucket_upper_bound(i) : histogram->max;
+        }
+    }
+
+    return histogram->max;
+}
+
+
+uint64_t histogram_mean(const histogram_t *histogram)
+{
+    return histogram->total ? histogram->sum / histogram->total : 0;
+}
@@ -0,0 +1,170 @@
+/**
+* @file location_dictionary.c
+*
+* @brief Implementation of the dictionary of the location names.
+*
+* @date 17-Oct-2026
+* @copyright GNU General Public License v3
+*
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "location_dictionary.h"
+#include "mqtt_userdefs.h"
+
+#define INITIAL_INDEX_SIZE 128      /**< Initial number of slots of the hash table. */
+
+
+/**
+ * @brief Returns the entry of the id, the chunk of the id has to exist.
+ */
+static inline location_entry_t *entry(const location_dictionary_t *dictionary, uint32_t id)
+{
+    return &(dictionary->chunks[id >> LOCATION_DICTIONARY_CHUNK_BITS][id & (LOCATION_DICTIONARY_CHUNK_SIZE - 1)]);
+}
+
+
+/**
+ * @brief Inserts the id into the hash table. The table has a free slot.
+ */
+static void location_index_insert(location_dictionary_t *dictionary, uint32_t id)
+{
+    uint32_t mask = dictionary->location_index_size - 1;
+    uint32_t slot = entry(dictionary, id)->hash & mask;
+
+    while (dictionary->location_index[slot])
+    {
+        slot = (slot + 1) & mask;
+    }
+
+    dictionary->location_index[slot] = id + 1;
+}
+
+
+int location_dictionary_init(location_dictionary_t *dictionary)
+{
+    memset(dictionary, 0, sizeof(location_dictionary_t));
+
+    dictionary->location_index_size = INITIAL_INDEX_SIZE;
+    dictionary->location_index = calloc(dictionary->location_index_size, sizeof(uint32_t));
+
+    return dictionary->location_index ? 0 : -1;
+}
+
+
+int64_t location_dictionary_intern(location_dictionary_t *dictionary, const char *name, size_t length)
+{
+    location_entry_t *location;
+    uint32_t *location_index;
+    uint32_t hash = location_hash_n(name, length);
+    uint32_t mask = dictionary->location_index_size - 1;
+    uint32_t slot = hash & mask;
+    uint32_t id = dictionary->number_of_locations;
+    uint32_t i;
+
+    while ((i = dictionary->location_index[slot]))
+    {
+        location = entry(dictionary, i - 1);
+
+        if ((location->hash == hash) && (location->length == length) && !memcmp(location->name, name, length))
+        {
+            return i - 1;
+        }
+
+        slot = (slot + 1) & mask;
+    }
+
+    if ((id == LOCATION_DICTIONARY_MAX_LOCATIONS) || (length > UINT32_MAX))
+    {
+        return -1;
+    }
+
+    if (!dictionary->chunks[id >> LOCATION_DICTIONARY_CHUNK_BITS])
+    {
+        dictionary->chunks[id >> LOCATION_DICTIONARY_CHUNK_BITS] = calloc(LOCATION_DICTIONARY_CHUNK_SIZE, sizeof(location_entry_t));
+
+        if (!dictionary->chunks[id >> LOCATION_DICTIONARY_CHUNK_BITS])
+        {
+            return -1;
+        }
+    }
+
+    //Keep the hash table at most half full
+    if (2 * (id + 1) > dictionary->location_index_size)
+    {
+        location_index = calloc(2 * dictionary->location_index_size, sizeof(uint32_t));
+
+        if (!location_index)
+        {
+            return -1;
+        }
+
+        free(dictionary->location_index);
+        dictionary->location_index = location_index;
+        dictionary->location_index_size *= 2;
+
+        for (i = 0; i < id; i++)
+        {
+            location_index_insert(dictionary, i);
+        }
+    }
+
+    location = entry(dictionary, id);
+    location->name = malloc(length + 1);
+
+    if (!location->name)
+    {
+        return -1;
+    }
+
+    memcpy(location->name, name, length);
+    location->name[length] = '\0';
+    location->length = (uint32_t) length;
+    location->hash = hash;
+
+    location_index_insert(dictionary, id);
+
+    //The entry is complete before the id is handed out
+    __atomic_store_n(&(dictionary->number_of_locations), id + 1, __ATOMIC_RELEASE);
+
+    return id;
+}
+
+
+const char *location_dictionary_name(const location_dictionary_t *dictionary, uint32_t id)
+{
+    if (id >= location_dictionary_size(dictionary))
+    {
+        return NULL;
+    }
+
+    return entry(dictionary, id)->name;
+}
+
+
+uint32_t location_dictionary_size(const location_dictionary_t *dictionary)
+{
+    return __atomic_load_n(&(dictionary->number_of_locations), __ATOMIC_ACQUIRE);
+}
+
+
+void location_dictionary_clean_up(location_dictionary_t *dictionary)
+{
+    uint32_t i;
+
+    for (i = 0; i < dictionary->number_of_locations; i++)
+    {
+        free(entry(dictionary, i)->name);
+    }
+
+    for (i = 0; i < LOCATION_DICTIONARY_CHUNKS; i++)
+    {
+        free(dictionary->chunks[i]);
+    }
+
+    free(dictionary->location_index);
+
+    memset(dictionary, 0, sizeof(location_dictionary_t));
+}
@@ -0,0 +1,325 @@
+/**
+* @file output_sink.c
+*
+* @brief Implementation of the buffered text output written by its own thread.
+*
+* @date 17-Oct-2026
+* @copyright GNU General Public License v3
+*
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "output_sink.h"
+
+
+int output_sink_target_from_string(const char *name, output_sink_target_t *target)
+{
+    if (!name[0] || !strcmp(name, "stdout"))
+    {
+        *target = OUTPUT_SINK_STDOUT;
+    }
+    else if (!strcmp(name, "null"))
+    {
+        *target = OUTPUT_SINK_NULL;
+    }
+    else
+    {
+        *target = OUTPUT_SINK_FILE;
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief Hands the active buffer over to the writer thread and continues with the other one.
+ * Waits while the writer thread is still writing the other buffer. Called with the lock held.
+ */
+static void swap_buffers(output_sink_t *sink)
+{
+    if (sink->pending_length)
+    {
+        __atomic_add_fetch(&(sink->stalls), 1, __ATOMIC_RELAXED);
+
+        while (sink->pending_length)
+        {
+            pthread_cond_wait(&(sink->written), &(sink->lock));
+        }
+    }
+
+    sink->pending_length = sink->length;
+    sink->active ^= 1;
+    sink->length = 0;
+
+    pthread_cond_signal(&(sink->filled));
+}
+
+
+/**
+ * @brief Writes the whole buffer to the destination, continues after partial writes.
+ */
+static void write_buffer(output_sink_t *sink, const char *buffer, size_t length)
+{
+    ssize_t written;
+
+    if (sink->target == OUTPUT_SINK_NULL)
+    {
+        __atomic_add_fetch(&(sink->bytes), length, __ATOMIC_RELAXED);
+        return;
+    }
+
+    while (length)
+    {
+        written = write(sink->fd, buffer, length);
+        __atomic_add_fetch(&(sink->writes), 1, __ATOMIC_RELAXED);
+
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            __atomic_add_fetch(&(sink->errors), 1, __ATOMIC_RELAXED);
+            return;
+        }
+
+        buffer += written;
+        length -= written;
+        __atomic_add_fetch(&(sink->bytes), written, __ATOMIC_RELAXED);
+    }
+}
+
+
+/**
+ * @brief Writer thread. Writes every buffer handed over by the producers, and the active buffer
+ * when the flush interval expires.
+ */
+static void *output_sink_writer(void *arg)
+{
+    output_sink_t *sink = (output_sink_t *) arg;
+    struct timespec deadline;
+    const char *buffer;
+    size_t length;
+
+    pthread_mutex_lock(&(sink->lock));
+
+    while (1)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += sink->flush_interval_ms / 1000;
+        deadline.tv_nsec += (sink->flush_interval_ms % 1000) * 1000000L;
+
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        while (!sink->pending_length && !sink->stop)
+        {
+            if (pthread_cond_timedwait(&(sink->filled), &(sink->lock), &deadline) == ETIMEDOUT)
+            {
+                break;
+            }
+        }
+
+        //Interval expired or stopping, write what the producers have so far
+        if (!sink->pending_length && sink->length)
+        {
+            swap_buffers(sink);
+        }
+
+        if (!sink->pending_length && sink->stop)
+        {
+            break;
+        }
+
+        if (!sink->pending_length)
+        {
+            continue;
+        }
+
+        //The producers use only the active buffer, the other one is written without the lock
+        buffer = sink->buffers[sink->active ^ 1];
+        length = sink->pending_length;
+
+        pthread_mutex_unlock(&(sink->lock));
+
+        write_buffer(sink, buffer, length);
+
+        pthread_mutex_lock(&(sink->lock));
+
+        sink->pending_length = 0;
+        pthread_cond_broadcast(&(sink->written));
+    }
+
+    pthread_mutex_unlock(&(sink->lock));
+
+    return NULL;
+}
+
+
+int output_sink_open(output_sink_t *sink, output_sink_target_t target, const char *path, size_t buffer_size, unsigned int flush_interval_ms)
+{
+    pthread_condattr_t cond_attr;
+
+    memset(sink, 0, sizeof(output_sink_t));
+
+    sink->target = target;
+    sink->buffer_size = buffer_size ? buffer_size : OUTPUT_SINK_BUFFER_SIZE;
+    sink->flush_interval_ms = flush_interval_ms ? flush_interval_ms : OUTPUT_SINK_FLUSH_INTERVAL_MS;
+    sink->fd = STDOUT_FILENO;
+
+    if (target == OUTPUT_SINK_FILE)
+    {
+        sink->fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+
+        if (sink->fd < 0)
+        {
+            return -1;
+        }
+    }
+
+    sink->buffers[0] = malloc(sink->buffer_size);
+    sink->buffers[1] = malloc(sink->buffer_size);
+
+    if (!sink->buffers[0] || !sink->buffers[1])
+    {
+        goto error;
+    }
+
+    pthread_mutex_init(&(sink->lock), NULL);
+    pthread_cond_init(&(sink->written), NULL);
+
+    //The flush interval is not affected by changes of the wall clock
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&(sink->filled), &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+
+    if (pthread_create(&(sink->writer), NULL, output_sink_writer, sink))
+    {
+        pthread_cond_destroy(&(sink->filled));
+        pthread_cond_destroy(&(sink->written));
+        pthread_mutex_destroy(&(sink->lock));
+        goto error;
+    }
+
+    return 0;
+
+error:
+    free(sink->buffers[0]);
+    free(sink->buffers[1]);
+
+    if (target == OUTPUT_SINK_FILE)
+    {
+        close(sink->fd);
+    }
+
+    return -1;
+}
+
+
+void output_sink_begin(output_sink_t *sink)
+{
+    pthread_mutex_lock(&(sink->lock));
+}
+
+
+const char *output_sink_time_stamp(output_sink_t *sink)
+{
+    time_t local_time = time(NULL);
+    struct tm tm_result;
+
+    if (local_time != sink->time_stamp_time)
+    {
+        localtime_r(&local_time, &tm_result);
+        strftime(sink->time_stamp, sizeof(sink->time_stamp), "%d.%h.%Y %H:%M:%S", &tm_result);
+        sink->time_stamp_time = local_time;
+    }
+
+    return sink->time_stamp;
+}
+
+
+void output_sink_printf(output_sink_t *sink, const char *format, ...)
+{
+    va_list args;
+    size_t space;
+    int length;
+
+    space = sink->buffer_size - sink->length;
+
+    va_start(args, format);
+    length = vsnprintf(sink->buffers[sink->active] + sink->length, space, format, args);
+    va_end(args);
+
+    if (length < 0)
+    {
+        return;
+    }
+
+    if ((size_t) length >= space)
+    {
+        //Does not fit, format it again at the start of the other buffer
+        swap_buffers(sink);
+
+        space = sink->buffer_size;
+
+        va_start(args, format);
+        length = vsnprintf(sink->buffers[sink->active], space, format, args);
+        va_end(args);
+
+        if ((size_t) length >= space)
+        {
+            //Longer than the whole buffer, the terminating null character is not written out
+            length = space - 1;
+        }
+    }
+
+    sink->length += length;
+}
+
+
+void output_sink_end(output_sink_t *sink)
+{
+    //Start writing a half full buffer if the writer thread is idle, the producers rarely wait then
+    if ((sink->length >= sink->buffer_size / 2) && !sink->pending_length)
+    {
+        swap_buffers(sink);
+    }
+
+    pthread_mutex_unlock(&(sink->lock));
+}
+
+
+void output_sink_close(output_sink_t *sink)
+{
+    pthread_mutex_lock(&(sink->lock));
+    sink->stop = true;
+    pthread_cond_signal(&(sink->filled));
+    pthread_mutex_unlock(&(sink->lock));
+
+    pthread_join(sink->writer, NULL);
+
+    pthread_cond_destroy(&(sink->filled));
+    pthread_cond_destroy(&(sink->written));
+    pthread_mutex_destroy(&(sink->lock));
+
+    free(sink->buffers[0]);
+    free(sink->buffers[1]);
+    sink->buffers[0] = sink->buffers[1] = NULL;
+
+    if (sink->target == OUTPUT_SINK_FILE)
+    {
+        close(sink->fd);
+    }
+}
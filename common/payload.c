@@ -0,0 +1,355 @@
+/**
+* @file payload.c
+*
+* @brief Encoding and decoding of the ambient data payload of the MQTT messages.
+*
+* @date 17-Oct-2026
+* @copyright GNU General Public License v3
+*
+*/
+
+#include <stddef.h>
+#include <string.h>
+#include <endian.h>
+
+#include "payload.h"
+
+
+int payload_format_from_string(const char *name, payload_format_t *format)
+{
+    if (!name[0] || !strcmp(name, "legacy"))
+    {
+        *format = PAYLOAD_FORMAT_LEGACY;
+    }
+    else if (!strcmp(name, "compact"))
+    {
+        *format = PAYLOAD_FORMAT_COMPACT;
+    }
+    else
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief Returns the bits of a double in little endian byte order.
+ */
+static inline uint64_t double_to_le(double value)
+{
+    uint64_t bits;
+
+    memcpy(&bits, &value, sizeof(bits));
+
+    return htole64(bits);
+}
+
+
+/**
+ * @brief Returns the double from its bits in little endian byte order.
+ */
+static inline double le_to_double(uint64_t bits)
+{
+    double value;
+
+    bits = le64toh(bits);
+    memcpy(&value, &bits, sizeof(value));
+
+    return value;
+}
+
+
+size_t encode_ambient(payload_format_t format, const ambient_t *ambient, const probe_t *probe, void *buffer, size_t size)
+{
+    compact_ambient_t compact;
+    size_t length;
+
+    if (format == PAYLOAD_FORMAT_COMPACT)
+    {
+        compact.tag = PAYLOAD_TAG;
+        compact.version = PAYLOAD_VERSION;
+        compact.flags = probe ? PAYLOAD_FLAG_PROBE : 0;
+        compact.reserved = 0;
+        compact.temperature = double_to_le(ambient->temperature);
+        compact.pressure = double_to_le(ambient->pressure);
+        compact.humidity = double_to_le(ambient->humidity);
+
+        length = sizeof(compact_ambient_t);
+    }
+    else
+    {
+        length = sizeof(ambient_t);
+    }
+
+    if (size < length + (probe ? sizeof(probe_t) : 0))
+    {
+        return 0;
+    }
+
+    memcpy(buffer, (format == PAYLOAD_FORMAT_COMPACT) ? (const void *) &compact : (const void *) ambient, length);
+
+    if (probe)
+    {
+        memcpy((uint8_t *) buffer + length, probe, sizeof(probe_t));
+        length += sizeof(probe_t);
+    }
+
+    return length;
+}
+
+
+void payload_batch_init(payload_batch_t *batch, unsigned int max_readings, bool probes)
+{
+    batch->max_readings = (max_readings && max_readings < PAYLOAD_BATCH_MAX_READINGS) ? max_readings : PAYLOAD_BATCH_MAX_READINGS;
+    batch->probes = probes;
+
+    payload_batch_reset(batch);
+}
+
+
+void payload_batch_reset(payload_batch_t *batch)
+{
+    batch->number_of_readings = 0;
+    batch->first_reading_time = 0;
+    batch->length = sizeof(compact_batch_header_t);
+}
+
+
+bool payload_batch_add(payload_batch_t *batch, const ambient_t *ambient, const probe_t *probe)
+{
+    compact_batch_header_t header;
+    uint64_t values[3];
+
+    if (!batch->number_of_readings)
+    {
+        batch->first_reading_time = monotonic_time_ns();
+    }
+
+    values[0] = double_to_le(ambient->temperature);
+    values[1] = double_to_le(ambient->pressure);
+    values[2] = double_to_le(ambient->humidity);
+
+    memcpy(batch->buffer + batch->length, values, sizeof(values));
+    batch->length += sizeof(values);
+
+    if (batch->probes)
+    {
+        memcpy(batch->buffer + batch->length, probe, sizeof(probe_t));
+        batch->length += sizeof(probe_t);
+    }
+
+    batch->number_of_readings++;
+
+    //Keep the header up to date, so the buffer can be published at any time
+    header.tag = PAYLOAD_BATCH_TAG;
+    header.version = PAYLOAD_VERSION;
+    header.flags = batch->probes ? PAYLOAD_FLAG_PROBE : 0;
+    header.reserved = 0;
+    header.number_of_readings = htole16((uint16_t) batch->number_of_readings);
+    header.reading_size = htole16((uint16_t) (PAYLOAD_BATCH_READING_SIZE + (batch->probes ? sizeof(probe_t) : 0)));
+
+    memcpy(batch->buffer, &header, sizeof(header));
+
+    return batch->number_of_readings >= batch->max_readings;
+}
+
+
+bool payload_batch_due(const payload_batch_t *batch, uint64_t next_reading_time, uint64_t max_latency_ns)
+{
+    return batch->number_of_readings && (next_reading_time - batch->first_reading_time > max_latency_ns);
+}
+
+
+/**
+ * @brief Returns the header of a well formed compact batch, NULL for other payloads.
+ */
+static const compact_batch_header_t *batch_header(const void *payload, size_t length)
+{
+    const compact_batch_header_t *header = (const compact_batch_header_t *) payload;
+    size_t reading_size;
+
+    if ((length < sizeof(compact_batch_header_t)) || (header->tag != PAYLOAD_BATCH_TAG) || (header->version < 1))
+    {
+        return NULL;
+    }
+
+    reading_size = le16toh(header->reading_size);
+
+    if ((reading_size < PAYLOAD_BATCH_READING_SIZE + ((header->flags & PAYLOAD_FLAG_PROBE) ? sizeof(probe_t) : 0)) ||
+        (length != sizeof(compact_batch_header_t) + le16toh(header->number_of_readings) * reading_size))
+    {
+        return NULL;
+    }
+
+    return header;
+}
+
+
+unsigned int payload_readings(const void *payload, size_t length)
+{
+    const compact_batch_header_t *header = batch_header(payload, length);
+
+    if (header)
+    {
+        return le16toh(header->number_of_readings);
+    }
+
+    //Malformed batch is not taken for a legacy payload
+    return ((length >= 1) && (*(const uint8_t *) payload == PAYLOAD_BATCH_TAG)) ? 0 : 1;
+}
+
+
+/**
+ * @brief Finds the second level of the topic home/<location>/ambient_data.
+ */
+static void topic_location(const char *topic, const char **location, size_t *location_length)
+{
+    const char *start = strchr(topic, '/');
+
+    *location = start ? start + 1 : topic;
+    *location_length = strcspn(*location, "/");
+}
+
+
+payload_format_t decode_reading(const char *topic, const void *payload, size_t length, unsigned int index,
+                                reading_t *reading, probe_t *probe, const char **location, size_t *location_length)
+{
+    const compact_ambient_t *compact = (const compact_ambient_t *) payload;
+    const compact_batch_header_t *header = batch_header(payload, length);
+    const uint8_t *compact_reading;
+    uint64_t values[3];
+    double legacy_values[3];
+    size_t values_offset = offsetof(ambient_t, temperature);
+
+    if (header)
+    {
+        compact_reading = (const uint8_t *) payload + sizeof(compact_batch_header_t) + index * le16toh(header->reading_size);
+        memcpy(values, compact_reading, sizeof(values));
+
+        topic_location(topic, location, location_length);
+        reading->temperature = le_to_double(values[0]);
+        reading->pressure = le_to_double(values[1]);
+        reading->humidity = le_to_double(values[2]);
+
+        //The probe is always at the end of the reading
+        if (probe)
+        {
+            if (header->flags & PAYLOAD_FLAG_PROBE)
+            {
+                memcpy(probe, compact_reading + le16toh(header->reading_size) - sizeof(probe_t), sizeof(probe_t));
+            }
+            else
+            {
+                memset(probe, 0, sizeof(probe_t));
+            }
+        }
+
+        return PAYLOAD_FORMAT_COMPACT_BATCH;
+    }
+
+    if ((length >= sizeof(compact_ambient_t)) && (length < sizeof(ambient_t)) && (compact->tag == PAYLOAD_TAG) && (compact->version >= 1))
+    {
+        topic_location(topic, location, location_length);
+        reading->temperature = le_to_double(compact->temperature);
+        reading->pressure = le_to_double(compact->pressure);
+        reading->humidity = le_to_double(compact->humidity);
+
+        //Fields added by newer versions are skipped, the probe is always the last one
+        if (probe)
+        {
+            if ((compact->flags & PAYLOAD_FLAG_PROBE) && (length >= sizeof(compact_ambient_t) + sizeof(probe_t)))
+            {
+                memcpy(probe, (const uint8_t *) payload + length - sizeof(probe_t), sizeof(probe_t));
+            }
+            else
+            {
+                memset(probe, 0, sizeof(probe_t));
+            }
+        }
+
+        return PAYLOAD_FORMAT_COMPACT;
+    }
+
+    //The name ends at the first null character, the last byte of the location field or the end of the payload
+    *location = (const char *) payload;
+    *location_length = strnlen(*location, length < values_offset ? length : values_offset - 1);
+
+    memset(legacy_values, 0, sizeof(legacy_values));
+
+    if (length > values_offset)
+    {
+        memcpy(legacy_values, (const uint8_t *) payload + values_offset,
+               length - values_offset < sizeof(legacy_values) ? length - values_offset : sizeof(legacy_values));
+    }
+
+    reading->temperature = legacy_values[0];
+    reading->pressure = legacy_values[1];
+    reading->humidity = legacy_values[2];
+
+    if (probe)
+    {
+        if (length >= sizeof(ambient_t) + sizeof(probe_t))
+        {
+            memcpy(probe, (const uint8_t *) payload + sizeof(ambient_t), sizeof(probe_t));
+        }
+        else
+        {
+            memset(probe, 0, sizeof(probe_t));
+        }
+    }
+
+    return PAYLOAD_FORMAT_LEGACY;
+}
+
+
+unsigned int payload_set_publish_time(void *payload, size_t length, uint64_t publish_time)
+{
+    const compact_ambient_t *compact = (const compact_ambient_t *) payload;
+    const compact_batch_header_t *header = batch_header(payload, length);
+    uint8_t *reading;
+    size_t reading_size;
+    unsigned int i, number_of_readings;
+
+    if (header)
+    {
+        if (!(header->flags & PAYLOAD_FLAG_PROBE))
+        {
+            return 0;
+        }
+
+        reading_size = le16toh(header->reading_size);
+        number_of_readings = le16toh(header->number_of_readings);
+        reading = (uint8_t *) payload + sizeof(compact_batch_header_t);
+
+        //The probe is always at the end of the reading
+        for (i = 0; i < number_of_readings; i++, reading += reading_size)
+        {
+            memcpy(reading + reading_size - sizeof(probe_t) + offsetof(probe_t, publish_time), &publish_time, sizeof(publish_time));
+        }
+
+        return number_of_readings;
+    }
+
+    if ((length >= sizeof(compact_ambient_t)) && (length < sizeof(ambient_t)) && (compact->tag == PAYLOAD_TAG) && (compact->version >= 1))
+    {
+        if (!(compact->flags & PAYLOAD_FLAG_PROBE) || (length < sizeof(compact_ambient_t) + sizeof(probe_t)))
+        {
+            return 0;
+        }
+
+        memcpy((uint8_t *) payload + length - sizeof(probe_t) + offsetof(probe_t, publish_time), &publish_time, sizeof(publish_time));
+
+        return 1;
+    }
+
+    if (length >= sizeof(ambient_t) + sizeof(probe_t))
+    {
+        memcpy((uint8_t *) payload + sizeof(ambient_t) + offsetof(probe_t, publish_time), &publish_time, sizeof(publish_time));
+
+        return 1;
+    }
+
+    return 0;
+}
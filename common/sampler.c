@@ -0,0 +1,187 @@
+/**
+* @file sampler.c
+*
+* @brief Implementation of the periodic sampling thread.
+*
+* @date 17-Oct-2026
+* @copyright GNU General Public License v3
+*
+*/
+
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "mqtt_userdefs.h"
+#include "sampler.h"
+
+
+/**
+ * @brief Waits until the deadline or until the sampling is stopped.
+ *
+ * @return true if the deadline was reached, false if the sampling was stopped
+ */
+static bool wait_for_deadline(sampler_t *sampler, uint64_t deadline)
+{
+    struct timespec due_time;
+    bool reached;
+
+    due_time.tv_sec = deadline / 1000000000ull;
+    due_time.tv_nsec = deadline % 1000000000ull;
+
+    pthread_mutex_lock(&(sampler->lock));
+
+    while (!sampler->stop && (pthread_cond_timedwait(&(sampler->stop_requested), &(sampler->lock), &due_time) != ETIMEDOUT));
+
+    reached = !sampler->stop;
+
+    pthread_mutex_unlock(&(sampler->lock));
+
+    return reached;
+}
+
+
+/**
+ * @brief Reads the sensors at the deadlines and passes the readings to the publishing thread.
+ */
+static void *sampling_thread(void *arg)
+{
+    sampler_t *sampler = (sampler_t *) arg;
+    sampler_reading_t reading;
+    uint64_t start = monotonic_time_ns();
+    uint64_t deadline, now;
+    unsigned long next = 0;
+
+    while (!sampler->max_samples || (next < sampler->max_samples))
+    {
+        //Deadlines are absolute, the time spent after the previous deadline does not shift them
+        deadline = start + next * sampler->period_ns;
+
+        if (!wait_for_deadline(sampler, deadline))
+        {
+            break;
+        }
+
+        now = monotonic_time_ns();
+        histogram_record(&(sampler->jitter), now > deadline ? now - deadline : 0);
+
+        memset(&reading, 0, sizeof(reading));
+        reading.deadline = deadline;
+        reading.time = now;
+        reading.sequence = next;
+
+        if (sampler->read(sampler->context, &reading))
+        {
+            __atomic_add_fetch(&(sampler->failed), 1, __ATOMIC_RELAXED);
+        }
+        else if (add_work_entry(&(sampler->publisher->working_queue), &reading))
+        {
+            __atomic_add_fetch(&(sampler->dropped), 1, __ATOMIC_RELAXED);
+        }
+        else
+        {
+            __atomic_add_fetch(&(sampler->samples), 1, __ATOMIC_RELAXED);
+        }
+
+        next++;
+
+        //A read longer than the period skips the deadlines already passed, the next
+        //reading stays on the schedule
+        now = monotonic_time_ns();
+
+        if (start + next * sampler->period_ns <= now)
+        {
+            __atomic_add_fetch(&(sampler->missed), (now - start) / sampler->period_ns + 1 - next, __ATOMIC_RELAXED);
+            next = (now - start) / sampler->period_ns + 1;
+        }
+    }
+
+    return NULL;
+}
+
+
+int sampler_start(sampler_t *sampler, uint64_t period_ns, unsigned long max_samples,
+                  sampler_read_f read, void *context, do_work_f publish, unsigned int queue_size)
+{
+    worker_attr_t attr;
+    pthread_condattr_t cond_attr;
+
+    memset(sampler, 0, sizeof(sampler_t));
+
+    if (!period_ns)
+    {
+        return -1;
+    }
+
+    sampler->period_ns = period_ns;
+    sampler->max_samples = max_samples;
+    sampler->read = read;
+    sampler->context = context;
+
+    histogram_init(&(sampler->jitter));
+
+    //Only the sampling thread adds readings, and it must never wait for the publishing thread
+    worker_attr_init(&attr);
+    attr.working_queue_size = queue_size ? queue_size : SAMPLER_DEFAULT_QUEUE_SIZE;
+    attr.working_queue_entry_size = sizeof(sampler_reading_t);
+    attr.do_work = publish;
+    attr.queue_mode = WORKING_QUEUE_MODE_SPSC;
+    attr.overflow_policy = WORKING_QUEUE_OVERFLOW_DROP_NEWEST;
+
+    if (create_worker_with_attr(&(sampler->publisher), &attr))
+    {
+        return -1;
+    }
+
+    //The deadlines are times of the monotonic clock
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&(sampler->stop_requested), &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+    pthread_mutex_init(&(sampler->lock), NULL);
+
+    if (pthread_create(&(sampler->sampling_thread), NULL, sampling_thread, sampler))
+    {
+        stop_worker(sampler->publisher);
+        worker_clean_up(&(sampler->publisher));
+        pthread_cond_destroy(&(sampler->stop_requested));
+        pthread_mutex_destroy(&(sampler->lock));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+void sampler_join(sampler_t *sampler)
+{
+    if (!sampler->publisher)
+    {
+        return;
+    }
+
+    pthread_join(sampler->sampling_thread, NULL);
+
+    //Stopping the worker publishes the waiting readings first
+    stop_worker(sampler->publisher);
+    worker_clean_up(&(sampler->publisher));
+
+    pthread_cond_destroy(&(sampler->stop_requested));
+    pthread_mutex_destroy(&(sampler->lock));
+}
+
+
+void sampler_stop(sampler_t *sampler)
+{
+    if (!sampler->publisher)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&(sampler->lock));
+    sampler->stop = true;
+    pthread_cond_signal(&(sampler->stop_requested));
+    pthread_mutex_unlock(&(sampler->lock));
+
+    sampler_join(sampler);
+}
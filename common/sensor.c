@@ -0,0 +1,262 @@
+/**
+* @file sensor.c
+*
+* @brief Selection of the sensor backend and the simulated backend.
+*
+* @date 17-Oct-2026
+* @copyright GNU General Public License v3
+*
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <time.h>
+
+#include "sensor.h"
+
+
+/**
+ * @brief Middle and amplitude of the simulated waves, in the order temperature, pressure, humidity.
+ */
+static const double simulated_base[3] = { 22.0, 1013.25, 45.0 };
+static const double simulated_amplitude[3] = { 3.0, 5.0, 10.0 };
+
+
+/**
+ * @brief Returns the next number of the splitmix64 generator.
+ */
+static uint64_t next_random(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+
+    return z ^ (z >> 31);
+}
+
+
+/**
+ * @brief Returns a uniformly distributed number in (0, 1].
+ */
+static double next_uniform(uint64_t *state)
+{
+    return ((next_random(state) >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+
+/**
+ * @brief Returns a normally distributed number with mean 0 and standard deviation 1, by the
+ * Box-Muller transform.
+ */
+static double next_gaussian(uint64_t *state)
+{
+    double radius = sqrt(-2.0 * log(next_uniform(state)));
+
+    return radius * cos(2.0 * M_PI * next_uniform(state));
+}
+
+
+/**
+ * @brief Parses the properties of the simulated backend, "key=value" pairs separated by commas.
+ *
+ * @return 0 on success, -1 for an unknown key or a malformed value
+ */
+static int parse_simulation(const char *properties, sensor_simulation_t *simulation)
+{
+    char copy[256];
+    char *pair, *value, *end, *save;
+
+    snprintf(copy, sizeof(copy), "%s", properties);
+
+    for (pair = strtok_r(copy, ",", &save); pair; pair = strtok_r(NULL, ",", &save))
+    {
+        value = strchr(pair, '=');
+
+        if (!value)
+        {
+            return -1;
+        }
+
+        *value++ = '\0';
+
+        if (!strcmp(pair, "seed"))
+        {
+            simulation->seed = strtoull(value, &end, 10);
+        }
+        else if (!strcmp(pair, "noise"))
+        {
+            simulation->noise = strtod(value, &end);
+        }
+        else if (!strcmp(pair, "fail"))
+        {
+            simulation->failure_rate = strtod(value, &end);
+        }
+        else if (!strcmp(pair, "latency_us"))
+        {
+            simulation->latency_us = (unsigned int) strtoul(value, &end, 10);
+        }
+        else if (!strcmp(pair, "period"))
+        {
+            simulation->period = (unsigned int) strtoul(value, &end, 10);
+        }
+        else
+        {
+            return -1;
+        }
+
+        if ((end == value) || *end)
+        {
+            return -1;
+        }
+    }
+
+    if ((simulation->noise < 0) || (simulation->failure_rate < 0) || (simulation->failure_rate > 1) || !simulation->period)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief Reads the simulated values of the next reading, after the simulated latency.
+ */
+static int simulated_read(sensor_t *sensor, sampler_reading_t *reading)
+{
+    struct timespec latency;
+    double position = 2.0 * M_PI * (sensor->reads % sensor->simulation.period) / sensor->simulation.period;
+    double values[3];
+    bool failed;
+    unsigned int i;
+
+    if (sensor->simulation.latency_us)
+    {
+        latency.tv_sec = sensor->simulation.latency_us / 1000000;
+        latency.tv_nsec = (sensor->simulation.latency_us % 1000000) * 1000;
+        clock_nanosleep(CLOCK_MONOTONIC, 0, &latency, NULL);
+    }
+
+    //The random numbers are drawn also for a failed read, so the readings after it do not
+    //depend on the failure rate
+    failed = next_uniform(&(sensor->random_state)) <= sensor->simulation.failure_rate;
+
+    for (i = 0; i < 3; i++)
+    {
+        values[i] = simulated_base[i] + simulated_amplitude[i] *
+                    (sin(position + sensor->phase[i]) + sensor->simulation.noise * next_gaussian(&(sensor->random_state)));
+    }
+
+    sensor->reads++;
+
+    if (failed)
+    {
+        return -1;
+    }
+
+    reading->temperature = values[0];
+    reading->pressure = values[1];
+    reading->humidity = values[2];
+
+    return 0;
+}
+
+
+int sensor_open(sensor_t *sensor, const char *specification)
+{
+    const char *properties = strchr(specification, ':');
+    size_t name_length = properties ? (size_t) (properties - specification) : strlen(specification);
+    unsigned int i;
+
+    memset(sensor, 0, sizeof(sensor_t));
+
+    if (!name_length)
+    {
+#ifdef WITH_LIBSETILA
+        sensor->backend = SENSOR_BACKEND_SENSE_HAT;
+#else
+        sensor->backend = SENSOR_BACKEND_SIMULATED;
+#endif
+    }
+    else if ((name_length == strlen("sense_hat")) && !strncasecmp(specification, "sense_hat", name_length))
+    {
+        sensor->backend = SENSOR_BACKEND_SENSE_HAT;
+    }
+    else if ((name_length == strlen("simulated")) && !strncasecmp(specification, "simulated", name_length))
+    {
+        sensor->backend = SENSOR_BACKEND_SIMULATED;
+    }
+    else
+    {
+        printf("Error: unknown sensor backend %s\n", specification);
+        return -1;
+    }
+
+    if (sensor->backend == SENSOR_BACKEND_SENSE_HAT)
+    {
+#ifdef WITH_LIBSETILA
+        if (properties)
+        {
+            printf("Error: the sense_hat sensors have no properties\n");
+            return -1;
+        }
+
+        return sensor_sense_hat_open(sensor);
+#else
+        printf("Error: built without libsetila, only the simulated sensors are available\n");
+        return -1;
+#endif
+    }
+
+    sensor->simulation.seed = SENSOR_SIMULATED_DEFAULT_SEED;
+    sensor->simulation.noise = SENSOR_SIMULATED_DEFAULT_NOISE;
+    sensor->simulation.period = SENSOR_SIMULATED_DEFAULT_PERIOD;
+
+    if (properties && parse_simulation(properties + 1, &(sensor->simulation)))
+    {
+        printf("Error: malformed properties of the simulated sensors %s\n", properties + 1);
+        return -1;
+    }
+
+    sensor->random_state = sensor->simulation.seed;
+
+    for (i = 0; i < 3; i++)
+    {
+        sensor->phase[i] = 2.0 * M_PI * next_uniform(&(sensor->random_state));
+    }
+
+    return 0;
+}
+
+
+int sensor_read(void *context, sampler_reading_t *reading)
+{
+    sensor_t *sensor = (sensor_t *) context;
+
+#ifdef WITH_LIBSETILA
+    if (sensor->backend == SENSOR_BACKEND_SENSE_HAT)
+    {
+        sensor->reads++;
+        return sensor_sense_hat_read(sensor, reading);
+    }
+#endif
+
+    return simulated_read(sensor, reading);
+}
+
+
+void sensor_close(sensor_t *sensor)
+{
+#ifdef WITH_LIBSETILA
+    if (sensor->backend == SENSOR_BACKEND_SENSE_HAT)
+    {
+        sensor_sense_hat_close(sensor);
+    }
+#endif
+
+    sensor->device = NULL;
+}
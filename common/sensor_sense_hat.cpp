@@ -0,0 +1,144 @@
+/**
+*  @file sensor_sense_hat.cpp
+*
+*  @brief Sense HAT backend of the ambient sensors. LPS25H and HTS221 sensors read over
+*  I2C with libsetila.
+*
+*  Exernal dependences:
+*   - libsetila v0.5.7 or newer (https://github.com/positronic57)
+*
+*  @date 17-Oct-2026
+*  @copyright GNU General Public License v3
+*/
+
+#include <iostream>
+#include <cstdint>
+
+#include "setila/setila_i2c.h"
+#include "setila/LPS25H.h"
+#include "setila/HTS221.h"
+
+extern "C" {
+#include "sensor.h"
+}
+
+
+/**
+ * @brief Libsetila devices of the Sense HAT.
+ */
+struct SenseHatDevices {
+    Bus_Master_Device *i2c_bus_master;
+    LPS25H *lps25h_sensor;
+    HTS221 *hts221_sensor;
+};
+
+
+static int init_ambient_sensors(LPS25H *lps25h_sensor, HTS221 *hts221_sensor)
+{
+    // Set LPS25H internal temperature average to 16 and pressure to 32
+    int status = lps25h_sensor->set_resolution(0x01, 0x01);
+    if (status)
+    {
+        std::cout << "LPS25H sensor set resolution failed." << std::endl;
+        return status;
+    }
+
+    status = lps25h_sensor->set_mode_of_operation(
+                ST_Sensor::MODE_OF_OPERATION::OP_FIFO_MEAN_MODE,
+                ST_Sensor::OUTPUT_DATA_RATE::ODR_1_Hz,
+                LPS25H_NBR_AVERAGED_SAMPLES::AVER_SAMPLES_4
+              );
+
+    if (status)
+    {
+        std::cout << "LPS25H sensor initialization failed." << std::endl;
+        return status;
+    }
+
+    //Set HTS221 internal temperature average to 32 and humidity to 64
+    status = hts221_sensor->set_resolution(0x04, 0x04);
+    if (status)
+    {
+        std::cout << "HTS221 sensor set resolution failed." << std::endl;
+        return status;
+    }
+
+    // Configure HTS221 for ONE SHOT type of measurements
+    status = hts221_sensor->set_mode_of_operation(ST_Sensor::MODE_OF_OPERATION::OP_ONE_SHOT);
+    if (status)
+    {
+        std::cout << "HTS221 sensor initialization failed." << std::endl;
+        return status;
+    }
+
+    return status;
+}
+
+
+int sensor_sense_hat_open(sensor_t *sensor)
+{
+    SenseHatDevices *devices = new SenseHatDevices;
+
+    devices->i2c_bus_master = new Bus_Master_Device("/dev/i2c-1", BUS_TYPE::I2C_BUS);
+    devices->lps25h_sensor = new LPS25H(Slave_Device_Type::I2C_SLAVE_DEVICE, devices->i2c_bus_master, 0x5C);
+    devices->hts221_sensor = new HTS221(Slave_Device_Type::I2C_SLAVE_DEVICE, devices->i2c_bus_master, 0x5F);
+
+    sensor->device = devices;
+
+    if (devices->i2c_bus_master->open_bus() < 0)
+    {
+        std::cout << "Failed to open master bus" << std::endl;
+        sensor_sense_hat_close(sensor);
+        return -1;
+    }
+
+    if (init_ambient_sensors(devices->lps25h_sensor, devices->hts221_sensor))
+    {
+        sensor_sense_hat_close(sensor);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+int sensor_sense_hat_read(sensor_t *sensor, sampler_reading_t *reading)
+{
+    SenseHatDevices *devices = (SenseHatDevices *) sensor->device;
+
+    if (devices->lps25h_sensor->get_sensor_readings())
+    {
+        std::cout << "LPS25H pressure/temperature measurement failed." << std::endl;
+        return -1;
+    }
+
+    if (devices->hts221_sensor->get_sensor_readings())
+    {
+        std::cout << "HTS221 humidity/temperature measurement failed." << std::endl;
+        return -1;
+    }
+
+    reading->temperature = devices->lps25h_sensor->temperature_reading();
+    reading->pressure = devices->lps25h_sensor->pressure_reading();
+    reading->humidity = devices->hts221_sensor->humidity_reading();
+
+    return 0;
+}
+
+
+void sensor_sense_hat_close(sensor_t *sensor)
+{
+    SenseHatDevices *devices = (SenseHatDevices *) sensor->device;
+
+    if (!devices)
+    {
+        return;
+    }
+
+    delete devices->lps25h_sensor;
+    delete devices->hts221_sensor;
+    delete devices->i2c_bus_master;
+    delete devices;
+
+    sensor->device = nullptr;
+}
@@ -0,0 +1,695 @@
+/**
+* @file store.c
+*
+* @brief Implementation of the append-only store of the received readings.
+*
+* @date 17-Oct-2026
+* @copyright GNU General Public License v3
+*
+*/
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "store.h"
+
+#define STORE_LOCATIONS_FILE "locations"                /**< Name of the locations file in the store directory. */
+#define STORE_SEGMENT_FORMAT "segment_%08u.dat"        /**< Name of a segment file in the store directory. */
+
+
+static uint32_t crc_table[256];     /**< CRC-32 (IEEE 802.3) of every byte value. */
+
+/**
+ * @brief Fills the CRC-32 table, only the first call does the work.
+ */
+static void crc_init(void)
+{
+    uint32_t crc;
+    unsigned int i, bit;
+
+    if (crc_table[1])
+    {
+        return;
+    }
+
+    for (i = 0; i < 256; i++)
+    {
+        for (crc = i, bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+        }
+
+        crc_table[i] = crc;
+    }
+}
+
+
+/**
+ * @brief Returns the checksum of the record, computed over all fields before the checksum.
+ */
+static uint32_t record_checksum(const store_record_t *record)
+{
+    const uint8_t *data = (const uint8_t *) record;
+    uint32_t crc = 0xFFFFFFFFu;
+    size_t i;
+
+    for (i = 0; i < offsetof(store_record_t, checksum); i++)
+    {
+        crc = crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
+
+
+/**
+ * @brief Returns the size of the segment file with the given number of records.
+ */
+static size_t segment_size(uint32_t capacity)
+{
+    return sizeof(store_segment_header_t) + (size_t) capacity * sizeof(store_record_t);
+}
+
+
+/**
+ * @brief Inserts the location id into the hash table of the locations. The table has a free slot.
+ */
+static void location_index_insert(store_t *store, uint32_t id)
+{
+    uint32_t mask = store->location_index_size - 1;
+    uint32_t slot = location_hash(store->locations[id].name) & mask;
+
+    while (store->location_index[slot])
+    {
+        slot = (slot + 1) & mask;
+    }
+
+    store->location_index[slot] = id + 1;
+}
+
+
+/**
+ * @brief Returns the id of the location, -1 if the location is not known.
+ */
+static int64_t find_location(const store_t *store, const char *name)
+{
+    uint32_t mask = store->location_index_size - 1;
+    uint32_t slot = location_hash(name) & mask;
+    uint32_t entry;
+
+    while ((entry = store->location_index[slot]))
+    {
+        if (!strcmp(store->locations[entry - 1].name, name))
+        {
+            return entry - 1;
+        }
+
+        slot = (slot + 1) & mask;
+    }
+
+    return -1;
+}
+
+
+/**
+ * @brief Adds the location to the locations table and to its hash table, which are grown as
+ * needed. Does not write the locations file.
+ *
+ * @return id of the location, -1 if memory could not be allocated
+ */
+static int64_t insert_location(store_t *store, const char *name)
+{
+    store_location_t *locations;
+    uint32_t *location_index;
+    uint32_t i;
+
+    if (store->number_of_locations == store->locations_capacity)
+    {
+        locations = realloc(store->locations, 2 * store->locations_capacity * sizeof(store_location_t));
+
+        if (!locations)
+        {
+            return -1;
+        }
+
+        store->locations = locations;
+        store->locations_capacity *= 2;
+    }
+
+    //Keep the hash table at most half full
+    if (2 * (store->number_of_locations + 1) > store->location_index_size)
+    {
+        location_index = calloc(2 * store->location_index_size, sizeof(uint32_t));
+
+        if (!location_index)
+        {
+            return -1;
+        }
+
+        free(store->location_index);
+        store->location_index = location_index;
+        store->location_index_size *= 2;
+
+        for (i = 0; i < store->number_of_locations; i++)
+        {
+            location_index_insert(store, i);
+        }
+    }
+
+    i = store->number_of_locations++;
+
+    snprintf(store->locations[i].name, sizeof(store->locations[i].name), "%s", name);
+    store->locations[i].last_record = STORE_NO_RECORD;
+    store->locations[i].records = 0;
+
+    location_index_insert(store, i);
+
+    return i;
+}
+
+
+/**
+ * @brief Returns the id of the location. A new location is added and appended to the locations
+ * file, before any record refers to it.
+ *
+ * @return id of the location, -1 on failure
+ */
+static int64_t location_id(store_t *store, const char *name)
+{
+    char line[sizeof(store->locations[0].name) + 16];
+    int64_t id = find_location(store, name);
+    int length;
+
+    if (id >= 0)
+    {
+        return id;
+    }
+
+    //The name has to fit on one line of the locations file
+    if (strchr(name, '\n'))
+    {
+        return -1;
+    }
+
+    id = insert_location(store, name);
+
+    if (id < 0)
+    {
+        return -1;
+    }
+
+    length = snprintf(line, sizeof(line), "%u %s\n", (unsigned int) id, store->locations[id].name);
+
+    if (write(store->locations_fd, line, length) != length)
+    {
+        //The location is not known after a restart, forget it
+        store->number_of_locations--;
+        memset(store->location_index, 0, store->location_index_size * sizeof(uint32_t));
+
+        for (id = 0; id < store->number_of_locations; id++)
+        {
+            location_index_insert(store, id);
+        }
+
+        return -1;
+    }
+
+    return id;
+}
+
+
+/**
+ * @brief Returns the store id of the location with the dictionary id. The name is looked up
+ * only for the first reading of the dictionary id.
+ *
+ * @return id of the location, -1 on failure
+ */
+static int64_t dictionary_location_id(store_t *store, uint32_t dictionary_id)
+{
+    char name[sizeof(store->locations[0].name)];
+    const char *dictionary_name;
+    uint32_t *dictionary_map;
+    uint32_t size = store->dictionary_map_size;
+    int64_t id;
+
+    if ((dictionary_id < size) && store->dictionary_map[dictionary_id])
+    {
+        return store->dictionary_map[dictionary_id] - 1;
+    }
+
+    dictionary_name = location_dictionary_name(store->dictionary, dictionary_id);
+
+    if (!dictionary_name)
+    {
+        return -1;
+    }
+
+    //Longer names are stored cut off, as in the locations file
+    snprintf(name, sizeof(name), "%s", dictionary_name);
+    id = location_id(store, name);
+
+    if (id < 0)
+    {
+        return -1;
+    }
+
+    if (dictionary_id >= size)
+    {
+        while (size <= dictionary_id)
+        {
+            size *= 2;
+        }
+
+        dictionary_map = realloc(store->dictionary_map, size * sizeof(uint32_t));
+
+        //The id is resolved again with the next reading
+        if (!dictionary_map)
+        {
+            return id;
+        }
+
+        memset(dictionary_map + store->dictionary_map_size, 0, (size - store->dictionary_map_size) * sizeof(uint32_t));
+        store->dictionary_map = dictionary_map;
+        store->dictionary_map_size = size;
+    }
+
+    store->dictionary_map[dictionary_id] = (uint32_t) id + 1;
+
+    return id;
+}
+
+
+/**
+ * @brief Reads the locations file. A line cut off by a crash is removed from the file.
+ *
+ * @return 0 on success, -1 if the file could not be read
+ */
+static int load_locations(store_t *store)
+{
+    char path[sizeof(store->directory) + 32];
+    char line[sizeof(store->locations[0].name) + 16];
+    off_t complete = 0;
+    unsigned int id;
+    char *name;
+    size_t length;
+    FILE *file;
+
+    snprintf(path, sizeof(path), "%s/%s", store->directory, STORE_LOCATIONS_FILE);
+
+    store->locations_fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+
+    if (store->locations_fd < 0)
+    {
+        return -1;
+    }
+
+    file = fopen(path, "r");
+
+    if (!file)
+    {
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), file))
+    {
+        length = strlen(line);
+        name = strchr(line, ' ');
+
+        //The ids are written in order, a line with another id ends the valid part
+        if (!length || (line[length - 1] != '\n') || !name || (strtoul(line, NULL, 10) != store->number_of_locations))
+        {
+            break;
+        }
+
+        line[length - 1] = '\0';
+        id = store->number_of_locations;
+
+        if (insert_location(store, name + 1) != id)
+        {
+            fclose(file);
+            return -1;
+        }
+
+        complete += length;
+    }
+
+    fclose(file);
+
+    return ftruncate(store->locations_fd, complete);
+}
+
+
+/**
+ * @brief Maps the segment file, a new file is created with its full size.
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int map_segment(store_t *store, uint32_t segment, bool create)
+{
+    char path[sizeof(store->directory) + 32];
+    struct timespec now;
+    struct stat file_stat;
+    size_t size;
+    void *mapping;
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/" STORE_SEGMENT_FORMAT, store->directory, segment);
+
+    fd = open(path, create ? (O_RDWR | O_CREAT | O_EXCL) : O_RDWR, 0644);
+
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    if (create)
+    {
+        size = segment_size(store->capacity);
+
+        //The file is sparse, the disk space is allocated as the records are written
+        if (ftruncate(fd, size))
+        {
+            close(fd);
+            return -1;
+        }
+    }
+    else
+    {
+        if (fstat(fd, &file_stat) || (file_stat.st_size < (off_t) sizeof(store_segment_header_t)))
+        {
+            close(fd);
+            return -1;
+        }
+
+        size = file_stat.st_size;
+    }
+
+    mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    //The mapping stays valid without the descriptor
+    close(fd);
+
+    if (mapping == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    store->header = (store_segment_header_t *) mapping;
+    store->records = (store_record_t *) (store->header + 1);
+    store->segment = segment;
+    store->tail = 0;
+
+    if (create)
+    {
+        clock_gettime(CLOCK_REALTIME, &now);
+
+        memcpy(store->header->magic, STORE_MAGIC, sizeof(store->header->magic));
+        store->header->version = STORE_VERSION;
+        store->header->record_size = sizeof(store_record_t);
+        store->header->capacity = store->capacity;
+        store->header->segment = segment;
+        store->header->created = (uint64_t) now.tv_sec * 1000000000ull + now.tv_nsec;
+
+        return 0;
+    }
+
+    if (memcmp(store->header->magic, STORE_MAGIC, sizeof(store->header->magic)) ||
+        (store->header->version < 1) || (store->header->record_size != sizeof(store_record_t)) ||
+        (size != segment_size(store->header->capacity)))
+    {
+        munmap(mapping, size);
+        store->header = NULL;
+        return -1;
+    }
+
+    store->capacity = store->header->capacity;
+
+    return 0;
+}
+
+
+/**
+ * @brief Unmaps the current segment, with MS_SYNC it waits until it is written to the disk.
+ */
+static void unmap_segment(store_t *store, int flags)
+{
+    size_t size = segment_size(store->capacity);
+
+    msync(store->header, size, flags);
+    munmap(store->header, size);
+
+    store->header = NULL;
+    store->records = NULL;
+}
+
+
+/**
+ * @brief Finds the end of the valid records in the current segment and rebuilds the index of
+ * the last record of every location. Records behind the first invalid one are cleared, so they
+ * cannot be taken for valid records after the tail is overwritten.
+ */
+static void recover_tail(store_t *store)
+{
+    static const store_record_t empty;
+    store_record_t *record;
+    uint32_t i;
+
+    for (i = 0; i < store->capacity; i++)
+    {
+        record = &(store->records[i]);
+
+        if (!record->timestamp || (record->location_id >= store->number_of_locations) ||
+            (record->checksum != record_checksum(record)))
+        {
+            break;
+        }
+
+        store->locations[record->location_id].last_record = i;
+        store->locations[record->location_id].records++;
+    }
+
+    store->tail = i;
+    store->recovered = i;
+
+    for (; i < store->capacity; i++)
+    {
+        if (memcmp(&(store->records[i]), &empty, sizeof(empty)))
+        {
+            memset(&(store->records[i]), 0, sizeof(empty));
+        }
+    }
+}
+
+
+/**
+ * @brief Returns the number of the last segment file in the directory, -1 if there is none.
+ */
+static int64_t last_segment(const char *directory)
+{
+    struct dirent *entry;
+    int64_t last = -1;
+    unsigned int segment;
+    DIR *dir = opendir(directory);
+
+    if (!dir)
+    {
+        return -1;
+    }
+
+    while ((entry = readdir(dir)))
+    {
+        if ((sscanf(entry->d_name, STORE_SEGMENT_FORMAT, &segment) == 1) && ((int64_t) segment > last))
+        {
+            last = segment;
+        }
+    }
+
+    closedir(dir);
+
+    return last;
+}
+
+
+int store_open(store_t *store, const char *directory, uint32_t segment_records, const location_dictionary_t *dictionary)
+{
+    int64_t segment;
+
+    memset(store, 0, sizeof(store_t));
+
+    crc_init();
+
+    snprintf(store->directory, sizeof(store->directory), "%s", directory);
+    store->segment_records = segment_records ? segment_records : STORE_SEGMENT_RECORDS;
+    store->capacity = store->segment_records;
+    store->locations_capacity = 64;
+    store->location_index_size = 128;
+    store->locations = malloc(store->locations_capacity * sizeof(store_location_t));
+    store->location_index = calloc(store->location_index_size, sizeof(uint32_t));
+    store->dictionary = dictionary;
+    store->dictionary_map_size = 64;
+    store->dictionary_map = calloc(store->dictionary_map_size, sizeof(uint32_t));
+
+    if (!store->locations || !store->location_index || !store->dictionary_map || load_locations(store))
+    {
+        goto error;
+    }
+
+    segment = last_segment(directory);
+
+    if (segment < 0)
+    {
+        if (map_segment(store, 0, true))
+        {
+            goto error;
+        }
+    }
+    else
+    {
+        if (map_segment(store, (uint32_t) segment, false))
+        {
+            goto error;
+        }
+
+        recover_tail(store);
+    }
+
+    pthread_mutex_init(&(store->lock), NULL);
+
+    return 0;
+
+error:
+    if (store->locations_fd > 0)
+    {
+        close(store->locations_fd);
+    }
+
+    free(store->locations);
+    free(store->location_index);
+    free(store->dictionary_map);
+
+    return -1;
+}
+
+
+int store_append(store_t *store, const void *readings, unsigned int number_of_readings, size_t entry_size)
+{
+    const reading_t *reading;
+    store_location_t *location;
+    store_record_t record;
+    struct timespec now;
+    uint64_t timestamp;
+    int64_t id;
+    uint32_t i;
+    int rc = 0;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    timestamp = (uint64_t) now.tv_sec * 1000000000ull + now.tv_nsec;
+
+    pthread_mutex_lock(&(store->lock));
+
+    for (; number_of_readings; number_of_readings--, readings = (const char *) readings + entry_size)
+    {
+        reading = (const reading_t *) readings;
+
+        if (!store->header || (store->tail == store->capacity))
+        {
+            //The full segment is written back in the background
+            if (store->header)
+            {
+                unmap_segment(store, MS_ASYNC);
+            }
+
+            for (i = 0; i < store->number_of_locations; i++)
+            {
+                store->locations[i].last_record = STORE_NO_RECORD;
+            }
+
+            store->capacity = store->segment_records;
+
+            if (map_segment(store, store->segment + 1, true))
+            {
+                rc = -1;
+                break;
+            }
+        }
+
+        id = dictionary_location_id(store, reading->location_id);
+
+        if (id < 0)
+        {
+            rc = -1;
+            continue;
+        }
+
+        location = &(store->locations[id]);
+
+        record.timestamp = timestamp;
+        record.location_id = (uint32_t) id;
+        record.previous = location->last_record;
+        record.temperature = reading->temperature;
+        record.pressure = reading->pressure;
+        record.humidity = reading->humidity;
+        record.reserved = 0;
+        record.checksum = record_checksum(&record);
+
+        memcpy(&(store->records[store->tail]), &record, sizeof(record));
+
+        location->last_record = store->tail++;
+        location->records++;
+        store->appended++;
+    }
+
+    pthread_mutex_unlock(&(store->lock));
+
+    return rc;
+}
+
+
+int store_last_record(store_t *store, const char *location, store_record_t *record)
+{
+    int64_t id;
+    int rc = -1;
+
+    pthread_mutex_lock(&(store->lock));
+
+    id = find_location(store, location);
+
+    if ((id >= 0) && store->header && (store->locations[id].last_record != STORE_NO_RECORD))
+    {
+        memcpy(record, &(store->records[store->locations[id].last_record]), sizeof(store_record_t));
+        rc = 0;
+    }
+
+    pthread_mutex_unlock(&(store->lock));
+
+    return rc;
+}
+
+
+void store_close(store_t *store)
+{
+    if (store->header)
+    {
+        unmap_segment(store, MS_SYNC);
+    }
+
+    close(store->locations_fd);
+
+    pthread_mutex_destroy(&(store->lock));
+
+    free(store->locations);
+    free(store->location_index);
+    free(store->dictionary_map);
+    store->locations = NULL;
+    store->location_index = NULL;
+    store->dictionary_map = NULL;
+}
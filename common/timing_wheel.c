@@ -0,0 +1,228 @@
+/**
+* @file timing_wheel.c
+*
+* @brief Implementation of the hierarchical timing wheel.
+*
+* @date 17-Oct-2026
+* @copyright GNU General Public License v3
+*
+*/
+
+#include <string.h>
+
+#include "mqtt_userdefs.h"
+#include "timing_wheel.h"
+
+#define LEVEL0_MASK (TIMING_WHEEL_LEVEL0_SLOTS - 1)
+#define LEVEL_MASK (TIMING_WHEEL_LEVEL_SLOTS - 1)
+
+
+/**
+ * @brief Returns the number of ticks covered by the levels up to the given one.
+ */
+static inline uint64_t level_range(unsigned int level)
+{
+    return 1ull << (TIMING_WHEEL_LEVEL0_BITS + level * TIMING_WHEEL_LEVEL_BITS);
+}
+
+
+/**
+ * @brief Returns the slot index of the tick in the given higher level.
+ */
+static inline unsigned int level_index(uint64_t tick, unsigned int level)
+{
+    return (unsigned int) (tick >> (TIMING_WHEEL_LEVEL0_BITS + (level - 1) * TIMING_WHEEL_LEVEL_BITS)) & LEVEL_MASK;
+}
+
+
+/**
+ * @brief Links the timer into the slot of the lowest level that covers its expiry.
+ */
+static void link_timer(timing_wheel_t *wheel, timing_wheel_timer_t *timer)
+{
+    timing_wheel_timer_t **slot;
+    uint64_t expires = timer->expires < wheel->current ? wheel->current : timer->expires;
+    uint64_t delta = expires - wheel->current;
+    unsigned int level;
+
+    if (delta < TIMING_WHEEL_LEVEL0_SLOTS)
+    {
+        slot = &(wheel->level0[expires & LEVEL0_MASK]);
+    }
+    else
+    {
+        for (level = 1; (level < TIMING_WHEEL_LEVELS - 1) && (delta >= level_range(level)); level++);
+
+        //Beyond the range of the wheel: parked in the last slot, cascaded again from there
+        if (delta >= level_range(level))
+        {
+            expires = wheel->current + level_range(level) - 1;
+        }
+
+        slot = &(wheel->levels[level - 1][level_index(expires, level)]);
+    }
+
+    timer->next = *slot;
+
+    if (timer->next)
+    {
+        timer->next->pprev = &(timer->next);
+    }
+
+    timer->pprev = slot;
+    *slot = timer;
+}
+
+
+/**
+ * @brief Removes the timer from its slot.
+ */
+static inline void unlink_timer(timing_wheel_timer_t *timer)
+{
+    *(timer->pprev) = timer->next;
+
+    if (timer->next)
+    {
+        timer->next->pprev = timer->pprev;
+    }
+
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+
+/**
+ * @brief Moves the timers of a higher level slot to the lower levels.
+ *
+ * @return slot index, 0 means the level completed a turn and the next level has to be cascaded too
+ */
+static unsigned int cascade(timing_wheel_t *wheel, unsigned int level)
+{
+    unsigned int index = level_index(wheel->current, level);
+    timing_wheel_timer_t *timer = wheel->levels[level - 1][index];
+    timing_wheel_timer_t *next;
+
+    wheel->levels[level - 1][index] = NULL;
+
+    for (; timer; timer = next)
+    {
+        next = timer->next;
+        link_timer(wheel, timer);
+        wheel->cascaded++;
+    }
+
+    return index;
+}
+
+
+void timing_wheel_init(timing_wheel_t *wheel, uint64_t start, uint64_t tick_ns)
+{
+    memset(wheel, 0, sizeof(timing_wheel_t));
+
+    wheel->start = start;
+    wheel->tick_ns = tick_ns ? tick_ns : 1;
+
+    histogram_init(&(wheel->lateness));
+}
+
+
+void timing_wheel_add(timing_wheel_t *wheel, timing_wheel_timer_t *timer, uint64_t due)
+{
+    timer->due = due;
+    timer->expires = due > wheel->start ? (due - wheel->start + wheel->tick_ns - 1) / wheel->tick_ns : 0;
+
+    link_timer(wheel, timer);
+    wheel->pending++;
+}
+
+
+void timing_wheel_cancel(timing_wheel_t *wheel, timing_wheel_timer_t *timer)
+{
+    if (!timer->pprev)
+    {
+        return;
+    }
+
+    unlink_timer(timer);
+    wheel->pending--;
+}
+
+
+unsigned long timing_wheel_advance(timing_wheel_t *wheel, uint64_t now, timing_wheel_expire_f expire, void *context)
+{
+    timing_wheel_timer_t *expiring, *timer;
+    uint64_t last, time;
+    unsigned long expired = 0;
+    unsigned int index, level;
+
+    if (now < wheel->start)
+    {
+        return 0;
+    }
+
+    last = (now - wheel->start) / wheel->tick_ns;
+
+    while (wheel->current <= last)
+    {
+        index = wheel->current & LEVEL0_MASK;
+
+        //A turn of the first level is complete, the timers of the next turn move down
+        for (level = 1; !index && (level < TIMING_WHEEL_LEVELS); level++)
+        {
+            index = cascade(wheel, level);
+        }
+
+        index = wheel->current & LEVEL0_MASK;
+
+        //The expiring timers are moved to a list of their own, so a timer scheduled again
+        //by the expire function waits at least for the next tick
+        expiring = wheel->level0[index];
+        wheel->level0[index] = NULL;
+
+        if (expiring)
+        {
+            expiring->pprev = &expiring;
+        }
+
+        wheel->current++;
+        wheel->ticks++;
+
+        while (expiring)
+        {
+            timer = expiring;
+            unlink_timer(timer);
+            wheel->pending--;
+            wheel->expired++;
+            expired++;
+
+            time = monotonic_time_ns();
+            histogram_record(&(wheel->lateness), time > timer->due ? time - timer->due : 0);
+
+            expire(wheel, timer, context);
+        }
+    }
+
+    return expired;
+}
+
+
+uint64_t timing_wheel_next_time(const timing_wheel_t *wheel)
+{
+    uint64_t tick = wheel->current;
+
+    //The cascade at the start of a turn can bring timers for this tick
+    if (tick & LEVEL0_MASK)
+    {
+        while (!wheel->level0[tick & LEVEL0_MASK])
+        {
+            tick++;
+
+            if (!(tick & LEVEL0_MASK))
+            {
+                break;
+            }
+        }
+    }
+
+    return wheel->start + tick * wheel->tick_ns;
+}
@@ -0,0 +1,505 @@
+/**
+* @file topic_router.c
+*
+* @brief Implementation of the topic router.
+*
+* @date 17-Oct-2026
+* @copyright GNU General Public License v3
+*
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "topic_router.h"
+#include "mqtt_userdefs.h"
+
+#define INITIAL_ROUTES 8        /**< Initial capacity of the route array. */
+#define INITIAL_NODES 16        /**< Initial capacity of the node array. */
+
+
+/**
+ * @brief Levels of a topic, split without copying.
+ */
+typedef struct {
+    const char *topic;
+    uint16_t length;
+    unsigned int number_of_levels;
+    topic_segment_t levels[TOPIC_ROUTER_MAX_LEVELS];
+    uint32_t hashes[TOPIC_ROUTER_MAX_LEVELS];
+} topic_levels_t;
+
+/**
+ * @brief State of one dispatch.
+ */
+typedef struct {
+    const topic_router_t *router;
+    const topic_levels_t *levels;
+    const void *payload;
+    size_t payload_length;
+    void *message_context;
+    topic_match_t match;
+    unsigned int matched;
+} dispatch_t;
+
+
+/**
+ * @brief Returns the first slot of the literal child in the hash table.
+ */
+static inline uint32_t child_slot(const topic_router_t *router, uint32_t parent, uint32_t hash)
+{
+    return (hash ^ (parent * 2654435761u)) & (router->children_size - 1);
+}
+
+
+/**
+ * @brief Returns the literal child of the node, TOPIC_ROUTER_NONE if there is none.
+ */
+static uint32_t find_child(const topic_router_t *router, uint32_t parent, const char *level, uint16_t length, uint32_t hash)
+{
+    uint32_t mask = router->children_size - 1;
+    uint32_t slot = child_slot(router, parent, hash);
+    const topic_node_t *node;
+    uint32_t entry;
+
+    while ((entry = router->children[slot]))
+    {
+        node = &(router->nodes[entry - 1]);
+
+        if ((node->parent == parent) && (node->hash == hash) && (node->length == length) && !memcmp(node->level, level, length))
+        {
+            return entry - 1;
+        }
+
+        slot = (slot + 1) & mask;
+    }
+
+    return TOPIC_ROUTER_NONE;
+}
+
+
+/**
+ * @brief Stores the index of a literal node in the hash table.
+ */
+static void insert_child(topic_router_t *router, uint32_t index)
+{
+    uint32_t mask = router->children_size - 1;
+    uint32_t slot = child_slot(router, router->nodes[index].parent, router->nodes[index].hash);
+
+    while (router->children[slot])
+    {
+        slot = (slot + 1) & mask;
+    }
+
+    router->children[slot] = index + 1;
+}
+
+
+/**
+ * @brief Appends a node to the trie. A literal node is added to the hash table too, a node
+ * without level text is the '+' child of its parent.
+ *
+ * @return index of the node, TOPIC_ROUTER_NONE if memory could not be allocated
+ */
+static uint32_t add_node(topic_router_t *router, uint32_t parent, const char *level, uint16_t length)
+{
+    topic_node_t *nodes;
+    topic_node_t *node;
+    uint32_t *children;
+    uint32_t i;
+
+    if (router->number_of_nodes == router->nodes_capacity)
+    {
+        nodes = realloc(router->nodes, 2 * router->nodes_capacity * sizeof(topic_node_t));
+
+        if (!nodes)
+        {
+            return TOPIC_ROUTER_NONE;
+        }
+
+        router->nodes = nodes;
+        router->nodes_capacity *= 2;
+    }
+
+    //Keep the hash table at most half full
+    if (level && (2 * (router->number_of_nodes + 1) > router->children_size))
+    {
+        children = calloc(2 * router->children_size, sizeof(uint32_t));
+
+        if (!children)
+        {
+            return TOPIC_ROUTER_NONE;
+        }
+
+        free(router->children);
+        router->children = children;
+        router->children_size *= 2;
+
+        for (i = 1; i < router->number_of_nodes; i++)
+        {
+            if (router->nodes[i].level)
+            {
+                insert_child(router, i);
+            }
+        }
+    }
+
+    node = &(router->nodes[router->number_of_nodes]);
+    node->parent = parent;
+    node->level = level;
+    node->length = length;
+    node->hash = level ? location_hash_n(level, length) : 0;
+    node->plus = TOPIC_ROUTER_NONE;
+    node->routes = TOPIC_ROUTER_NONE;
+    node->multi_level_routes = TOPIC_ROUTER_NONE;
+
+    if (level)
+    {
+        insert_child(router, router->number_of_nodes);
+    }
+
+    return router->number_of_nodes++;
+}
+
+
+/**
+ * @brief Removes the nodes from the given index on, added by a failed topic_router_add(). They
+ * refer to the level texts of its filter and have no routes.
+ */
+static void remove_nodes(topic_router_t *router, uint32_t number_of_nodes)
+{
+    uint32_t i;
+
+    for (i = number_of_nodes; i < router->number_of_nodes; i++)
+    {
+        if (router->nodes[router->nodes[i].parent].plus == i)
+        {
+            router->nodes[router->nodes[i].parent].plus = TOPIC_ROUTER_NONE;
+        }
+    }
+
+    router->number_of_nodes = number_of_nodes;
+
+    //The probe sequences may pass the removed nodes, so the hash table is built again
+    memset(router->children, 0, router->children_size * sizeof(uint32_t));
+
+    for (i = 1; i < router->number_of_nodes; i++)
+    {
+        if (router->nodes[i].level)
+        {
+            insert_child(router, i);
+        }
+    }
+}
+
+
+/**
+ * @brief Checks the filter against the MQTT rules: '#' only as the whole last level, '+' only
+ * as a whole level.
+ *
+ * @return 0 for a valid filter, -1 otherwise
+ */
+static int check_filter(const char *filter)
+{
+    unsigned int levels = 1, wildcards = 0;
+    const char *c;
+    size_t length = strlen(filter);
+
+    if (!length || (length > UINT16_MAX))
+    {
+        return -1;
+    }
+
+    for (c = filter; *c; c++)
+    {
+        if (*c == '/')
+        {
+            levels++;
+        }
+        else if ((*c == '+') || (*c == '#'))
+        {
+            //The wildcard has to be the whole level, '#' the last one too
+            if (((c != filter) && (c[-1] != '/')) || ((c[1] != '/') && c[1]) || ((*c == '#') && c[1]))
+            {
+                return -1;
+            }
+
+            wildcards++;
+        }
+    }
+
+    return ((levels > TOPIC_ROUTER_MAX_LEVELS) || (wildcards > TOPIC_ROUTER_MAX_CAPTURES)) ? -1 : 0;
+}
+
+
+/**
+ * @brief Appends the route to a list, the routes are called in the order they were added.
+ */
+static void link_route(topic_router_t *router, uint32_t *list, uint32_t route)
+{
+    while (*list != TOPIC_ROUTER_NONE)
+    {
+        list = &(router->routes[*list].next);
+    }
+
+    *list = route;
+}
+
+
+/**
+ * @brief Calls the handlers of the routes in the list.
+ */
+static void call_routes(dispatch_t *dispatch, uint32_t route, unsigned int number_of_captures)
+{
+    const topic_route_t *routes = dispatch->router->routes;
+
+    dispatch->match.number_of_captures = number_of_captures;
+
+    for (; route != TOPIC_ROUTER_NONE; route = routes[route].next)
+    {
+        routes[route].handler(routes[route].context, dispatch->message_context, &(dispatch->match),
+                              dispatch->payload, dispatch->payload_length);
+        dispatch->matched++;
+    }
+}
+
+
+/**
+ * @brief Matches the levels of the topic from the given one below the node.
+ *
+ * @param[in, out] dispatch state of the dispatch
+ * @param[in] index node matched by the previous levels
+ * @param[in] level first level still to be matched
+ * @param[in] number_of_captures wildcards matched by the previous levels
+ */
+static void match_levels(dispatch_t *dispatch, uint32_t index, unsigned int level, unsigned int number_of_captures)
+{
+    const topic_router_t *router = dispatch->router;
+    const topic_levels_t *levels = dispatch->levels;
+    const topic_node_t *node = &(router->nodes[index]);
+    topic_segment_t *capture = &(dispatch->match.captures[number_of_captures]);
+    uint32_t child;
+
+    //Topics starting with '$' are not matched by a wildcard in the first level
+    bool wildcards = level || (levels->topic[0] != '$');
+
+    //'#' matches the rest of the topic, also no level at all
+    if (wildcards && (node->multi_level_routes != TOPIC_ROUTER_NONE))
+    {
+        capture->offset = level < levels->number_of_levels ? levels->levels[level].offset : levels->length;
+        capture->length = levels->length - capture->offset;
+        call_routes(dispatch, node->multi_level_routes, number_of_captures + 1);
+    }
+
+    if (level == levels->number_of_levels)
+    {
+        call_routes(dispatch, node->routes, number_of_captures);
+        return;
+    }
+
+    child = find_child(router, index, levels->topic + levels->levels[level].offset, levels->levels[level].length, levels->hashes[level]);
+
+    if (child != TOPIC_ROUTER_NONE)
+    {
+        match_levels(dispatch, child, level + 1, number_of_captures);
+    }
+
+    if (wildcards && (node->plus != TOPIC_ROUTER_NONE))
+    {
+        *capture = levels->levels[level];
+        match_levels(dispatch, node->plus, level + 1, number_of_captures + 1);
+    }
+}
+
+
+int topic_router_init(topic_router_t *router)
+{
+    memset(router, 0, sizeof(topic_router_t));
+
+    router->routes = malloc(INITIAL_ROUTES * sizeof(topic_route_t));
+    router->nodes = malloc(INITIAL_NODES * sizeof(topic_node_t));
+    router->children = calloc(2 * INITIAL_NODES, sizeof(uint32_t));
+
+    if (!router->routes || !router->nodes || !router->children)
+    {
+        topic_router_clean_up(router);
+        return -1;
+    }
+
+    router->routes_capacity = INITIAL_ROUTES;
+    router->nodes_capacity = INITIAL_NODES;
+    router->children_size = 2 * INITIAL_NODES;
+
+    //The root
+    add_node(router, TOPIC_ROUTER_NONE, NULL, 0);
+
+    return 0;
+}
+
+
+int topic_router_add(topic_router_t *router, const char *filter, topic_handler_f handler, void *context)
+{
+    topic_route_t *routes;
+    topic_route_t *route;
+    const char *level, *end;
+    uint32_t index = 0, child;
+    uint32_t number_of_nodes = router->number_of_nodes;
+    uint16_t length;
+
+    if (check_filter(filter))
+    {
+        printf("Error: Invalid topic filter %s\n", filter);
+        return -1;
+    }
+
+    if (router->number_of_routes == router->routes_capacity)
+    {
+        routes = realloc(router->routes, 2 * router->routes_capacity * sizeof(topic_route_t));
+
+        if (!routes)
+        {
+            return -1;
+        }
+
+        router->routes = routes;
+        router->routes_capacity *= 2;
+    }
+
+    route = &(router->routes[router->number_of_routes]);
+    route->filter = strdup(filter);
+    route->handler = handler;
+    route->context = context;
+    route->next = TOPIC_ROUTER_NONE;
+
+    if (!route->filter)
+    {
+        return -1;
+    }
+
+    //The nodes refer to the level texts in the copy of the filter, kept until the clean up
+    for (level = route->filter; ; level = end + 1)
+    {
+        end = strchr(level, '/');
+        length = (uint16_t) (end ? end - level : strlen(level));
+
+        if (*level == '#')
+        {
+            link_route(router, &(router->nodes[index].multi_level_routes), router->number_of_routes++);
+            return 0;
+        }
+
+        if (*level == '+')
+        {
+            child = router->nodes[index].plus;
+
+            if (child == TOPIC_ROUTER_NONE)
+            {
+                child = add_node(router, index, NULL, 0);
+                router->nodes[index].plus = child;
+            }
+        }
+        else
+        {
+            child = find_child(router, index, level, length, location_hash_n(level, length));
+
+            if (child == TOPIC_ROUTER_NONE)
+            {
+                child = add_node(router, index, level, length);
+            }
+        }
+
+        if (child == TOPIC_ROUTER_NONE)
+        {
+            //The nodes added so far refer to the filter
+            remove_nodes(router, number_of_nodes);
+            free(route->filter);
+            return -1;
+        }
+
+        index = child;
+
+        if (!end)
+        {
+            break;
+        }
+    }
+
+    link_route(router, &(router->nodes[index].routes), router->number_of_routes++);
+
+    return 0;
+}
+
+
+unsigned int topic_router_dispatch(const topic_router_t *router, const char *topic, const void *payload, size_t payload_length, void *message_context)
+{
+    topic_levels_t levels;
+    dispatch_t dispatch;
+    const char *level, *end;
+    size_t length = strlen(topic);
+
+    if (length > UINT16_MAX)
+    {
+        return 0;
+    }
+
+    levels.topic = topic;
+    levels.length = (uint16_t) length;
+    levels.number_of_levels = 0;
+
+    for (level = topic; ; level = end + 1)
+    {
+        if (levels.number_of_levels == TOPIC_ROUTER_MAX_LEVELS)
+        {
+            return 0;
+        }
+
+        end = strchr(level, '/');
+
+        levels.levels[levels.number_of_levels].offset = (uint16_t) (level - topic);
+        levels.levels[levels.number_of_levels].length = (uint16_t) (end ? end - level : strlen(level));
+        levels.hashes[levels.number_of_levels] = location_hash_n(level, levels.levels[levels.number_of_levels].length);
+        levels.number_of_levels++;
+
+        if (!end)
+        {
+            break;
+        }
+    }
+
+    dispatch.router = router;
+    dispatch.levels = &levels;
+    dispatch.payload = payload;
+    dispatch.payload_length = payload_length;
+    dispatch.message_context = message_context;
+    dispatch.match.topic = topic;
+    dispatch.matched = 0;
+
+    match_levels(&dispatch, 0, 0, 0);
+
+    return dispatch.matched;
+}
+
+
+uint32_t topic_segment_hash(const topic_match_t *match, unsigned int capture)
+{
+    return location_hash_n(match->topic + match->captures[capture].offset, match->captures[capture].length);
+}
+
+
+void topic_router_clean_up(topic_router_t *router)
+{
+    uint32_t i;
+
+    for (i = 0; i < router->number_of_routes; i++)
+    {
+        free(router->routes[i].filter);
+    }
+
+    free(router->routes);
+    free(router->nodes);
+    free(router->children);
+
+    memset(router, 0, sizeof(topic_router_t));
+}
@@ -5,12 +5,12 @@
 *  Readings from Pi Sense HAT sensors are used as 
 *  MQTT message payload in JSON fomar so it can
 *  be processed by Home Assistant which plays the
-*  role of a subscriber to MQTT topics.
+*  role of a subscriber to MQTT topics. With -e simulated
+*  the readings come from simulated sensors.
 *
 *  Exernal dependences:
 *   - libmosquitto (https://mosquitto.org)
-*   - libsetila v0.5.7 or newer (https://github.com/positronic57)
-*   - libjsoncpp (https://github.com/open-source-parsers/jsoncpp)
+*   - libsetila v0.5.7 or newer (https://github.com/positronic57), optional
 * 
 *  @date 10-Jun-2025
 *  @copyright GNU General Public License v3
@@ -20,16 +20,13 @@
 #include <cstdint>
 #include <string>
 
-#include <unistd.h> // For sleep()
-
-#include "setila/setila_i2c.h"
-#include "setila/LPS25H.h"
-#include "setila/HTS221.h"
-
-#include "json/json.h"
-
 extern "C" {
 #include "mosquitto.h"
+#include "ha_json.h"
+#include "histogram.h"
+#include "mqtt_userdefs.h"
+#include "sampler.h"
+#include "sensor.h"
 }
 
 
@@ -41,75 +38,60 @@ extern "C" {
 
 #define MQTT_HA_AMBIENT_TOPIC "home/ambient_data/living_room"
 
+#define HA_SAMPLE_PERIOD_MS 60000     // One reading per minute
+#define HA_NUMBER_OF_SAMPLES 10
+
 
 struct AmbientData {
     std::string location;
     double temperature = 0.0;
     double pressure = 0.0;
     double humidity = 0.0;
-    std::string as_json_string();
+    int as_json(char *buffer, size_t size) const;
 };
 
 
-std::string AmbientData::as_json_string()
+// Writes the same JSON document as jsoncpp with an empty indentation, precision 2
+// and precision type "decimal", into the buffer without any heap allocation.
+// Returns the length of the document, -1 if the buffer is too small.
+int AmbientData::as_json(char *buffer, size_t size) const
 {
-    Json::Value ha_json;
-    Json::StreamWriterBuilder builder;
-    
-    // Configure the JSON as string writer
-    builder["indentation"] = "";
-    builder["precision"] = 2;
-    builder["precisionType"] = "decimal";
-
-    // Build the JSON document
-    ha_json["temperature"] = temperature;
-    ha_json["pressure"] = pressure;
-    ha_json["humidity"] = humidity;
-
-    // Convert the JSON to a string
-    return Json::writeString(builder, ha_json);
+    return ha_json_ambient(buffer, size, temperature, pressure, humidity);
 }
 
 
-int init_ambient_sensors(LPS25H *lps25h_sensor, HTS221 *hts221_sensor)
+// Used only by the publishing thread after the connection
+static struct mosquitto *mosq = nullptr;
+
+static struct AmbientData ambient_data;
+
+
+// Called in the publishing thread for every reading. The time spent here,
+// including a slow broker, does not delay the next reading of the sensors.
+static int publish_reading(void *entry)
 {
-    // Set LPS25H internal temperature average to 16 and pressure to 32
-    int status = lps25h_sensor->set_resolution(0x01, 0x01);
-    if (status)
-    {
-        std::cout << "HTS221 sensor set resolution failed." << std::endl;
-        return status;
-    }
+    const sampler_reading_t *reading = (const sampler_reading_t *) entry;
+    char mqtt_payload[HA_JSON_MAX_LENGTH];
+    int mqtt_payload_length;
 
-    status = lps25h_sensor->set_mode_of_operation(
-                ST_Sensor::MODE_OF_OPERATION::OP_FIFO_MEAN_MODE,
-                ST_Sensor::OUTPUT_DATA_RATE::ODR_1_Hz,
-                LPS25H_NBR_AVERAGED_SAMPLES::AVER_SAMPLES_4
-              );
+    std::cout << std::endl << "Pi Sense Hat sensor reading #" << reading->sequence + 1 << ":" << std::endl;
+    std::cout << "Pressure P = " << reading->pressure << "[hPa]" << std::endl;
+    std::cout << "Temperature T = " << reading->temperature << "[°C]" << std::endl;
+    std::cout << "Relative Humidity R = " << reading->humidity << "[%rH]" << std::endl;
+    std::cout << "Sampled " << (reading->time - reading->deadline) / 1000 << "[us] after the deadline" << std::endl;
+    std::cout << std::endl;
 
-    if (status)
-    {
-        std::cout << "LPS25H sensor initialization failed." << std::endl;
-        return status;
-    }
+    ambient_data.temperature = reading->temperature;
+    ambient_data.pressure = reading->pressure;
+    ambient_data.humidity = reading->humidity;
 
-    //Set HTS221 internal temperature average to 32 and humidity to 64
-    status = hts221_sensor->set_resolution(0x04, 0x04);
-    if (status)
-    {
-        std::cout << "HTS221 sensor set resolution failed." << std::endl;
-        return status;
-    }
+    mqtt_payload_length = ambient_data.as_json(mqtt_payload, sizeof(mqtt_payload));
+    std::cout << "JSON payload for reading number #" << reading->sequence + 1 << std::endl;
+    std::cout << mqtt_payload << std::endl;
 
-    // Configure HTS221 for ONE SHOT type of measurements
-    status = hts221_sensor->set_mode_of_operation(ST_Sensor::MODE_OF_OPERATION::OP_ONE_SHOT);
-    if (status)
-    {
-        std::cout << "HTS221 sensor initialization failed." << std::endl;
-        return status;
-    }
+    mosquitto_publish(mosq, NULL, MQTT_HA_AMBIENT_TOPIC, mqtt_payload_length, mqtt_payload, 0, false);
 
-    return status;
+    return 0;
 }
 
 
@@ -140,79 +122,58 @@ int main(int argc, char *argv[])
 {
     int status = 0;
 
-    struct mosquitto *mosq = nullptr;
+    start_arg_t start_arg = {};
+
+    sensor_t sensor;
 
-    Bus_Master_Device *i2c_bus_master = new Bus_Master_Device("/dev/i2c-1", BUS_TYPE::I2C_BUS);
+    // Only the sensor backend (-e) and the sample period (-P) are taken from the arguments
+    start_arg.sample_period_ms = HA_SAMPLE_PERIOD_MS;
+    process_arguments(argc, argv, &start_arg);
 
-    LPS25H *lps25h_sensor = new LPS25H(Slave_Device_Type::I2C_SLAVE_DEVICE, i2c_bus_master, 0x5C);
-    HTS221 *hts221_sensor = new HTS221(Slave_Device_Type::I2C_SLAVE_DEVICE, i2c_bus_master, 0x5F);
+    if (!start_arg.sample_period_ms) {
+        std::cout << "Error: the sample period must be at least 1 ms" << std::endl;
+        return -1;
+    }
 
-    struct AmbientData ambient_data;
+    if (sensor_open(&sensor, start_arg.sensor)) {
+        std::cout << "Error: opening the sensors failed" << std::endl;
+        return -1;
+    }
 
     do //only once
     {
-        status = i2c_bus_master->open_bus();
+        status = prepare_MQTT_connection(&mosq);
         if (status) {
-            std::cout << "Failed to open master bus" << std::endl;
             break;
         }
 
-        status = init_ambient_sensors(lps25h_sensor, hts221_sensor);
-        if (status) {
-            break;
-        }
+        ambient_data.location = "living_room";
 
-        status = prepare_MQTT_connection(&mosq);
+        sampler_t sampler;
+
+        // Do 10 measurements with period of 60s (-P), on a fixed schedule in the sampling thread
+        status = sampler_start(&sampler, start_arg.sample_period_ms * 1000000ull, HA_NUMBER_OF_SAMPLES, sensor_read, &sensor, publish_reading, 0);
         if (status) {
+            std::cout << "Starting the sampling thread failed" << std::endl;
             break;
         }
 
-        ambient_data.location = "living_room";
+        sampler_join(&sampler);
+
+        std::cout << std::endl << "Sampling jitter p50 = " << histogram_percentile(&sampler.jitter, 50) / 1000
+                  << "[us], p99 = " << histogram_percentile(&sampler.jitter, 99) / 1000
+                  << "[us], max = " << sampler.jitter.max / 1000 << "[us]" << std::endl;
+        std::cout << "Readings published " << sampler.samples << ", failed " << sampler.failed
+                  << ", missed deadlines " << sampler.missed << ", dropped " << sampler.dropped << std::endl;
 
-        std::string mqtt_payload;
-        int loop = 0;
-        do // Do 10 measurements with period of 60s
-        {
-            status = lps25h_sensor->get_sensor_readings();
-            if (status) {
-                std::cout << "LPS25H pressure/temperature measurement failed." << std::endl;
-                break;
-            }
-
-            status = hts221_sensor->get_sensor_readings();
-            if (status) {
-                std::cout << "HTS221 humidity/temperature measurement failed." << std::endl;
-                break;
-            }
-
-            std::cout << std::endl << "Pi Sense Hat sensor reading #" << loop + 1 << ":" << std::endl;
-            std::cout << "Pressure P = " << lps25h_sensor->pressure_reading() << "[hPa]" << std::endl;
-            std::cout << "Temperature T = " << lps25h_sensor->temperature_reading() << "[°C]" << std::endl;
-            std::cout << "Relative Humidity R = " << hts221_sensor->humidity_reading() << "[%rH]" << std::endl;
-            std::cout << std::endl;
-
-            ambient_data.temperature = lps25h_sensor->temperature_reading();
-            ambient_data.pressure = lps25h_sensor->pressure_reading();
-            ambient_data.humidity = hts221_sensor->humidity_reading();
-
-            mqtt_payload = ambient_data.as_json_string();
-            std::cout << "JSON payload for reading number #" << loop + 1 << std::endl;
-            std::cout << mqtt_payload << std::endl;
-
-            mosquitto_publish(mosq, NULL, MQTT_HA_AMBIENT_TOPIC, mqtt_payload.length(), mqtt_payload.c_str(), 0, false);
-
-            // Sleep for about a minute
-            sleep(60);
-        }while(++loop < 10);
+        status = (sampler.samples == HA_NUMBER_OF_SAMPLES) ? 0 : -1;
 
     }while(0);
 
     mosquitto_destroy(mosq);
     mosquitto_lib_cleanup();
 
-    delete lps25h_sensor;
-    delete hts221_sensor;
-    delete i2c_bus_master;
+    sensor_close(&sensor);
 
     return status;
 }
@@ -0,0 +1,136 @@
+/**
+* @file aggregator.h
+*
+* @brief Rolling window statistics of the readings of every location.
+*
+* Every window is split into AGGREGATOR_SLOTS time slots of equal length. A slot keeps the
+* count, the sum, the sum of squares, the minimum and the maximum of every value of the
+* readings received in its time. A reading goes to the slot of the current time, a slot
+* left from an earlier round is cleared first. The statistics of a window are reduced from
+* the slots of the last AGGREGATOR_SLOTS slot lengths, so a window of 60 s covers between
+* 56.25 and 60 s of readings.
+*
+* The slots are kept as a structure of arrays, one array per value and per statistic, so the
+* reduction runs over contiguous arrays the compiler can vectorize. The windows of the locations
+* are indexed by the id of the location dictionary.
+*
+* @date 17-Oct-2026
+* @copyright GNU General Public License v3
+*
+*/
+
+#ifndef AGGREGATOR_H
+#define AGGREGATOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "mqtt_userdefs.h"
+
+#define AGGREGATOR_MAX_WINDOWS 4            /**< Maximal number of windows. */
+#define AGGREGATOR_SLOTS 16                 /**< Number of time slots of one window. */
+#define AGGREGATOR_VALUES 3                 /**< Aggregated values of a reading: temperature, pressure and humidity. */
+#define AGGREGATOR_DEFAULT_WINDOWS "10,60,900"     /**< Default window lengths in seconds. */
+
+
+/**
+ * @brief Time slots of one window of one location, as a structure of arrays.
+ */
+typedef struct {
+    uint64_t round[AGGREGATOR_SLOTS];                            /**< Number of the slot length since the start, the slot is valid for. */
+    double count[AGGREGATOR_SLOTS];                              /**< Number of readings. */
+    double sum[AGGREGATOR_VALUES][AGGREGATOR_SLOTS];             /**< Sum of the values. */
+    double sum_of_squares[AGGREGATOR_VALUES][AGGREGATOR_SLOTS];  /**< Sum of the squares of the values. */
+    double min[AGGREGATOR_VALUES][AGGREGATOR_SLOTS];             /**< Minimum of the values. */
+    double max[AGGREGATOR_VALUES][AGGREGATOR_SLOTS];             /**< Maximum of the values. */
+} aggregator_window_t;
+
+/**
+ * @brief Windows of one location.
+ */
+typedef struct {
+    aggregator_window_t windows[AGGREGATOR_MAX_WINDOWS];  /**< Time slots of every window. */
+} aggregator_location_t;
+
+/**
+ * @brief Statistics of one window.
+ */
+typedef struct {
+    unsigned int seconds;                   /**< Length of the window. */
+    unsigned long count;                    /**< Number of readings in the window. */
+    double min[AGGREGATOR_VALUES];          /**< Minimum of every value. */
+    double max[AGGREGATOR_VALUES];          /**< Maximum of every value. */
+    double mean[AGGREGATOR_VALUES];         /**< Mean of every value. */
+    double stddev[AGGREGATOR_VALUES];       /**< Population standard deviation of every value. */
+} aggregate_t;
+
+/**
+ * @brief Defines new data type for the aggregator.
+ */
+typedef struct aggregator aggregator_t;
+
+/**
+ * @brief Windows of all locations.
+ */
+struct aggregator {
+    pthread_mutex_t lock;                           /**< Protects the locations. */
+    unsigned int number_of_windows;                 /**< Number of windows. */
+    unsigned int window_seconds[AGGREGATOR_MAX_WINDOWS];    /**< Length of every window. */
+    uint64_t slot_ns[AGGREGATOR_MAX_WINDOWS];       /**< Length of a slot of every window. */
+    uint64_t start_time;                            /**< Monotonic time in ns of the start. */
+    aggregator_location_t **locations;              /**< Windows indexed by the location id, NULL for a location without readings. */
+    uint32_t locations_capacity;                    /**< Allocated entries in locations. */
+};
+
+
+/**
+ * @brief Converts a comma separated list of window lengths in seconds.
+ *
+ * @param[in] list list of window lengths, empty string selects AGGREGATOR_DEFAULT_WINDOWS
+ * @param[out] window_seconds window lengths
+ *
+ * @return number of windows, -1 for a zero length, too many windows or a malformed list
+ */
+extern int aggregator_windows_from_string(const char *list, unsigned int window_seconds[AGGREGATOR_MAX_WINDOWS]);
+
+/**
+ * @brief Prepares an aggregator without locations.
+ *
+ * @param[out] aggregator aggregator object
+ * @param[in] window_seconds length of every window
+ * @param[in] number_of_windows number of windows, at most AGGREGATOR_MAX_WINDOWS
+ *
+ * @return 0 on success, -1 on failure
+ */
+extern int aggregator_init(aggregator_t *aggregator, const unsigned int *window_seconds, unsigned int number_of_windows);
+
+/**
+ * @brief Adds the readings to the windows of their locations, in one step for all of them.
+ *
+ * @param[in, out] aggregator aggregator object
+ * @param[in] readings array of entries starting with a reading_t
+ * @param[in] number_of_readings number of entries in the array
+ * @param[in] entry_size size of one entry in the array
+ *
+ * @return 0 on success, -1 if a new location could not be added
+ */
+extern int aggregator_add(aggregator_t *aggregator, const void *readings, unsigned int number_of_readings, size_t entry_size);
+
+/**
+ * @brief Reduces the windows of a location to their statistics at the current time.
+ *
+ * @param[in] aggregator aggregator object
+ * @param[in] location_id id of the location in the location dictionary
+ * @param[out] aggregates statistics of every window
+ *
+ * @return 0 on success, -1 if the location has no readings
+ */
+extern int aggregator_get(aggregator_t *aggregator, uint32_t location_id, aggregate_t aggregates[AGGREGATOR_MAX_WINDOWS]);
+
+/**
+ * @brief Frees the locations.
+ */
+extern void aggregator_clean_up(aggregator_t *aggregator);
+
+#endif
@@ -0,0 +1,136 @@
+/**
+* @file async_publisher.h
+*
+* @brief Asynchronous MQTT publisher with a bounded in-flight window and delivery accounting.
+*
+* The libmosquitto network loop runs in a background thread. It sends the queued messages,
+* the keepalives and completes the QoS 1/2 handshakes. The publishing thread only queues the
+* messages. With QoS 1/2 it blocks when the in-flight window is full, so the throughput is
+* limited by the window size and not by the round trip to the broker.
+*
+* A publisher attached to an event loop has no thread of its own, the loop services its
+* connection. It is used only from the loop thread and never blocks: a message that does
+* not fit into the in-flight window is rejected.
+*
+* @date 17-Oct-2026
+* @copyright GNU General Public License v3
+*
+*/
+
+#ifndef ASYNC_PUBLISHER_H
+#define ASYNC_PUBLISHER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "mosquitto.h"
+
+#include "histogram.h"
+#include "event_loop.h"
+
+#define ASYNC_PUBLISHER_DEFAULT_WINDOW 20      /**< Default number of QoS 1/2 messages waiting for the acknowledgement. */
+
+
+/**
+ * @brief Publish time of a message waiting for completion.
+ */
+typedef struct {
+    int mid;                    /**< Libmosquitto message id, negated if completed before its publish time was stored, 0 for a free slot. */
+    uint64_t publish_time;      /**< Monotonic time in ns when the message was queued. */
+} in_flight_message_t;
+
+/**
+ * @brief Defines new data type for the asynchronous publisher.
+ */
+typedef struct async_publisher async_publisher_t;
+
+/**
+ * @brief Libmosquitto client with its network thread, in-flight window and counters.
+ */
+struct async_publisher {
+    struct mosquitto *mosq;             /**< Libmosquitto client instance. */
+    int qos;                            /**< QoS level of the published messages. */
+    unsigned int window;                /**< Maximal number of QoS 1/2 messages waiting for the acknowledgement. */
+    sem_t free_slots;                   /**< Free slots in the in-flight window. */
+    sem_t connected;                    /**< Posted by on_connect after the first successful connection. */
+    bool is_connected;                  /**< Broker accepted the connection and it was not lost since. */
+    pthread_mutex_t in_flight_lock;     /**< Protects the in_flight table. */
+    in_flight_message_t *in_flight;     /**< Hash table of the publish times keyed by message id, with linear probing. Power of two size. */
+    unsigned int in_flight_size;        /**< Number of slots in the in_flight table. */
+    unsigned int in_flight_count;       /**< Number of used slots in the in_flight table. */
+    unsigned long published;            /**< Messages accepted by libmosquitto. */
+    unsigned long completed;            /**< Messages acknowledged by the broker, or written to the socket with QoS 0. */
+    unsigned long failed;               /**< Messages rejected by libmosquitto. */
+    unsigned long window_full;          /**< Messages rejected because the in-flight window was full, only attached to an event loop. */
+    unsigned long connections;          /**< Successful connections to the broker, including reconnects. */
+    histogram_t time_to_ack;            /**< Time from publishing to completion in ns. */
+    event_loop_t *loop;                 /**< Event loop servicing the connection, NULL with a network thread. */
+    event_loop_source_t source;         /**< Source of the connection in the event loop. */
+};
+
+
+/**
+ * @brief Creates the libmosquitto client, connects to the broker and starts the network thread.
+ *
+ * Waits for the broker to accept the connection.
+ *
+ * @param[out] publisher publisher object
+ * @param[in] hostname hostname/IP of the broker
+ * @param[in] port port of the broker
+ * @param[in] qos QoS level of the published messages
+ * @param[in] window maximal number of QoS 1/2 messages waiting for the acknowledgement, 0 for the default
+ *
+ * @return 0 on success, -1 if the client could not be created or the broker did not accept the connection
+ */
+extern int async_publisher_start(async_publisher_t *publisher, const char *hostname, int port, int qos, unsigned int window);
+
+/**
+ * @brief Creates the libmosquitto client, connects to the broker and lets the event loop service
+ * the connection. The broker accepts the connection later, in the loop.
+ *
+ * @param[out] publisher publisher object
+ * @param[in, out] loop event loop
+ * @param[in] hostname hostname/IP of the broker
+ * @param[in] port port of the broker
+ * @param[in] qos QoS level of the published messages
+ * @param[in] window maximal number of QoS 1/2 messages waiting for the acknowledgement, 0 for the default
+ *
+ * @return 0 on success, -1 if the client could not be created or connected
+ */
+extern int async_publisher_attach(async_publisher_t *publisher, event_loop_t *loop, const char *hostname, int port, int qos, unsigned int window);
+
+/**
+ * @brief Returns true if all published messages are completed.
+ */
+extern bool async_publisher_idle(const async_publisher_t *publisher);
+
+/**
+ * @brief Queues the message for sending by the network thread.
+ *
+ * With QoS 1/2 it blocks while the in-flight window is full. Attached to an event loop it
+ * returns MOSQ_ERR_NOMEM instead and counts the message in window_full.
+ *
+ * @param[in, out] publisher publisher object
+ * @param[in] topic MQTT topic
+ * @param[in] payload message payload
+ * @param[in] payload_length length of the payload
+ *
+ * @return MOSQ_ERR_SUCCESS on success, libmosquitto error code otherwise
+ */
+extern int async_publish(async_publisher_t *publisher, const char *topic, const void *payload, int payload_length);
+
+/**
+ * @brief Waits for the completion of the published messages, then disconnects and stops the
+ * network thread.
+ *
+ * Attached to an event loop it removes the connection from the loop and disconnects at once,
+ * the caller waits for the outstanding messages in the loop with async_publisher_idle().
+ *
+ * @param[in, out] publisher publisher object
+ * @param[in] timeout_ms maximal time to wait for the outstanding messages
+ */
+extern void async_publisher_stop(async_publisher_t *publisher, unsigned int timeout_ms);
+
+#endif
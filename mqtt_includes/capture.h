@@ -0,0 +1,120 @@
+/**
+* @file capture.h
+*
+* @brief Capture file of received MQTT messages, for replaying recorded traffic.
+*
+* A capture file starts with a capture_file_header_t, followed by one record per message:
+* a capture_record_header_t, the topic without the terminating null character and the
+* payload. The time of a message is the time since the start of the capture, so the replay
+* reproduces the gaps between the messages. All numbers are little endian, so a capture
+* taken on one machine can be replayed on another.
+*
+* The writer buffers the records in user space, it does not issue a system call per message.
+*
+* @date 17-Oct-2026
+* @copyright GNU General Public License v3
+*
+*/
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define CAPTURE_MAGIC "MQTTCAP1"               /**< First bytes of a capture file. */
+#define CAPTURE_VERSION 1                      /**< Version of the capture format written by this code. */
+#define CAPTURE_BUFFER_SIZE (1 << 20)          /**< Size of the stdio buffer of a capture file. */
+#define CAPTURE_MAX_TOPIC_LENGTH 65535         /**< Longest topic of a MQTT message. */
+#define CAPTURE_MAX_PAYLOAD_LENGTH (1 << 20)   /**< Longer payloads are not captured. */
+
+
+/**
+ * @brief Header at the start of a capture file.
+ */
+typedef struct __attribute__ ((__packed__)){
+  char magic[8];                 /**< CAPTURE_MAGIC. */
+  uint32_t version;              /**< CAPTURE_VERSION of the writer. */
+  uint32_t reserved;             /**< Written as 0. */
+  uint64_t start_time;           /**< Start of the capture, ns since the epoch. */
+} capture_file_header_t;
+
+/**
+ * @brief Header of one captured message.
+ */
+typedef struct __attribute__ ((__packed__)){
+  uint64_t time;                 /**< Receive time in ns since the start of the capture. */
+  uint16_t topic_length;         /**< Length of the topic. */
+  uint16_t reserved;             /**< Written as 0. */
+  uint32_t payload_length;       /**< Length of the payload. */
+} capture_record_header_t;
+
+/**
+ * @brief Defines new data type for the capture file.
+ */
+typedef struct capture capture_t;
+
+/**
+ * @brief Capture file opened for writing or for reading.
+ */
+struct capture {
+    FILE *file;                         /**< Capture file. */
+    char *buffer;                       /**< Stdio buffer of the file. */
+    uint64_t start_time;                /**< Monotonic time in ns of the start of the capture, only for writing. */
+    unsigned long messages;             /**< Messages written or read. */
+    char topic[CAPTURE_MAX_TOPIC_LENGTH + 1];   /**< Topic of the message read last. */
+    uint8_t *payload;                   /**< Payload of the message read last. */
+    uint64_t time;                      /**< Time of the message read last, ns since the start of the capture. */
+    uint32_t payload_length;            /**< Length of the payload of the message read last. */
+};
+
+
+/**
+ * @brief Creates the capture file and writes its header.
+ *
+ * @param[out] capture capture object
+ * @param[in] path name of the capture file, an existing file is overwritten
+ *
+ * @return 0 on success, -1 if the file could not be created
+ */
+extern int capture_create(capture_t *capture, const char *path);
+
+/**
+ * @brief Appends a received message to the capture. Not thread safe, called only from the
+ * thread receiving the messages.
+ *
+ * @param[in, out] capture capture object
+ * @param[in] topic topic of the message
+ * @param[in] payload payload of the message
+ * @param[in] payload_length length of the payload
+ *
+ * @return 0 on success, -1 if the message is too long or could not be written
+ */
+extern int capture_write(capture_t *capture, const char *topic, const void *payload, uint32_t payload_length);
+
+/**
+ * @brief Opens the capture file for reading and checks its header.
+ *
+ * @param[out] capture capture object
+ * @param[in] path name of the capture file
+ *
+ * @return 0 on success, -1 if the file could not be opened or it is not a capture file
+ */
+extern int capture_open(capture_t *capture, const char *path);
+
+/**
+ * @brief Reads the next message into the topic, payload, payload_length and time fields of
+ * the capture object.
+ *
+ * @param[in, out] capture capture object
+ *
+ * @return 1 if a message was read, 0 at the end of the capture, -1 for a truncated or damaged record
+ */
+extern int capture_read(capture_t *capture);
+
+/**
+ * @brief Writes the buffered records and closes the capture file.
+ */
+extern void capture_close(capture_t *capture);
+
+#endif
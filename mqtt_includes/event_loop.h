@@ -0,0 +1,179 @@
+/**
+* @file event_loop.h
+*
+* @brief Single threaded epoll event loop for libmosquitto clients, timers and file descriptors.
+*
+* The loop replaces the network thread of mosquitto_loop_start(). The socket of every client is
+* watched with epoll: readable sockets are read with mosquitto_loop_read(), and sockets with
+* pending output, according to mosquitto_want_write(), are written with mosquitto_loop_write()
+* when they become writable. A timerfd calls mosquitto_loop_misc() for every client once per
+* second for the keepalives and reconnects the lost clients without blocking. Further timerfd timers and any
+* file descriptor can be added for the periodic work of the application, so one thread services
+* all broker connections of a process.
+*
+* The sources are intrusive: the user owns the event_loop_source_t objects and keeps them until
+* they are removed from the loop.
+*
+* Libmosquitto calls the callbacks of the clients from the loop thread. The clients must be
+* used only from the loop thread, except for event_loop_stop(), which can be called from any
+* thread and from a signal handler.
+*
+* @date 17-Oct-2026
+* @copyright GNU General Public License v3
+*
+*/
+
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "mosquitto.h"
+
+#define EVENT_LOOP_MAX_EVENTS 64                    /**< Maximal number of events handled after one epoll_wait(). */
+#define EVENT_LOOP_MISC_PERIOD_NS 1000000000ull     /**< Period of the keepalive and reconnect checks. */
+
+
+/**
+ * @brief Kinds of event sources.
+ */
+typedef enum {
+    EVENT_LOOP_SOURCE_FD = 0,       /**< File descriptor of the user. */
+    EVENT_LOOP_SOURCE_TIMER,        /**< Timerfd created by the loop. */
+    EVENT_LOOP_SOURCE_CLIENT        /**< Socket of a libmosquitto client. */
+} event_loop_source_type_t;
+
+/**
+ * @brief Defines new data type for the event loop.
+ */
+typedef struct event_loop event_loop_t;
+
+/**
+ * @brief Defines new data type for the event source.
+ */
+typedef struct event_loop_source event_loop_source_t;
+
+/**
+ * @brief Function called from the loop thread when the source is ready.
+ *
+ * @param[in, out] loop event loop
+ * @param[in, out] source ready source
+ * @param[in] events epoll events of the source
+ */
+typedef void (*event_loop_handler_f)(event_loop_t *loop, event_loop_source_t *source, uint32_t events);
+
+/**
+ * @brief File descriptor, timer or libmosquitto client watched by the loop.
+ */
+struct event_loop_source {
+    event_loop_source_type_t type;      /**< Kind of the source. */
+    int fd;                             /**< Watched file descriptor, -1 while a client has no socket. */
+    uint32_t events;                    /**< Epoll events the source is registered for. */
+    event_loop_handler_f handler;       /**< Called when the source is ready, NULL for clients. */
+    void *context;                      /**< Context of the handler. */
+    uint64_t expirations;               /**< Timer: expirations since the previous call of the handler. */
+    struct mosquitto *mosq;             /**< Client: libmosquitto client instance. */
+    event_loop_source_t *next;          /**< Client: next client of the loop. */
+};
+
+/**
+ * @brief Epoll instance, internal sources and counters of the loop.
+ */
+struct event_loop {
+    int epoll_fd;                       /**< Epoll instance. */
+    bool stop;                          /**< Set by event_loop_stop(). */
+    event_loop_source_t wake;           /**< Eventfd written by event_loop_stop(). */
+    event_loop_source_t misc;           /**< Timer of the keepalive and reconnect checks. */
+    event_loop_source_t *clients;       /**< Libmosquitto clients of the loop. */
+    unsigned long wakeups;              /**< Number of returns from epoll_wait(). */
+    unsigned long reads;                /**< Number of mosquitto_loop_read() calls. */
+    unsigned long writes;               /**< Number of mosquitto_loop_write() calls. */
+    unsigned long reconnects;           /**< Number of reconnect attempts of the lost clients. */
+};
+
+
+/**
+ * @brief Creates the epoll instance and the internal sources.
+ *
+ * @return 0 on success, -1 if a file descriptor could not be created
+ */
+extern int event_loop_init(event_loop_t *loop);
+
+/**
+ * @brief Watches the file descriptor for the given epoll events.
+ *
+ * @param[in, out] loop event loop
+ * @param[out] source source object
+ * @param[in] fd file descriptor, still owned by the user
+ * @param[in] events epoll events, e.g. EPOLLIN
+ * @param[in] handler function called when the file descriptor is ready
+ * @param[in] context context of the handler
+ *
+ * @return 0 on success, -1 if epoll refused the file descriptor
+ */
+extern int event_loop_add_fd(event_loop_t *loop, event_loop_source_t *source, int fd, uint32_t events, event_loop_handler_f handler, void *context);
+
+/**
+ * @brief Creates a timer on the monotonic clock.
+ *
+ * @param[in, out] loop event loop
+ * @param[out] source source object
+ * @param[in] due monotonic time in ns of the first expiration, 0 creates a disarmed timer
+ * @param[in] period_ns period of the following expirations, 0 for a one-shot timer
+ * @param[in] handler function called after the expirations
+ * @param[in] context context of the handler
+ *
+ * @return 0 on success, -1 if the timer could not be created
+ */
+extern int event_loop_add_timer(event_loop_t *loop, event_loop_source_t *source, uint64_t due, uint64_t period_ns, event_loop_handler_f handler, void *context);
+
+/**
+ * @brief Arms the timer again.
+ *
+ * @param[in, out] source timer source
+ * @param[in] due monotonic time in ns of the next expiration, a time in the past expires at once, 0 disarms the timer
+ * @param[in] period_ns period of the following expirations, 0 for a one-shot timer
+ *
+ * @return 0 on success, -1 on failure
+ */
+extern int event_loop_set_timer(event_loop_source_t *source, uint64_t due, uint64_t period_ns);
+
+/**
+ * @brief Services the libmosquitto client from the loop. The client must be connected with
+ * mosquitto_connect() or mosquitto_connect_async() and must not run its own network thread.
+ * A client whose connection failed is added as well, the reconnect checks retry it.
+ *
+ * @param[in, out] loop event loop
+ * @param[out] source source object
+ * @param[in] mosq libmosquitto client instance
+ *
+ * @return 0
+ */
+extern int event_loop_add_client(event_loop_t *loop, event_loop_source_t *source, struct mosquitto *mosq);
+
+/**
+ * @brief Stops watching the source. Closes the timerfd of a timer. Must not be called from a
+ * handler, the events of the current round can still refer to the source.
+ */
+extern void event_loop_remove(event_loop_t *loop, event_loop_source_t *source);
+
+/**
+ * @brief Waits for the events and calls the handlers until event_loop_stop() is called.
+ *
+ * @return 0 after event_loop_stop(), -1 if epoll_wait() failed
+ */
+extern int event_loop_run(event_loop_t *loop);
+
+/**
+ * @brief Makes event_loop_run() return after the current events. Async-signal-safe.
+ */
+extern void event_loop_stop(event_loop_t *loop);
+
+/**
+ * @brief Closes the epoll instance and the internal sources. The sources of the user must be
+ * removed before.
+ */
+extern void event_loop_clean_up(event_loop_t *loop);
+
+#endif
@@ -0,0 +1,39 @@
+/**
+* @file ha_json.h
+*
+* @brief Serializer of the Home Assistant ambient payload without heap allocation.
+*
+* The payload is written into a buffer of the caller, byte for byte the same as the
+* jsoncpp StreamWriterBuilder with an empty indentation, precision 2 and precision type
+* "decimal": the keys in alphabetical order, the values rounded to two decimals with the
+* trailing zeros removed, keeping one digit after the decimal point.
+*
+* @date 17-Oct-2026
+* @copyright GNU General Public License v3
+*
+*/
+
+#ifndef HA_JSON_H
+#define HA_JSON_H
+
+#include <stddef.h>
+
+#define HA_JSON_NUMBER_LENGTH 320      /**< Longest value with the null character: sign, 309 digits of DBL_MAX, point and two decimals. */
+#define HA_JSON_MAX_LENGTH 1024        /**< Buffer size which fits any payload with the null character. */
+
+
+/**
+ * @brief Writes the ambient payload {"humidity":h,"pressure":p,"temperature":t} with the
+ * terminating null character.
+ *
+ * @param[out] buffer destination of the payload
+ * @param[in] size size of the buffer, HA_JSON_MAX_LENGTH fits any payload
+ * @param[in] temperature temperature reading
+ * @param[in] pressure pressure reading
+ * @param[in] humidity humidity reading
+ *
+ * @return length of the payload without the null character, -1 if the buffer is too small
+ */
+extern int ha_json_ambient(char *buffer, size_t size, double temperature, double pressure, double humidity);
+
+#endif
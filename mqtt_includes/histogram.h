@@ -0,0 +1,101 @@
+/**
+* @file histogram.h
+*
+* @brief Lock-free histogram for latency and queue depth statistics.
+*
+* Values are counted in log-linear buckets: every power of two range is split in
+* HISTOGRAM_SUB_BUCKETS equal parts, so the relative error of a reported value is
+* below 1/HISTOGRAM_SUB_BUCKETS. Recording uses relaxed atomic operations only,
+* so a histogram can be updated by one thread and read by another at any time.
+*
+* @date 17-Oct-2026
+* @copyright GNU General Public License v3
+*
+*/
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+
+/**
+ * @brief Number of sub-buckets per power of two range, as a power of two.
+ */
+#define HISTOGRAM_SUB_BUCKET_BITS	3
+
+/**
+ * @brief Number of sub-buckets per power of two range.
+ */
+#define HISTOGRAM_SUB_BUCKETS	(1 << HISTOGRAM_SUB_BUCKET_BITS)
+
+/**
+ * @brief Total number of buckets. Covers the whole range of 64-bit values.
+ */
+#define HISTOGRAM_BUCKETS	((64 - HISTOGRAM_SUB_BUCKET_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+/**
+ * @brief Defines new data type for histogram.
+ */
+typedef struct histogram histogram_t;
+
+/**
+ * @brief Represents the distribution of the recorded values.
+ */
+struct histogram {
+	uint64_t counts[HISTOGRAM_BUCKETS];   /**< Number of values recorded in each bucket. */
+	uint64_t total;                                 /**< Number of recorded values. */
+	uint64_t sum;                                    /**< Sum of the recorded values. */
+	uint64_t max;                                    /**< Largest recorded value. */
+};
+
+/**
+ * @brief Sets all counters of the histogram to zero.
+ *
+ * @param[out] histogram histogram to be initialized
+ */
+extern void histogram_init(histogram_t *histogram);
+
+/**
+ * @brief Counts the value in its bucket.
+ *
+ * @param[in, out] histogram histogram that receives the value
+ * @param[in] value value to be recorded
+ */
+extern void histogram_record(histogram_t *histogram, uint64_t value);
+
+/**
+ * @brief Copies the histogram that can be updated by another thread at the same time.
+ *
+ * @param[in] histogram source histogram
+ * @param[out] copy consistent enough copy for reporting
+ */
+extern void histogram_snapshot(const histogram_t *histogram, histogram_t *copy);
+
+/**
+ * @brief Adds the counters of one histogram to another one.
+ *
+ * @param[in, out] histogram histogram that receives the counters
+ * @param[in] other histogram to be added
+ */
+extern void histogram_merge(histogram_t *histogram, const histogram_t *other);
+
+/**
+ * @brief Returns the value below which the given percentage of the recorded values fall.
+ *
+ * @param[in] histogram histogram with the recorded values
+ * @param[in] percentile requested percentile, between 0 and 100
+ *
+ * @return upper bound of the bucket with the percentile, 0 for empty histogram
+ */
+extern uint64_t histogram_percentile(const histogram_t *histogram, double percentile);
+
+/**
+ * @brief Returns the mean of the recorded values.
+ *
+ * @param[in] histogram histogram with the recorded values
+ *
+ * @return mean value, 0 for empty histogram
+ */
+extern uint64_t histogram_mean(const histogram_t *histogram);
+
+#endif
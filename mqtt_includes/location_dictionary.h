@@ -0,0 +1,89 @@
+/**
+* @file location_dictionary.h
+*
+* @brief Dictionary of the location names, mapping every name to a dense id.
+*
+* The receiving thread interns the location of every reading once, the pipeline behind it
+* carries only the id and tables per location are plain arrays indexed by the id. The name is
+* looked up by the id only when output is produced.
+*
+* The entries are kept in chunks of a fixed size that are never moved, so the names can be read
+* by any thread without a lock while new names are added. Only one thread at a time may intern
+* names. A thread that got the id through a queue or another synchronisation reads the entry.
+*
+* @date 17-Oct-2026
+* @copyright GNU General Public License v3
+*
+*/
+
+#ifndef LOCATION_DICTIONARY_H
+#define LOCATION_DICTIONARY_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define LOCATION_DICTIONARY_CHUNK_BITS 10                                       /**< Entries in one chunk, as a power of two. */
+#define LOCATION_DICTIONARY_CHUNK_SIZE (1u << LOCATION_DICTIONARY_CHUNK_BITS)   /**< Entries in one chunk. */
+#define LOCATION_DICTIONARY_CHUNKS 1024                                         /**< Maximal number of chunks. */
+#define LOCATION_DICTIONARY_MAX_LOCATIONS (LOCATION_DICTIONARY_CHUNKS * LOCATION_DICTIONARY_CHUNK_SIZE)     /**< Maximal number of locations. */
+
+
+/**
+ * @brief Name of one location.
+ */
+typedef struct {
+    char *name;                     /**< Null terminated name. */
+    uint32_t length;                /**< Length of the name. */
+    uint32_t hash;                  /**< Hash of the name, equal to location_hash(). */
+} location_entry_t;
+
+/**
+ * @brief Defines new data type for the dictionary.
+ */
+typedef struct location_dictionary location_dictionary_t;
+
+/**
+ * @brief Names of all locations with the hash table of the ids.
+ */
+struct location_dictionary {
+    location_entry_t *chunks[LOCATION_DICTIONARY_CHUNKS];   /**< Entries indexed by the id, allocated one chunk at a time. */
+    uint32_t number_of_locations;                           /**< Number of ids handed out. */
+    uint32_t *location_index;                               /**< Hash table of location ids + 1, 0 marks an empty slot. Power of two size. */
+    uint32_t location_index_size;                           /**< Number of slots in location_index. */
+};
+
+
+/**
+ * @brief Prepares an empty dictionary.
+ *
+ * @return 0 on success, -1 if memory could not be allocated
+ */
+extern int location_dictionary_init(location_dictionary_t *dictionary);
+
+/**
+ * @brief Returns the id of the location. A new location gets the next id.
+ *
+ * @param[in, out] dictionary dictionary
+ * @param[in] name location name, not necessarily null terminated
+ * @param[in] length length of the name
+ *
+ * @return id of the location, -1 if the dictionary is full or memory could not be allocated
+ */
+extern int64_t location_dictionary_intern(location_dictionary_t *dictionary, const char *name, size_t length);
+
+/**
+ * @brief Returns the name of the location with the id, NULL for an unknown id.
+ */
+extern const char *location_dictionary_name(const location_dictionary_t *dictionary, uint32_t id);
+
+/**
+ * @brief Returns the number of locations, all ids are below it.
+ */
+extern uint32_t location_dictionary_size(const location_dictionary_t *dictionary);
+
+/**
+ * @brief Frees the names. No thread may use the dictionary any more.
+ */
+extern void location_dictionary_clean_up(location_dictionary_t *dictionary);
+
+#endif
@@ -8,7 +8,12 @@
  * 
  * 
  */
+#ifndef MQTT_USERDEFS_H
+#define MQTT_USERDEFS_H
+
 #include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
 
 /**
  * @brief New enum data type. Represents the posible quality of service levels in MQTT messages
@@ -32,14 +37,64 @@ typedef struct __attribute__ ((__packed__)){
 } ambient_t;
 
 
+/**
+ * @brief Probe appended to the payload by the load generator. The subscriber uses it for measuring
+ * the publish to process latency and the lost messages.
+ */
+typedef struct __attribute__ ((__packed__)){
+  uint64_t publish_time;     /**< CLOCK_MONOTONIC time in ns when the message was published. */
+  uint32_t publisher;        /**< Index of the simulated publisher. */
+  uint32_t sequence;         /**< Sequence number of the message, counted separately for every publisher. */
+} probe_t;
+
+
+/**
+ * @brief Reading as it travels through the subscriber, 32 bytes. The location is an id of the
+ * location dictionary, its name is looked up only for the output.
+ */
+typedef struct {
+  uint32_t location_id;      /**< Id of the location in the location dictionary. */
+  uint32_t reserved;         /**< Padding, 0. */
+  double temperature;        /**< Temperature value. */
+  double pressure;           /**< Pressure value. */
+  double humidity;           /**< Humidity value. */
+} reading_t;
+
+
 /**
  * @brief Container for the command line arguments provided 
  * when starting the MQTT clients.
  */
 typedef struct {
-  char broker_hostname[128];     /**< Hostname/IP of the MQTT broker host. */
+  char broker_hostname[512];     /**< Hostname/IP of the MQTT broker host, mqtt_sub takes a comma separated list of hostname[:port] or [IPv6 address]:port. */
   uint16_t broker_port;          /**< MQTT broker listens on this port for MQTT messages. */
   char location[64];             /**< MQTT location string. */
+  unsigned int number_of_workers;   /**< Number of worker threads for processing the received messages. */
+  unsigned int queue_size;          /**< Number of entries in the queue of each worker. */
+  char overflow_policy[32];         /**< What happens with new messages when a worker queue is full. */
+  unsigned int stats_interval;      /**< Period in seconds for printing the worker statistics, 0 disables them. */
+  bool conflate;                    /**< Keep only the latest waiting reading of every location. */
+  unsigned int number_of_publishers;   /**< Number of simulated publishers, each with its own broker connection. */
+  unsigned int publish_rate;        /**< Total number of messages per second from all publishers, 0 for one message per second without probe. */
+  unsigned int duration;            /**< Load generator stops after this many seconds, 0 runs forever. */
+  bool measure;                     /**< Measure latency and loss from the probes instead of printing the payloads. */
+  char payload_format[16];          /**< Wire format of the published payload: legacy or compact. */
+  unsigned int batch_size;          /**< Publish readings in compact batches of up to this many readings, 0 or 1 disables batching. */
+  unsigned int batch_latency_ms;    /**< Publish a batch at the latest this many ms after its first reading. */
+  unsigned int qos;                 /**< QoS level of the published messages. */
+  unsigned int max_inflight;        /**< Maximal number of published QoS 1/2 messages waiting for the acknowledgement. */
+  char output[256];                 /**< Destination of the printed payloads: stdout, null or a file name. */
+  char store_directory[256];        /**< Directory of the store of the received readings, empty disables the store. */
+  char capture_file[256];           /**< Capture file of the received messages, written by mqtt_sub and read by mqtt_replay. */
+  double replay_speed;              /**< Replay the capture this many times faster than recorded, 0 as fast as possible. */
+  unsigned int aggregate_interval;  /**< Period in seconds for publishing the window statistics of every location, 0 disables them. */
+  char aggregate_windows[64];       /**< Comma separated lengths of the aggregation windows in seconds. */
+  unsigned int sample_period_ms;    /**< Period in ms for reading the sensors, mean publish period of the virtual devices. */
+  char sensor[256];                 /**< Sensor backend and its properties, see sensor.h. */
+  unsigned int number_of_devices;   /**< Number of virtual devices simulated by mqtt_pub, 0 disables the fleet simulation. */
+  char worker_cpus[64];             /**< CPUs of the worker threads, e.g. 2-3, empty keeps the inherited affinity. */
+  char network_cpus[64];            /**< CPUs of the thread running the network event loop, empty keeps the inherited affinity. */
+  char scheduling[16];              /**< Scheduling of the worker and network threads: fifo:<priority>, rr:<priority> or other. */
 } start_arg_t;
 
 
@@ -53,3 +108,35 @@ typedef struct {
  * @return always returns 0
  */
 extern int process_arguments(int argc, char *argv[], start_arg_t *start_arg);
+
+
+/**
+ * @brief Calculates a hash of the location name (FNV-1a).
+ *
+ * @param[in] location null terminated location name
+ *
+ * @return 32-bit hash of the location name
+ */
+extern uint32_t location_hash(const char *location);
+
+/**
+ * @brief Same as location_hash(), for a text that is not null terminated.
+ *
+ * The topic router, the location dictionary and the sharding of mqtt_sub compare these hashes,
+ * so every hash of a location name is calculated here.
+ *
+ * @param[in] text location name or topic level
+ * @param[in] length length of the text
+ *
+ * @return 32-bit hash of the text
+ */
+extern uint32_t location_hash_n(const char *text, size_t length);
+
+
+/**
+ * @brief Returns the CLOCK_MONOTONIC time in ns. The clock is shared by all processes on one
+ * machine, so the probe timestamps of the publisher can be compared with it in the subscriber.
+ */
+extern uint64_t monotonic_time_ns(void);
+
+#endif
@@ -0,0 +1,126 @@
+/**
+* @file output_sink.h
+*
+* @brief Buffered text output written by its own thread.
+*
+* The threads producing the output format the text into the active one of two buffers.
+* When the active buffer is full, or when the flush interval expires, the buffers are
+* swapped and the writer thread writes the filled buffer with one write() call, while
+* the producers continue with the other buffer. A producer waits only when both buffers
+* are full.
+*
+* @date 17-Oct-2026
+* @copyright GNU General Public License v3
+*
+*/
+
+#ifndef OUTPUT_SINK_H
+#define OUTPUT_SINK_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+
+#define OUTPUT_SINK_BUFFER_SIZE 65536          /**< Default size of one buffer in bytes. */
+#define OUTPUT_SINK_FLUSH_INTERVAL_MS 100      /**< Default time after which buffered output is written. */
+
+
+/**
+ * @brief Destinations of the output.
+ */
+typedef enum {
+    OUTPUT_SINK_STDOUT = 0,     /**< Standard output. */
+    OUTPUT_SINK_FILE,           /**< File, the output is appended. */
+    OUTPUT_SINK_NULL            /**< Output is formatted and discarded, for benchmarks. */
+} output_sink_target_t;
+
+/**
+ * @brief Defines new data type for the output sink.
+ */
+typedef struct output_sink output_sink_t;
+
+/**
+ * @brief Double buffered output with its writer thread.
+ */
+struct output_sink {
+    output_sink_target_t target;        /**< Destination of the output. */
+    int fd;                             /**< File descriptor of the destination. */
+    size_t buffer_size;                 /**< Size of one buffer in bytes. */
+    unsigned int flush_interval_ms;     /**< Buffered output is written at the latest after this time. */
+    pthread_mutex_t lock;               /**< Protects the buffers and the time stamp cache. */
+    pthread_cond_t filled;              /**< Signals the writer thread that a buffer is ready for writing. */
+    pthread_cond_t written;             /**< Signals the producers that the writer thread released its buffer. */
+    pthread_t writer;                   /**< Writer thread. */
+    bool stop;                          /**< Writer thread writes the rest of the output and finishes. */
+    char *buffers[2];                   /**< Active buffer and the buffer being written. */
+    unsigned int active;                /**< Index of the buffer the producers write into. */
+    size_t length;                      /**< Length of the output in the active buffer. */
+    size_t pending_length;              /**< Length of the output waiting for the writer thread, 0 if its buffer is free. */
+    time_t time_stamp_time;             /**< Second of the cached time stamp. */
+    char time_stamp[32];                /**< Cached local time formatted for the output. */
+    //The counters are updated with relaxed atomics and can be read from any thread
+    unsigned long bytes;                /**< Bytes written to the destination. */
+    unsigned long writes;               /**< Number of write() calls. */
+    unsigned long stalls;               /**< Number of times a producer waited for the writer thread. */
+    unsigned long errors;               /**< Number of failed write() calls. */
+};
+
+
+/**
+ * @brief Converts the destination given on the command line into a target.
+ *
+ * @param[in] name stdout, null or a file name, empty string selects stdout
+ * @param[out] target destination of the output, OUTPUT_SINK_FILE for any other name
+ *
+ * @return always returns 0
+ */
+extern int output_sink_target_from_string(const char *name, output_sink_target_t *target);
+
+/**
+ * @brief Opens the destination, allocates the buffers and starts the writer thread.
+ *
+ * @param[out] sink output sink object
+ * @param[in] target destination of the output
+ * @param[in] path file name, used only with OUTPUT_SINK_FILE
+ * @param[in] buffer_size size of one buffer in bytes, 0 for OUTPUT_SINK_BUFFER_SIZE
+ * @param[in] flush_interval_ms buffered output is written at the latest after this time, 0 for OUTPUT_SINK_FLUSH_INTERVAL_MS
+ *
+ * @return 0 on success, -1 if the file could not be opened or the resources could not be allocated
+ */
+extern int output_sink_open(output_sink_t *sink, output_sink_target_t target, const char *path, size_t buffer_size, unsigned int flush_interval_ms);
+
+/**
+ * @brief Locks the sink for a sequence of output_sink_printf() calls. The output of one sequence
+ * is not interleaved with the output of other threads.
+ */
+extern void output_sink_begin(output_sink_t *sink);
+
+/**
+ * @brief Returns the current local time formatted as "%d.%h.%Y %H:%M:%S". It is formatted only
+ * once per second. Call only between output_sink_begin() and output_sink_end().
+ */
+extern const char *output_sink_time_stamp(output_sink_t *sink);
+
+/**
+ * @brief Formats the text into the active buffer. Call only between output_sink_begin() and
+ * output_sink_end().
+ *
+ * Swaps the buffers when the text does not fit. A text longer than the buffer is truncated.
+ *
+ * @param[in, out] sink output sink object
+ * @param[in] format printf format
+ */
+extern void output_sink_printf(output_sink_t *sink, const char *format, ...) __attribute__ ((format (printf, 2, 3)));
+
+/**
+ * @brief Unlocks the sink after a sequence of output_sink_printf() calls.
+ */
+extern void output_sink_end(output_sink_t *sink);
+
+/**
+ * @brief Writes the rest of the output, stops the writer thread, closes the file and frees the buffers.
+ */
+extern void output_sink_close(output_sink_t *sink);
+
+#endif
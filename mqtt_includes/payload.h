@@ -0,0 +1,197 @@
+/**
+* @file payload.h
+*
+* @brief Encoding and decoding of the ambient data payload of the MQTT messages.
+*
+* Two wire formats are supported:
+*  - legacy: the packed ambient_t with the location in a 256 bytes field, 280 bytes;
+*  - compact: 4 bytes header followed by temperature, pressure and humidity as little
+*    endian IEEE 754 doubles, 28 bytes. The location is taken from the topic
+*    home/<location>/ambient_data.
+*
+* Both formats can be followed by a probe_t. The first byte of a compact payload is
+* PAYLOAD_TAG and its length is below sizeof(ambient_t), so the subscriber tells the
+* formats apart and old and new publishers can share the broker. Newer versions of the
+* compact format may only append fields to the version 1 layout.
+*
+* A compact batch carries several readings of one location in one message: 8 bytes
+* header with PAYLOAD_BATCH_TAG, the number of readings and the size of one reading,
+* followed by an array of readings. Every reading holds the three doubles and, with
+* PAYLOAD_FLAG_PROBE, its own probe_t at the end.
+*
+* @date 17-Oct-2026
+* @copyright GNU General Public License v3
+*
+*/
+
+#ifndef PAYLOAD_H
+#define PAYLOAD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "mqtt_userdefs.h"
+
+#define PAYLOAD_TAG 0xA7                /**< First byte of a compact payload. Not a valid first byte of a UTF-8 location name. */
+#define PAYLOAD_VERSION 1               /**< Version of the compact payload written by this code. */
+#define PAYLOAD_FLAG_PROBE 0x01         /**< Compact payload is followed by a probe_t. */
+#define PAYLOAD_BATCH_TAG 0xA8          /**< First byte of a compact batch. */
+#define PAYLOAD_BATCH_MAX_READINGS 256  /**< Maximal number of readings in one batch. */
+
+#define PAYLOAD_MAX_SIZE (sizeof(ambient_t) + sizeof(probe_t))     /**< Longest encoded payload. */
+
+
+/**
+ * @brief Wire formats of the ambient data payload.
+ */
+typedef enum {
+    PAYLOAD_FORMAT_LEGACY = 0,      /**< Packed ambient_t. */
+    PAYLOAD_FORMAT_COMPACT,         /**< compact_ambient_t, location in the topic. */
+    PAYLOAD_FORMAT_COMPACT_BATCH    /**< compact_batch_header_t and array of readings, location in the topic. */
+} payload_format_t;
+
+/**
+ * @brief Compact payload, version 1.
+ */
+typedef struct __attribute__ ((__packed__)){
+  uint8_t tag;               /**< PAYLOAD_TAG. */
+  uint8_t version;           /**< PAYLOAD_VERSION of the writer. */
+  uint8_t flags;             /**< PAYLOAD_FLAG_* bits. */
+  uint8_t reserved;          /**< Written as 0. */
+  uint64_t temperature;      /**< Temperature, little endian IEEE 754 double. */
+  uint64_t pressure;         /**< Pressure, little endian IEEE 754 double. */
+  uint64_t humidity;         /**< Humidity, little endian IEEE 754 double. */
+} compact_ambient_t;
+
+/**
+ * @brief Header of a compact batch, version 1.
+ */
+typedef struct __attribute__ ((__packed__)){
+  uint8_t tag;                   /**< PAYLOAD_BATCH_TAG. */
+  uint8_t version;               /**< PAYLOAD_VERSION of the writer. */
+  uint8_t flags;                 /**< PAYLOAD_FLAG_* bits, valid for every reading. */
+  uint8_t reserved;              /**< Written as 0. */
+  uint16_t number_of_readings;   /**< Number of readings in the batch, little endian. */
+  uint16_t reading_size;         /**< Size of one reading in bytes, little endian. */
+} compact_batch_header_t;
+
+#define PAYLOAD_BATCH_READING_SIZE (3 * sizeof(uint64_t))        /**< Reading without probe, version 1. */
+
+/**
+ * @brief Readings collected by a publisher for one compact batch message.
+ */
+typedef struct {
+    unsigned int max_readings;          /**< Batch is full with this many readings. */
+    unsigned int number_of_readings;    /**< Readings in the buffer. */
+    bool probes;                        /**< Every reading carries a probe_t. */
+    uint64_t first_reading_time;        /**< Monotonic time in ns when the first reading was added. */
+    size_t length;                      /**< Length of the encoded batch in the buffer. */
+    uint8_t buffer[sizeof(compact_batch_header_t) + PAYLOAD_BATCH_MAX_READINGS * (PAYLOAD_BATCH_READING_SIZE + sizeof(probe_t))];   /**< Encoded batch. */
+} payload_batch_t;
+
+
+/**
+ * @brief Converts the name of a wire format into its value.
+ *
+ * @param[in] name legacy or compact, empty string selects legacy
+ * @param[out] format wire format
+ *
+ * @return 0 on success, -1 for unknown name
+ */
+extern int payload_format_from_string(const char *name, payload_format_t *format);
+
+/**
+ * @brief Encodes the ambient data in the given wire format.
+ *
+ * @param[in] format wire format
+ * @param[in] ambient ambient data, the location is not encoded in the compact format
+ * @param[in] probe probe appended to the payload, NULL for none
+ * @param[out] buffer encoded payload
+ * @param[in] size size of the buffer
+ *
+ * @return length of the encoded payload, 0 if the buffer is too small
+ */
+extern size_t encode_ambient(payload_format_t format, const ambient_t *ambient, const probe_t *probe, void *buffer, size_t size);
+
+/**
+ * @brief Prepares an empty batch.
+ *
+ * @param[out] batch batch object
+ * @param[in] max_readings batch is full with this many readings, limited to PAYLOAD_BATCH_MAX_READINGS
+ * @param[in] probes every reading carries a probe
+ */
+extern void payload_batch_init(payload_batch_t *batch, unsigned int max_readings, bool probes);
+
+/**
+ * @brief Adds a reading to the batch. The buffer holds a complete batch message after every call.
+ *
+ * @param[in, out] batch batch object, not full
+ * @param[in] ambient reading, the location is not encoded
+ * @param[in] probe probe of the reading, used only if the batch carries probes
+ *
+ * @return true if the batch is full and has to be published
+ */
+extern bool payload_batch_add(payload_batch_t *batch, const ambient_t *ambient, const probe_t *probe);
+
+/**
+ * @brief Empties the batch after it was published.
+ */
+extern void payload_batch_reset(payload_batch_t *batch);
+
+/**
+ * @brief Tells if a batch has to be published now, because waiting for the next reading would
+ * keep its first reading longer than allowed.
+ *
+ * @param[in] batch batch object
+ * @param[in] next_reading_time monotonic time in ns of the next reading
+ * @param[in] max_latency_ns longest time in ns a reading may wait in the batch
+ *
+ * @return true if the batch is not empty and its deadline comes before the next reading
+ */
+extern bool payload_batch_due(const payload_batch_t *batch, uint64_t next_reading_time, uint64_t max_latency_ns);
+
+/**
+ * @brief Returns the number of readings in a received payload.
+ *
+ * @param[in] payload received payload
+ * @param[in] length length of the payload
+ *
+ * @return number of readings of a compact batch, 0 for a malformed batch, 1 for other formats
+ */
+extern unsigned int payload_readings(const void *payload, size_t length);
+
+/**
+ * @brief Decodes the payload of a received MQTT message in any of the wire formats.
+ *
+ * The location is not copied, it is returned as a part of the topic for the compact formats and
+ * of the payload for the legacy format. A payload that is not in the compact format is taken as
+ * legacy, the values missing from a shorter legacy payload are zero.
+ *
+ * @param[in] topic topic of the message, the location of a compact payload is its second level
+ * @param[in] payload received payload
+ * @param[in] length length of the payload
+ * @param[in] index index of the reading in a compact batch, below payload_readings(). Ignored by other formats.
+ * @param[out] reading decoded values, the location id is not written
+ * @param[out] probe decoded probe, zeroed if the payload has none. NULL if not needed.
+ * @param[out] location first character of the location name
+ * @param[out] location_length length of the location name
+ *
+ * @return wire format of the payload
+ */
+extern payload_format_t decode_reading(const char *topic, const void *payload, size_t length, unsigned int index,
+                                       reading_t *reading, probe_t *probe, const char **location, size_t *location_length);
+
+/**
+ * @brief Sets the publish time of every probe in an encoded payload of any wire format.
+ * Payloads without probes are not changed.
+ *
+ * @param[in, out] payload encoded payload
+ * @param[in] length length of the payload
+ * @param[in] publish_time monotonic time in ns written into the probes
+ *
+ * @return number of updated probes
+ */
+extern unsigned int payload_set_publish_time(void *payload, size_t length, uint64_t publish_time);
+
+#endif
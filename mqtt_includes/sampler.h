@@ -0,0 +1,112 @@
+/**
+* @file sampler.h
+*
+* @brief Periodic sampling of the sensors in a thread of its own, decoupled from publishing.
+*
+* The sampling thread reads the sensors at absolute deadlines start + k * period of the
+* monotonic clock, so the time spent on printing, encoding and publishing the readings does
+* not shift the following samples. The timestamped readings go through a SPSC worker queue to
+* the publishing thread. When the publishing thread falls behind, for example because the
+* broker is slow, new readings are dropped instead of delaying the sampling.
+*
+* The jitter, the time between the deadline and the start of the sensor read, is recorded in
+* a histogram. A read that takes longer than a period skips the deadlines that already passed.
+*
+* @date 17-Oct-2026
+* @copyright GNU General Public License v3
+*
+*/
+
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "histogram.h"
+#include "worker.h"
+
+#define SAMPLER_DEFAULT_QUEUE_SIZE 64        /**< Default number of readings waiting for the publishing thread. */
+
+
+/**
+ * @brief One timestamped reading of the sensors.
+ */
+typedef struct {
+    uint64_t deadline;          /**< Monotonic time in ns the reading was due. */
+    uint64_t time;              /**< Monotonic time in ns the sensor read started. */
+    unsigned long sequence;     /**< Number of the deadline since the start. */
+    double temperature;         /**< Temperature value. */
+    double pressure;            /**< Pressure value. */
+    double humidity;            /**< Humidity value. */
+} sampler_reading_t;
+
+/**
+ * @brief Data type sampler_read_f. A function pointer. Points to a function that reads the
+ * sensors into the temperature, pressure and humidity of the reading.
+ *
+ * @return 0 on success, the reading is published, non zero if the sensors could not be read
+ */
+typedef int (*sampler_read_f)(void *context, sampler_reading_t *reading);
+
+/**
+ * @brief Defines new data type for the sampler.
+ */
+typedef struct sampler sampler_t;
+
+/**
+ * @brief Sampling thread, its schedule and counters, and the worker of the publishing thread.
+ */
+struct sampler {
+    pthread_t sampling_thread;          /**< Sensors are read in this thread. */
+    pthread_mutex_t lock;               /**< Protects stop with the stop_requested condition. */
+    pthread_cond_t stop_requested;      /**< Wakes up the sampling thread before its deadline. Uses the monotonic clock. */
+    bool stop;                          /**< Stop the sampling. */
+    uint64_t period_ns;                 /**< Time between two deadlines. */
+    unsigned long max_samples;          /**< Sampling ends after this many deadlines, 0 never. */
+    sampler_read_f read;                /**< Reads the sensors. */
+    void *context;                      /**< Passed to read. */
+    worker_t *publisher;                /**< Publishing thread and the queue of the readings. */
+    unsigned long samples;              /**< Readings passed to the publishing thread. */
+    unsigned long dropped;              /**< Readings dropped because the publishing thread fell behind. */
+    unsigned long failed;               /**< Deadlines when the sensors could not be read. */
+    unsigned long missed;               /**< Deadlines skipped because the previous read ended after them. */
+    histogram_t jitter;                 /**< Time in ns from the deadline to the start of the sensor read. */
+};
+
+
+/**
+ * @brief Starts the publishing thread and the sampling thread. The first reading is due
+ * immediately.
+ *
+ * @param[out] sampler sampler object
+ * @param[in] period_ns time between two readings in ns
+ * @param[in] max_samples number of deadlines before the sampling ends, 0 for no limit
+ * @param[in] read function reading the sensors, called in the sampling thread
+ * @param[in] context passed to the read function
+ * @param[in] publish function called in the publishing thread with every sampler_reading_t
+ * @param[in] queue_size maximal number of readings waiting for the publishing thread, 0 for the default
+ *
+ * @return 0 on success, -1 if a thread could not be started
+ */
+extern int sampler_start(sampler_t *sampler, uint64_t period_ns, unsigned long max_samples,
+                         sampler_read_f read, void *context, do_work_f publish, unsigned int queue_size);
+
+/**
+ * @brief Waits for the sampling thread to end after max_samples deadlines or sampler_stop(),
+ * publishes the waiting readings and ends the publishing thread. The counters and the jitter
+ * histogram stay valid.
+ *
+ * @param[in, out] sampler sampler object
+ */
+extern void sampler_join(sampler_t *sampler);
+
+/**
+ * @brief Ends the sampling without waiting for the next deadline, then the same as sampler_join().
+ *
+ * @param[in, out] sampler sampler object
+ */
+extern void sampler_stop(sampler_t *sampler);
+
+#endif
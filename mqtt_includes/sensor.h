@@ -0,0 +1,113 @@
+/**
+* @file sensor.h
+*
+* @brief Ambient sensors of the Sense HAT publishers, with interchangeable backends.
+*
+* Two backends are available:
+*  - sense_hat: LPS25H and HTS221 sensors of the Pi Sense HAT read over I2C with libsetila.
+*    Built only when libsetila is found, the build then defines WITH_LIBSETILA;
+*  - simulated: deterministic readings without hardware. Every value follows a sine wave
+*    with a phase taken from the seed, plus gaussian noise. Reads can fail with a given
+*    probability and take a given time. The same seed gives the same sequence of readings
+*    and failures, so a run can be repeated exactly.
+*
+* The backend is selected at run time with a specification string:
+*
+*     sense_hat
+*     simulated[:seed=<n>,noise=<fraction>,fail=<probability>,latency_us=<us>,period=<readings>]
+*
+* The noise is the standard deviation as a fraction of the wave amplitude, the period is the
+* number of readings of one wave.
+*
+* @date 17-Oct-2026
+* @copyright GNU General Public License v3
+*
+*/
+
+#ifndef SENSOR_H
+#define SENSOR_H
+
+#include <stdint.h>
+
+#include "sampler.h"
+
+#define SENSOR_SIMULATED_DEFAULT_SEED 1          /**< Default seed of the simulated backend. */
+#define SENSOR_SIMULATED_DEFAULT_NOISE 0.05      /**< Default noise of the simulated backend. */
+#define SENSOR_SIMULATED_DEFAULT_PERIOD 600      /**< Default number of readings of one simulated wave. */
+
+
+/**
+ * @brief Sensor backends.
+ */
+typedef enum {
+    SENSOR_BACKEND_SENSE_HAT = 0,   /**< Pi Sense HAT sensors read with libsetila. */
+    SENSOR_BACKEND_SIMULATED        /**< Deterministic simulated readings. */
+} sensor_backend_t;
+
+/**
+ * @brief Properties of the simulated backend.
+ */
+typedef struct {
+    uint64_t seed;                  /**< Seed of the wave phases, the noise and the failures. */
+    double noise;                   /**< Standard deviation of the noise as a fraction of the wave amplitude. */
+    double failure_rate;            /**< Probability of a failed read. */
+    unsigned int latency_us;        /**< Duration of every read in us. */
+    unsigned int period;            /**< Number of readings of one wave. */
+} sensor_simulation_t;
+
+/**
+ * @brief Defines new data type for the sensors.
+ */
+typedef struct sensor sensor_t;
+
+/**
+ * @brief Opened sensors of one backend.
+ */
+struct sensor {
+    sensor_backend_t backend;           /**< Selected backend. */
+    sensor_simulation_t simulation;     /**< Properties of the simulated backend. */
+    uint64_t random_state;              /**< Simulated backend: state of the random number generator. */
+    double phase[3];                    /**< Simulated backend: phase of the temperature, pressure and humidity waves. */
+    unsigned long reads;                /**< Number of reads, including the failed ones. */
+    void *device;                       /**< Sense HAT backend: libsetila devices. */
+};
+
+
+/**
+ * @brief Opens the sensors selected by the specification.
+ *
+ * @param[out] sensor sensor object
+ * @param[in] specification backend and its properties, empty string selects sense_hat when
+ * built with libsetila and simulated otherwise
+ *
+ * @return 0 on success, -1 for a malformed specification, a backend that was not built or
+ * sensors that could not be initialised
+ */
+extern int sensor_open(sensor_t *sensor, const char *specification);
+
+/**
+ * @brief Reads the temperature, pressure and humidity into the reading. Matches sampler_read_f,
+ * so it can be passed to sampler_start() with the sensor object as the context.
+ *
+ * @param[in, out] context sensor object
+ * @param[out] reading reading to be filled
+ *
+ * @return 0 on success, -1 if the read failed
+ */
+extern int sensor_read(void *context, sampler_reading_t *reading);
+
+/**
+ * @brief Releases the sensors.
+ */
+extern void sensor_close(sensor_t *sensor);
+
+#ifdef WITH_LIBSETILA
+/**
+ * @brief Sense HAT backend, implemented in sensor_sense_hat.cpp. Used by the functions above.
+ */
+extern int sensor_sense_hat_open(sensor_t *sensor);
+extern int sensor_sense_hat_read(sensor_t *sensor, sampler_reading_t *reading);
+extern void sensor_sense_hat_close(sensor_t *sensor);
+#endif
+
+#endif
@@ -0,0 +1,156 @@
+/**
+* @file store.h
+*
+* @brief Append-only store of the received readings in memory mapped segment files.
+*
+* The store is a directory with the segment files segment_<number>.dat and the file locations,
+* which lists the location names with their ids. A segment file has a header followed by
+* fixed size records. The whole segment file is created with its final size and mapped into
+* memory, so appending a reading is a copy into the mapping without a system call. When the
+* segment is full, the next one is created.
+*
+* Every record carries a checksum. When the store is opened, the last segment is scanned and
+* its tail ends at the first record with a bad checksum, so a record written only in part
+* before a crash is dropped and overwritten. Every record also holds the index of the previous
+* record of the same location in its segment, and the store keeps the last record of every
+* location, so the history of a location is reached without scanning the segment.
+*
+* The appended readings carry the ids of the location dictionary. The store resolves the name of
+* a dictionary id once, when its first reading arrives, and keeps the store id of every dictionary
+* id in an array.
+*
+* The records are written in the byte order of the host.
+*
+* @date 17-Oct-2026
+* @copyright GNU General Public License v3
+*
+*/
+
+#ifndef STORE_H
+#define STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "mqtt_userdefs.h"
+#include "location_dictionary.h"
+
+#define STORE_MAGIC "MQTTSEG1"                  /**< First bytes of a segment file. */
+#define STORE_VERSION 1                         /**< Version of the segment format written by this code. */
+#define STORE_SEGMENT_RECORDS (1u << 20)        /**< Default number of records in one segment, 48 MiB. */
+#define STORE_NO_RECORD 0xFFFFFFFFu             /**< Record index meaning no record. */
+
+
+/**
+ * @brief Header at the start of every segment file.
+ */
+typedef struct __attribute__ ((__packed__)){
+  char magic[8];                 /**< STORE_MAGIC. */
+  uint32_t version;              /**< STORE_VERSION of the writer. */
+  uint32_t record_size;          /**< sizeof(store_record_t). */
+  uint32_t capacity;             /**< Number of records in the segment. */
+  uint32_t segment;              /**< Number of the segment. */
+  uint64_t created;              /**< Creation time of the segment, ns since the epoch. */
+  uint8_t reserved[32];          /**< Written as 0. */
+} store_segment_header_t;
+
+/**
+ * @brief One stored reading, 48 bytes.
+ */
+typedef struct __attribute__ ((__packed__)){
+  uint64_t timestamp;            /**< Time of storing the reading, ns since the epoch. Never 0. */
+  uint32_t location_id;          /**< Id of the location in the locations file. */
+  uint32_t previous;             /**< Index of the previous record of the location in the segment, STORE_NO_RECORD for none. */
+  double temperature;            /**< Temperature value. */
+  double pressure;               /**< Pressure value. */
+  double humidity;               /**< Humidity value. */
+  uint32_t reserved;             /**< Written as 0. */
+  uint32_t checksum;             /**< CRC-32 of the preceding fields. */
+} store_record_t;
+
+/**
+ * @brief Location known to the store.
+ */
+typedef struct {
+  char name[sizeof(((ambient_t *) 0)->location)];   /**< Location name. */
+  uint32_t last_record;          /**< Index of the last record of the location in the current segment, STORE_NO_RECORD for none. */
+  unsigned long records;         /**< Records of the location stored since the store was opened, including the recovered ones. */
+} store_location_t;
+
+/**
+ * @brief Defines new data type for the store.
+ */
+typedef struct store store_t;
+
+/**
+ * @brief Open store with its current segment and the location index.
+ */
+struct store {
+    char directory[256];                /**< Directory of the store. */
+    pthread_mutex_t lock;               /**< Serializes the appends of several threads. */
+    int locations_fd;                   /**< Locations file, a new location is appended as "<id> <name>\n". */
+    store_location_t *locations;        /**< Locations indexed by their id. */
+    uint32_t number_of_locations;       /**< Number of known locations. */
+    uint32_t locations_capacity;        /**< Allocated entries in locations. */
+    uint32_t *location_index;           /**< Hash table of location ids + 1, 0 marks an empty slot. Power of two size. */
+    uint32_t location_index_size;       /**< Number of slots in location_index. */
+    const location_dictionary_t *dictionary;    /**< Names of the location ids of the appended readings. */
+    uint32_t *dictionary_map;           /**< Store id + 1 of every dictionary id, 0 for an id not resolved yet. */
+    uint32_t dictionary_map_size;       /**< Number of entries in dictionary_map. */
+    uint32_t segment;                   /**< Number of the current segment. */
+    uint32_t segment_records;           /**< Records in a new segment. */
+    uint32_t capacity;                  /**< Records in the current segment. */
+    store_segment_header_t *header;     /**< Mapping of the current segment, NULL if a new segment could not be created. */
+    store_record_t *records;            /**< Records of the current segment. */
+    uint32_t tail;                      /**< Index of the next record in the current segment. */
+    unsigned long appended;             /**< Records appended since the store was opened. */
+    unsigned long recovered;            /**< Valid records found in the last segment when the store was opened. */
+};
+
+
+/**
+ * @brief Opens the store in the directory, or creates it. Recovers the tail of the last segment.
+ *
+ * @param[out] store store object
+ * @param[in] directory directory of the store, it has to exist
+ * @param[in] segment_records records in a new segment, 0 for STORE_SEGMENT_RECORDS. An existing segment keeps its size.
+ * @param[in] dictionary location dictionary of the appended readings
+ *
+ * @return 0 on success, -1 if the files could not be created, read or mapped
+ */
+extern int store_open(store_t *store, const char *directory, uint32_t segment_records, const location_dictionary_t *dictionary);
+
+/**
+ * @brief Appends the readings, in one step for all of them. Starts a new segment when the
+ * current one is full.
+ *
+ * @param[in, out] store store object
+ * @param[in] readings array of entries starting with a reading_t
+ * @param[in] number_of_readings number of entries in the array
+ * @param[in] entry_size size of one entry in the array
+ *
+ * @return 0 on success, -1 if a new segment or a new location could not be created
+ */
+extern int store_append(store_t *store, const void *readings, unsigned int number_of_readings, size_t entry_size);
+
+/**
+ * @brief Copies the last stored reading of the location.
+ *
+ * Earlier readings of the location in the same segment follow the previous field of the records.
+ *
+ * @param[in] store store object
+ * @param[in] location location name
+ * @param[out] record last record of the location
+ *
+ * @return 0 on success, -1 if the current segment has no reading of the location
+ */
+extern int store_last_record(store_t *store, const char *location, store_record_t *record);
+
+/**
+ * @brief Writes the current segment to the disk and closes the store.
+ */
+extern void store_close(store_t *store);
+
+#endif
@@ -0,0 +1,129 @@
+/**
+* @file timing_wheel.h
+*
+* @brief Hierarchical timing wheel for scheduling a large number of periodic timers from one thread.
+*
+* Time is counted in ticks of a fixed length since the start of the wheel. The first level has
+* TIMING_WHEEL_LEVEL0_SLOTS slots of one tick, every further level has TIMING_WHEEL_LEVEL_SLOTS
+* slots, each as long as a whole turn of the level below. A timer is linked into the slot of the
+* lowest level that covers its expiry, so adding and cancelling a timer takes constant time.
+* When the first level completes a turn, the timers of the next slot of the level above are moved
+* down (cascaded). With a tick of 1 ms the four levels cover about 18 hours, timers expiring later
+* are parked in the last slot of the highest level and cascaded again.
+*
+* The timers are intrusive: the user embeds timing_wheel_timer_t as the first member of its own
+* structure, so the wheel needs no memory of its own for the timers.
+*
+* The wheel is not thread safe, it is used only by the thread that advances it.
+*
+* @date 17-Oct-2026
+* @copyright GNU General Public License v3
+*
+*/
+
+#ifndef TIMING_WHEEL_H
+#define TIMING_WHEEL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "histogram.h"
+
+#define TIMING_WHEEL_LEVEL0_BITS 8                                  /**< Number of first level slots, as a power of two. */
+#define TIMING_WHEEL_LEVEL_BITS 6                                   /**< Number of slots of the higher levels, as a power of two. */
+#define TIMING_WHEEL_LEVEL0_SLOTS (1 << TIMING_WHEEL_LEVEL0_BITS)   /**< Number of first level slots. */
+#define TIMING_WHEEL_LEVEL_SLOTS (1 << TIMING_WHEEL_LEVEL_BITS)     /**< Number of slots of the higher levels. */
+#define TIMING_WHEEL_LEVELS 4                                       /**< Number of levels. */
+
+
+/**
+ * @brief Defines new data type for the timer.
+ */
+typedef struct timing_wheel_timer timing_wheel_timer_t;
+
+/**
+ * @brief Timer linked into a slot of the wheel.
+ */
+struct timing_wheel_timer {
+    timing_wheel_timer_t *next;         /**< Next timer in the same slot. */
+    timing_wheel_timer_t **pprev;       /**< Link pointing to this timer, NULL when the timer is not scheduled. */
+    uint64_t due;                       /**< Monotonic time in ns when the timer expires. */
+    uint64_t expires;                   /**< Tick when the timer expires, the first tick not earlier than the due time. */
+};
+
+/**
+ * @brief Defines new data type for the timing wheel.
+ */
+typedef struct timing_wheel timing_wheel_t;
+
+/**
+ * @brief Function called for every expired timer. It can schedule the timer again.
+ *
+ * @param[in, out] wheel timing wheel of the timer
+ * @param[in, out] timer expired timer, already removed from the wheel
+ * @param[in, out] context context given to timing_wheel_advance()
+ */
+typedef void (*timing_wheel_expire_f)(timing_wheel_t *wheel, timing_wheel_timer_t *timer, void *context);
+
+/**
+ * @brief Slots of all levels, counters and the lateness of the expired timers.
+ */
+struct timing_wheel {
+    uint64_t start;                                                 /**< Monotonic time in ns of tick 0. */
+    uint64_t tick_ns;                                               /**< Length of one tick in ns. */
+    uint64_t current;                                               /**< Next tick to be processed. */
+    timing_wheel_timer_t *level0[TIMING_WHEEL_LEVEL0_SLOTS];        /**< First level, one tick per slot. */
+    timing_wheel_timer_t *levels[TIMING_WHEEL_LEVELS - 1][TIMING_WHEEL_LEVEL_SLOTS];   /**< Higher levels. */
+    unsigned long pending;                                          /**< Number of scheduled timers. */
+    unsigned long expired;                                          /**< Number of expired timers. */
+    unsigned long cascaded;                                         /**< Number of timers moved to a lower level. */
+    unsigned long ticks;                                            /**< Number of processed ticks. */
+    histogram_t lateness;                                           /**< Time in ns from the due time to the call of the expire function. */
+};
+
+
+/**
+ * @brief Initializes an empty wheel.
+ *
+ * @param[out] wheel timing wheel
+ * @param[in] start monotonic time in ns of tick 0
+ * @param[in] tick_ns length of one tick in ns
+ */
+extern void timing_wheel_init(timing_wheel_t *wheel, uint64_t start, uint64_t tick_ns);
+
+/**
+ * @brief Schedules the timer. The timer must not be scheduled already.
+ *
+ * A due time in the past expires with the next processed tick.
+ *
+ * @param[in, out] wheel timing wheel
+ * @param[in, out] timer timer to be scheduled
+ * @param[in] due monotonic time in ns when the timer expires
+ */
+extern void timing_wheel_add(timing_wheel_t *wheel, timing_wheel_timer_t *timer, uint64_t due);
+
+/**
+ * @brief Removes the timer from the wheel. Does nothing if the timer is not scheduled.
+ */
+extern void timing_wheel_cancel(timing_wheel_t *wheel, timing_wheel_timer_t *timer);
+
+/**
+ * @brief Processes all ticks up to the given time and calls the expire function for every
+ * expired timer, in the order of the ticks.
+ *
+ * @param[in, out] wheel timing wheel
+ * @param[in] now monotonic time in ns
+ * @param[in] expire function called for every expired timer
+ * @param[in, out] context passed to the expire function
+ *
+ * @return number of expired timers
+ */
+extern unsigned long timing_wheel_advance(timing_wheel_t *wheel, uint64_t now, timing_wheel_expire_f expire, void *context);
+
+/**
+ * @brief Returns the monotonic time in ns when the wheel has to be advanced again: the start
+ * of the next tick with expiring timers, or of the next cascade, whichever comes first.
+ */
+extern uint64_t timing_wheel_next_time(const timing_wheel_t *wheel);
+
+#endif
@@ -0,0 +1,150 @@
+/**
+* @file topic_router.h
+*
+* @brief Routing of received MQTT messages to handlers registered for topic filters.
+*
+* The filters are compiled into a trie with one node per filter level. The literal children of
+* all nodes are kept in one hash table keyed by the parent node and the level text, and every
+* node has at most one '+' child and a list of the routes ending with '#'. A topic is matched by
+* walking its levels, so the dispatch cost depends on the depth of the topic and the number of
+* matching routes, not on the number of routes.
+*
+* The levels matched by the wildcards are reported as offsets into the topic, so a handler reads
+* e.g. the location of home/+/ambient_data without copying or allocating. Matching follows the
+* MQTT rules: '+' matches one level, also an empty one, '#' as the last level matches its parent
+* level and all levels below, and topics starting with '$' are not matched by a wildcard in the
+* first level.
+*
+* Routes are added before the dispatching starts. The dispatch reads the router only, so several
+* threads can dispatch at the same time.
+*
+* @date 17-Oct-2026
+* @copyright GNU General Public License v3
+*
+*/
+
+#ifndef TOPIC_ROUTER_H
+#define TOPIC_ROUTER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define TOPIC_ROUTER_MAX_LEVELS 32      /**< Deeper topics and filters are not routed. */
+#define TOPIC_ROUTER_MAX_CAPTURES 8     /**< Maximal number of wildcards in one filter. */
+#define TOPIC_ROUTER_NONE UINT32_MAX    /**< Missing node or route. */
+
+
+/**
+ * @brief Part of the topic matched by a wildcard.
+ */
+typedef struct {
+    uint16_t offset;                /**< Offset of the first character in the topic. */
+    uint16_t length;                /**< Number of characters. */
+} topic_segment_t;
+
+/**
+ * @brief Topic of a dispatched message with the levels matched by the wildcards of the route.
+ */
+typedef struct {
+    const char *topic;                                      /**< Topic of the message. */
+    unsigned int number_of_captures;                        /**< Number of wildcards of the route. */
+    topic_segment_t captures[TOPIC_ROUTER_MAX_CAPTURES];    /**< Matched levels in the order of the wildcards, '#' takes the rest of the topic. */
+} topic_match_t;
+
+/**
+ * @brief Function called for every route matching the topic of a message.
+ *
+ * @param[in, out] context context given when the route was added, e.g. its worker pool
+ * @param[in, out] message_context context given to topic_router_dispatch(), e.g. the connection
+ * @param[in] match topic and the levels matched by the wildcards
+ * @param[in] payload message payload
+ * @param[in] payload_length length of the payload
+ */
+typedef void (*topic_handler_f)(void *context, void *message_context, const topic_match_t *match, const void *payload, size_t payload_length);
+
+/**
+ * @brief Handler registered for a topic filter.
+ */
+typedef struct {
+    char *filter;                   /**< Topic filter, for subscribing. */
+    topic_handler_f handler;        /**< Function called for the matching messages. */
+    void *context;                  /**< Context of the handler. */
+    uint32_t next;                  /**< Next route ending in the same node. */
+} topic_route_t;
+
+/**
+ * @brief Level of a filter in the trie.
+ */
+typedef struct {
+    uint32_t parent;                /**< Parent node, TOPIC_ROUTER_NONE for the root. */
+    uint32_t hash;                  /**< Hash of the level text. */
+    const char *level;              /**< Level text, in the filter of the route that added the node. */
+    uint16_t length;                /**< Length of the level text. */
+    uint32_t plus;                  /**< Child for '+'. */
+    uint32_t routes;                /**< First route ending in this node. */
+    uint32_t multi_level_routes;    /**< First route ending with '#' below this node. */
+} topic_node_t;
+
+/**
+ * @brief Defines new data type for the router.
+ */
+typedef struct topic_router topic_router_t;
+
+/**
+ * @brief Routes and their compiled trie.
+ */
+struct topic_router {
+    topic_route_t *routes;              /**< Registered routes. */
+    uint32_t number_of_routes;
+    uint32_t routes_capacity;
+    topic_node_t *nodes;                /**< Nodes of the trie, node 0 is the root. */
+    uint32_t number_of_nodes;
+    uint32_t nodes_capacity;
+    uint32_t *children;                 /**< Hash table of the literal child node indexes + 1, 0 marks an empty slot. Power of two size. */
+    uint32_t children_size;             /**< Number of slots in children. */
+};
+
+
+/**
+ * @brief Initializes an empty router.
+ *
+ * @return 0 on success, -1 if memory could not be allocated
+ */
+extern int topic_router_init(topic_router_t *router);
+
+/**
+ * @brief Registers the handler for the topic filter.
+ *
+ * @param[in, out] router router
+ * @param[in] filter MQTT topic filter, may contain '+' and '#'
+ * @param[in] handler function called for the matching messages
+ * @param[in] context context of the handler
+ *
+ * @return 0 on success, -1 for an invalid filter or if memory could not be allocated
+ */
+extern int topic_router_add(topic_router_t *router, const char *filter, topic_handler_f handler, void *context);
+
+/**
+ * @brief Calls the handler of every route matching the topic.
+ *
+ * @param[in] router router
+ * @param[in] topic topic of the message
+ * @param[in] payload message payload
+ * @param[in] payload_length length of the payload
+ * @param[in, out] message_context passed to the handlers
+ *
+ * @return number of matching routes
+ */
+extern unsigned int topic_router_dispatch(const topic_router_t *router, const char *topic, const void *payload, size_t payload_length, void *message_context);
+
+/**
+ * @brief Returns the hash of a matched level, equal to location_hash() of the level text.
+ */
+extern uint32_t topic_segment_hash(const topic_match_t *match, unsigned int capture);
+
+/**
+ * @brief Frees the routes and the trie.
+ */
+extern void topic_router_clean_up(topic_router_t *router);
+
+#endif
@@ -10,11 +10,37 @@
 */
 
 #include <stdbool.h>
+#include <pthread.h>
+
+#include "histogram.h"
+
+/**
+ * @brief Size of the CPU cache line in bytes. The queue indices written by the
+ * producer and by the worker thread are placed on separate cache lines.
+ */
+#define WORKING_QUEUE_CACHE_LINE_SIZE	64
+
+#define WORKING_QUEUE_MAX_SIZE (1u << 30) /**< Largest queue size, the index of a conflating queue has twice as many slots. */
+#define WORKER_MAX_CPUS 1024            /**< CPUs that can be given in the affinity of a thread. */
+#define WORKER_THREAD_NAME_SIZE 16      /**< Longest thread name accepted by Linux, with the terminating null character. */
 
 /**
- * @brief Maximal legth of the work queue in number of entries.
+ * @brief Synchronisation mode of the working queue.
  */
-#define MAXIMUM_WORKING_QUEUE_LENGTH	128
+typedef enum {
+	WORKING_QUEUE_MODE_LOCKED = 0,    /**< Queue protected by a mutex. Any number of threads can add entries. */
+	WORKING_QUEUE_MODE_SPSC           /**< Lock-free ring. Exactly one thread adds entries, the worker thread removes them. */
+} working_queue_mode_t;
+
+/**
+ * @brief What happens with a new entry when the working queue is full.
+ */
+typedef enum {
+	WORKING_QUEUE_OVERFLOW_BLOCK = 0,         /**< Producer waits for a free slot. */
+	WORKING_QUEUE_OVERFLOW_DROP_NEWEST,     /**< New entry is discarded. */
+	WORKING_QUEUE_OVERFLOW_DROP_OLDEST,      /**< Oldest waiting entry is discarded to make room. Not supported in WORKING_QUEUE_MODE_SPSC. */
+	WORKING_QUEUE_OVERFLOW_BLOCK_TIMEOUT    /**< Producer waits for a free slot at most overflow_timeout_ms, then the new entry is discarded. */
+} working_queue_overflow_t;
 
 /**
  * @brief Defines a new data type for working queue.
@@ -31,23 +57,114 @@ typedef struct worker worker_t;
  */
 typedef int (*do_work_f)(void *work_entry);
 
+/**
+ * @brief Data type do_work_batch_f. A function pointer. Points to a function that will be called with
+ * a contiguous array of entries taken from the queue in one step.
+ */
+typedef int (*do_work_batch_f)(void *work_entries, unsigned int number_of_entries);
+
+/**
+ * @brief Defines new data type for the worker attributes.
+ */
+typedef struct worker_attr worker_attr_t;
+
+/**
+ * @brief Defines new data type for the worker statistics.
+ */
+typedef struct worker_stats worker_stats_t;
+
+/**
+ * @brief CPU affinity, scheduling policy and name of a thread.
+ *
+ * A zeroed object leaves all of them as inherited from the creating thread.
+ */
+typedef struct {
+	uint64_t cpus[WORKER_MAX_CPUS / 64];     /**< Bit mask of the CPUs the thread may run on. All zero keeps the affinity of the creating thread. */
+	int sched_policy;                           /**< SCHED_FIFO or SCHED_RR. SCHED_OTHER (0) inherits the policy and priority of the creating thread. */
+	int sched_priority;                        /**< Priority with SCHED_FIFO and SCHED_RR. */
+	char name[WORKER_THREAD_NAME_SIZE];       /**< Name shown by top -H and ps -L. Empty keeps the name of the creating thread. */
+} worker_thread_attr_t;
+
+/**
+ * @brief Defines new data type for a pool of workers.
+ */
+typedef struct worker_pool worker_pool_t;
+
+/**
+ * @brief Data type work_entry_hash_f. A function pointer. Points to a function that returns the
+ * sharding key of a queue entry. Entries with the same key are processed by the same worker, in order.
+ */
+typedef unsigned int (*work_entry_hash_f)(const void *work_entry);
+
+/**
+ * @brief Data type work_entry_equal_f. A function pointer. Points to a function that tells if two
+ * queue entries have the same conflation key.
+ */
+typedef bool (*work_entry_equal_f)(const void *work_entry, const void *other_work_entry);
+
+/**
+ * @brief Slot of the index of entries waiting in a conflating queue.
+ */
+typedef struct {
+	unsigned int hash;          /**< Conflation key hash of the entry. */
+	unsigned int position;    /**< Free running index of the entry in the queue. */
+	bool used;                     /**< Slot refers to a waiting entry. */
+} pending_index_slot_t;
+
 /**
  * @brief Represents a FIFO queue for storring payloads from received MQTT messages. 
  * 
  * Main thread will write data from one side of the queue as they arrive via MQTT, while the
  * worker thead will process them on the other end of the queue.
+ *
+ * In WORKING_QUEUE_MODE_SPSC mode the head is written only by the worker thread and the tail
+ * only by the producer, so they are kept on separate cache lines together with the copy of
+ * the other side's index. The mutex and the conditional variables are used only when one
+ * side has to sleep because the ring is empty or full.
+ *
+ * The capacity is a power of two. Head and tail are free running counters, the slot of an
+ * entry is the counter masked with max_queue_size - 1.
+ *
+ * A conflating queue keeps at most one waiting entry per key. A new entry with the key of a
+ * waiting one overwrites it in place. Entries taken by the worker thread are no longer waiting,
+ * so a newer entry with the same key is appended after them.
  */
 struct working_queue {
-	unsigned int max_queue_size;   /**< Muximal lenght of the queue in number of entries. */
+	working_queue_mode_t mode;     /**< Synchronisation mode of the queue. */
+	working_queue_overflow_t overflow_policy;   /**< What happens with a new entry when the queue is full. */
+	unsigned int overflow_timeout_ms;   /**< Longest wait for a free slot with WORKING_QUEUE_OVERFLOW_BLOCK_TIMEOUT. */
+	unsigned int max_queue_size;   /**< Muximal lenght of the queue in number of entries. Power of two. */
 	pthread_mutex_t access;            /**< Pthread mutex for controlling the queue access. */
 	pthread_cond_t empty;               /**< Conditional variable queue is empty. Informs the waiting thread that the queue is empty. */
 	pthread_cond_t not_full;            /**< Conditional variable queue is not full. Informs the waiting thread that new entries can be written in the queue. */
 	pthread_cond_t not_empty;      /**< Conditional variable queue is not empty. Informs the waiting thread that there are some entries in the queue..*/
-	int head;                                            /**< Head of the FIFO queue. Worker thread process the head entry first. */
-	int tail;                                                /**< Tail of the FIFO queue. New entry is appended at the tail of the queue. */
-	int number_of_entries;                /**< Current number of entries in the queue. */
+	unsigned int number_of_entries;                /**< Current number of entries in the queue. Not used in SPSC mode. */
 	void *entry;                                      /**< Pointer to memory reserved for the queue. */
-	int entry_size;                                 /**< Size of one queue entry in bites .*/
+	size_t entry_size;                           /**< Size of one queue entry in bites .*/
+	uint64_t *enqueue_time;                   /**< Monotonic time in ns when the entry in the same slot was committed. NULL if statistics are not collected. */
+	work_entry_hash_f conflation_hash;     /**< Conflation key hash of an entry. NULL for plain FIFO queue. */
+	work_entry_equal_f conflation_equal;  /**< Compares the conflation keys of two entries. */
+	unsigned int *entry_hash;                   /**< Conflation key hash of the entry in the same slot. */
+	pending_index_slot_t *pending_index;   /**< Open addressing hash table of the waiting entries. */
+	unsigned int pending_index_size;        /**< Number of slots in pending_index. Power of two. */
+	void *staging;                                     /**< Entry reserved while the conflating queue is full. Conflated or queued at commit. */
+	bool staging_in_use;                          /**< Staging entry is reserved by a producer. */
+	void *reserved_entry;                        /**< Entry returned by the last reserve_work_entry() in WORKING_QUEUE_MODE_LOCKED. */
+	unsigned long conflated;                     /**< Number of new entries that replaced a waiting entry with the same key. */
+	int producer_waiting __attribute__((aligned(WORKING_QUEUE_CACHE_LINE_SIZE)));   /**< SPSC: producer sleeps on not_full. */
+	int consumer_waiting;                     /**< SPSC: worker thread sleeps on not_empty. */
+	unsigned int head __attribute__((aligned(WORKING_QUEUE_CACHE_LINE_SIZE)));   /**< Head of the FIFO queue. Worker thread process the head entry first. */
+	unsigned int cached_tail;                                 /**< SPSC: last tail value seen by the worker thread. */
+	unsigned int high_water_mark;                      /**< Largest number of entries seen in the queue by the worker thread. */
+	unsigned long dequeued;                               /**< Number of entries processed and removed from the queue. */
+	unsigned int tail __attribute__((aligned(WORKING_QUEUE_CACHE_LINE_SIZE)));   /**< Tail of the FIFO queue. New entry is appended at the tail of the queue. */
+	unsigned int cached_head;                              /**< SPSC: last head value seen by the producer. */
+	unsigned long dropped_newest;                  /**< Number of new entries discarded because the queue was full. */
+	unsigned long dropped_oldest;                   /**< Number of waiting entries discarded to make room for new ones. */
+	unsigned long timeouts;                             /**< Number of new entries discarded after waiting overflow_timeout_ms for a free slot. */
+	unsigned long enqueued;                             /**< Number of entries added to the queue. */
+	unsigned long blocked;                               /**< Number of times a producer waited for a free slot. */
+	uint64_t blocked_ns;                                 /**< Total time producers waited for a free slot in ns. */
 };
 
 /**
@@ -58,6 +175,61 @@ struct worker {
 	pthread_t working_thread;                  /**< Worker will run in this thread */
 	bool stop_working;                                 /**< Stop the processing of the working queue items */
 	do_work_f do_work;                               /**< Function that will be called for each queue entry. MQTT payload processor. */
+	do_work_batch_f do_work_batch;          /**< Function that will be called for each batch of entries. Replaces do_work if set. */
+	unsigned int max_batch_size;              /**< Maximum number of entries taken from the queue in one step. */
+	void *batch;                                          /**< Copy of the entries taken from the queue. Used only with WORKING_QUEUE_OVERFLOW_DROP_OLDEST. */
+	bool collect_stats;                                 /**< Record the histograms below. */
+	histogram_t queue_depth;                       /**< Number of entries in the queue each time the worker takes entries from it. */
+	histogram_t queue_latency;                    /**< Time in ns between commit of an entry and the start of its processing. */
+	histogram_t processing_time;                 /**< Duration of do_work or do_work_batch calls in ns. */
+};
+
+/**
+ * @brief Worker properties used by create_worker_with_attr().
+ */
+struct worker_attr {
+	unsigned int working_queue_size;          /**< Maximum number of entries in the queue. Rounded up to a power of two, at most WORKING_QUEUE_MAX_SIZE. */
+	unsigned int working_queue_entry_size;    /**< Size of the queue entries in bytes. */
+	do_work_f do_work;                                 /**< Function called for each queue entry. */
+	working_queue_mode_t queue_mode;         /**< Synchronisation mode of the queue. Default WORKING_QUEUE_MODE_LOCKED. */
+	do_work_batch_f do_work_batch;            /**< Function called for each batch of entries. Optional, replaces do_work if set. */
+	unsigned int max_batch_size;                /**< Maximum number of entries in a batch. Default 0, all entries in the queue. */
+	working_queue_overflow_t overflow_policy;   /**< What happens with a new entry when the queue is full. Default WORKING_QUEUE_OVERFLOW_BLOCK. */
+	unsigned int overflow_timeout_ms;          /**< Longest wait for a free slot with WORKING_QUEUE_OVERFLOW_BLOCK_TIMEOUT. */
+	bool collect_stats;                                  /**< Record queue depth, latency and processing time histograms. Default false. */
+	work_entry_hash_f conflation_hash;        /**< Makes a conflating queue keyed by this hash. Requires WORKING_QUEUE_MODE_LOCKED. Default NULL, plain FIFO. */
+	work_entry_equal_f conflation_equal;     /**< Compares the keys of entries with the same hash. Required with conflation_hash. */
+	worker_thread_attr_t thread;               /**< Affinity, scheduling and name of the worker thread. Default all inherited. The workers of a pool get their index appended to the name. */
+};
+
+/**
+ * @brief Snapshot of the worker counters and histograms.
+ *
+ * The counters are always kept. The histograms are filled only when the worker is created
+ * with collect_stats set, because they need a clock read per entry.
+ */
+struct worker_stats {
+	unsigned long enqueued;                 /**< Number of entries added to the queue. */
+	unsigned long dequeued;                 /**< Number of processed entries. */
+	unsigned long dropped_newest;      /**< Number of new entries discarded because the queue was full. */
+	unsigned long dropped_oldest;       /**< Number of waiting entries discarded to make room for new ones. */
+	unsigned long timeouts;                 /**< Number of new entries discarded after a timed wait for a free slot. */
+	unsigned long conflated;               /**< Number of new entries that replaced a waiting entry with the same key. */
+	unsigned int high_water_mark;      /**< Largest number of entries seen in the queue. */
+	unsigned long blocked;                   /**< Number of times a producer waited for a free slot. */
+	uint64_t blocked_ns;                     /**< Total time producers waited for a free slot in ns. */
+	histogram_t queue_depth;           /**< Number of entries in the queue each time the worker takes entries from it. */
+	histogram_t queue_latency;        /**< Time in ns between commit of an entry and the start of its processing. */
+	histogram_t processing_time;     /**< Duration of do_work or do_work_batch calls in ns. */
+};
+
+/**
+ * @brief Represents a set of workers, each with its own queue and thread.
+ */
+struct worker_pool {
+	unsigned int number_of_workers;   /**< Number of workers in the pool. */
+	worker_t **workers;                        /**< Workers of the pool. */
+	work_entry_hash_f hash;                /**< Selects the worker for a queue entry. */
 };
 
 /**
@@ -65,7 +237,7 @@ struct worker {
  * Processing will be done by calling a function specified in the do_work_t argument for each entry.
  * 
  * @param[in, out] worker worker object containing all worker items and properties
- * @param[in] working_queue_size maximum number of entries in the queue
+ * @param[in] working_queue_size maximum number of entries in the queue, rounded up to a power of two, at most WORKING_QUEUE_MAX_SIZE
  * @param[in] working_queue_entry_size size of the queue entries
  * @param[in] do_work function pointer. This function will be called for each queue elements
  *
@@ -73,13 +245,120 @@ struct worker {
  */
 extern int create_worker(worker_t **worker, unsigned int working_queue_size, unsigned int working_queue_entry_size, do_work_f do_work);
 
+/**
+ * @brief Initializes the worker attributes with the default values.
+ *
+ * @param[out] attr attributes to be initialized
+ */
+extern void worker_attr_init(worker_attr_t *attr);
+
+/**
+ * @brief Sets the CPUs of the thread attributes from a list such as 0-3,6.
+ *
+ * @param[in] list comma separated CPU numbers and ranges, empty string keeps the inherited affinity
+ * @param[out] thread thread attributes
+ *
+ * @return 0 on success, -1 for a malformed list or a CPU above WORKER_MAX_CPUS - 1
+ */
+extern int worker_cpus_from_string(const char *list, worker_thread_attr_t *thread);
+
+/**
+ * @brief Sets the scheduling policy of the thread attributes from fifo:<priority>, rr:<priority> or other.
+ *
+ * @param[in] scheduling policy and priority, empty string or other inherits the scheduling
+ * @param[out] thread thread attributes
+ *
+ * @return 0 on success, -1 for an unknown policy or a priority out of the range of the policy
+ */
+extern int worker_scheduling_from_string(const char *scheduling, worker_thread_attr_t *thread);
+
+/**
+ * @brief Applies the affinity, the scheduling policy and the name to a running thread, e.g. to the
+ * thread of an event loop.
+ *
+ * @param[in] thread_id thread, e.g. pthread_self()
+ * @param[in] thread thread attributes, the inherited properties are not changed
+ *
+ * @return 0 on success, -1 if a property could not be set, the others are still applied
+ */
+extern int worker_thread_attr_apply(pthread_t thread_id, const worker_thread_attr_t *thread);
+
+/**
+ * @brief Same as create_worker(), but the worker properties are taken from the attributes object.
+ *
+ * With queue_mode set to WORKING_QUEUE_MODE_SPSC, add_work_entry() must be called from one thread only.
+ * WORKING_QUEUE_OVERFLOW_DROP_OLDEST and conflation can not be combined with WORKING_QUEUE_MODE_SPSC.
+ * A real-time scheduling policy needs CAP_SYS_NICE or a sufficient RLIMIT_RTPRIO, otherwise the
+ * thread can not be created.
+ *
+ * @param[in, out] worker worker object containing all worker items and properties
+ * @param[in] attr worker attributes
+ *
+ * @return 0 in case woker is created successfully, -1 in case of error
+ */
+extern int create_worker_with_attr(worker_t **worker, const worker_attr_t *attr);
+
 /**
  * @brief Writes entry in the working queue
  *
  * @param[in] working_queue pointer to the working queue
  * @param[in] working_entry pointer to the new entry
+ *
+ * @return 0 if the entry is in the queue, -1 if it was discarded by the overflow policy
+ */
+extern int add_work_entry(working_queue_t *working_queue, void *working_entry);
+
+/**
+ * @brief Reserves the slot at the tail of the working queue, so the new entry can be written
+ * directly into the queue. When the queue is full, the overflow policy of the queue applies.
+ *
+ * Every reserved slot has to be followed by commit_work_entry(). In WORKING_QUEUE_MODE_LOCKED
+ * the queue lock is held between the two calls. A full conflating queue returns a staging
+ * entry, and the overflow policy applies at commit if the entry does not replace a waiting one.
+ *
+ * @param[in] working_queue pointer to the working queue
+ *
+ * @return pointer to the reserved slot, NULL if the new entry was discarded by the overflow policy
+ */
+extern void *reserve_work_entry(working_queue_t *working_queue);
+
+/**
+ * @brief Appends the entry written in the slot returned by reserve_work_entry() to the working queue.
+ *
+ * @param[in] working_queue pointer to the working queue
+ */
+extern void commit_work_entry(working_queue_t *working_queue);
+
+/**
+ * @brief Returns the entries at the head of the working queue without removing them. Only the
+ * thread that consumes the queue may call it. Does not block.
+ *
+ * The entries are contiguous in memory and stay valid until release_work_entries().
+ * Not usable with WORKING_QUEUE_OVERFLOW_DROP_OLDEST, where producers can remove waiting entries.
+ *
+ * @param[in] working_queue pointer to the working queue
+ * @param[in] max_entries maximum number of entries to return
+ * @param[out] number_of_entries number of returned entries, 0 if the queue is empty
+ *
+ * @return pointer to the first entry, NULL if the queue is empty
+ */
+extern void *peek_work_entries(working_queue_t *working_queue, unsigned int max_entries, unsigned int *number_of_entries);
+
+/**
+ * @brief Removes the given number of entries returned by peek_work_entries() from the head of the working queue.
+ *
+ * @param[in] working_queue pointer to the working queue
+ * @param[in] number_of_entries number of processed entries
  */
-extern void add_work_entry(working_queue_t *working_queue, void *working_entry);
+extern void release_work_entries(working_queue_t *working_queue, unsigned int number_of_entries);
+
+/**
+ * @brief Takes a snapshot of the worker statistics. Can be called while the worker is running.
+ *
+ * @param[in] worker worker object
+ * @param[out] stats snapshot of the counters and histograms
+ */
+extern void get_worker_stats(worker_t *worker, worker_stats_t *stats);
 
 /**
  * @brief Ends worker thread execution.
@@ -89,6 +368,58 @@ extern void add_work_entry(working_queue_t *working_queue, void *working_entry);
  */
 extern int stop_worker(worker_t *worker);
 
+/**
+ * @brief Creates a pool of workers. Every worker gets its own queue and thread with the given attributes.
+ *
+ * @param[in, out] pool pool object containing all workers
+ * @param[in] number_of_workers number of worker threads in the pool
+ * @param[in] attr attributes used for each of the workers
+ * @param[in] hash function pointer. Its result modulo number_of_workers selects the worker for an entry.
+ * Can be NULL if the entries are not added with add_pool_work_entry().
+ *
+ * @return 0 in case the pool is created successfully, -1 in case of error
+ */
+extern int create_worker_pool(worker_pool_t **pool, unsigned int number_of_workers, const worker_attr_t *attr, work_entry_hash_f hash);
+
+/**
+ * @brief Writes entry in the queue of the worker selected by the hash of the entry.
+ *
+ * With WORKING_QUEUE_MODE_SPSC workers, this function must be called from one thread only.
+ *
+ * @param[in] pool pointer to the worker pool
+ * @param[in] working_entry pointer to the new entry
+ *
+ * @return 0 if the entry is in the queue, -1 if it was discarded by the overflow policy
+ */
+extern int add_pool_work_entry(worker_pool_t *pool, void *working_entry);
+
+/**
+ * @brief Ends the execution of all worker threads in the pool after their queues are drained.
+ *
+ * @param[in, out] pool to be stopped
+ * @return 0
+ */
+extern int stop_worker_pool(worker_pool_t *pool);
+
+/**
+ * @brief Returns the worker of the pool that processes the entries with the given hash.
+ *
+ * Used together with reserve_work_entry()/commit_work_entry() when the entry is written directly into the queue.
+ *
+ * @param[in] pool pointer to the worker pool
+ * @param[in] hash sharding key of the entry
+ *
+ * @return selected worker
+ */
+extern worker_t *get_pool_worker(worker_pool_t *pool, unsigned int hash);
+
+/**
+ *  @brief Free up the resources allocated for the pool and its workers.
+ *
+ *  @param[in, out] pool points to a poiner of the pool structure
+ */
+extern void worker_pool_clean_up(worker_pool_t **pool);
+
 /**
  *  @brief Free up the resources allocated for the worker and the working queue.
  *  
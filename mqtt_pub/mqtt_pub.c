@@ -4,6 +4,15 @@
   * @brief MQTT client based on libmosquitto. It publishes 
   * dummy environment data on MQTT topic: /home/<location_name>/ambient_data.
   *
+  * With a publish rate given it runs as a load generator: several simulated publishers, each with
+  * its own broker connection, publish at the given total rate. Every message carries a probe with
+  * the publish time and a sequence number for measuring latency and loss in mqtt_sub.
+  *
+  * With a number of virtual devices given it simulates a fleet of devices, each with its own
+  * location, period and phase, over a few broker connections. The publish times of all devices
+  * are scheduled by a hierarchical timing wheel, and one thread runs the wheel and all broker
+  * connections in an epoll event loop.
+  *
   * @date 10-Feb-2020
   * @copyright GNU General Public License v3
   *
@@ -13,31 +22,603 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <string.h>
 #include <getopt.h>
+#include <time.h>
 #include <sys/types.h>
 
 #include "mosquitto.h"
 
 #include "mqtt_userdefs.h"
+#include "payload.h"
+#include "async_publisher.h"
+#include "timing_wheel.h"
+#include "event_loop.h"
+
+#define PUBLISHER_STOP_TIMEOUT 5000     /**< Time in ms to wait for the outstanding messages at the end. */
+#define FLEET_DEFAULT_PERIOD_MS 1000    /**< Default mean publish period of the virtual devices. */
+#define FLEET_PERIOD_SPREAD 0.1         /**< Periods of the virtual devices differ up to this fraction from the mean period. */
+#define FLEET_TICK_NS 1000000ull        /**< Length of one tick of the timing wheel in ns. */
+#define FLEET_TOPIC_SIZE 80             /**< Topic home/<location>_<index>/ambient_data with the location cut to 50 characters. */
+#define FLEET_LOCATION_OFFSET 5         /**< Offset of the location in the topic, after home/. */
+
+
+/**
+ * @brief Simulated publisher of the load generator.
+ */
+typedef struct {
+    async_publisher_t client;       /**< Own libmosquitto client instance, broker connection and network thread. */
+    bool started;                   /**< Client is connected and its network thread runs. */
+    char location[64];              /**< Location of the publisher. */
+    char topic[256];                /**< Topic with the location of the publisher. */
+    uint32_t sequence;              /**< Sequence number of the next message. */
+    payload_batch_t *batch;         /**< Readings waiting to be published in one message. NULL without batching. */
+} publisher_t;
+
+
+/**
+ * @brief Virtual device of the fleet.
+ */
+typedef struct {
+    timing_wheel_timer_t timer;     /**< Next publish time. First member, so the device is found from its timer. */
+    uint64_t period_ns;             /**< Publish period of the device. */
+    uint32_t index;                 /**< Index of the device, also the publisher index in the probe. */
+    uint32_t sequence;              /**< Sequence number of the next message. */
+    uint32_t location_length;       /**< Length of the location in the topic. */
+    char topic[FLEET_TOPIC_SIZE];   /**< Topic with the location of the device, built once for the whole simulation. */
+} virtual_device_t;
+
+
+/**
+ * @brief State of the fleet shared with the expire function of the timing wheel.
+ */
+typedef struct {
+    const start_arg_t *start_arg;       /**< Command line arguments. */
+    payload_format_t payload_format;    /**< Wire format of the published payload. */
+    publisher_t *publishers;            /**< Broker connections shared by the devices. */
+    unsigned int number_of_publishers;  /**< Number of broker connections. */
+    ambient_t ambient;                  /**< Dummy environment data of all devices. */
+    uint64_t sent;                      /**< Number of published messages. */
+    timing_wheel_t wheel;               /**< Next publish times of the devices. */
+    uint64_t end;                       /**< Monotonic time in ns when the simulation stops, 0 runs forever. */
+    uint64_t stop_deadline;             /**< Monotonic time in ns when the outstanding messages are given up. */
+    bool draining;                      /**< Simulation stopped, the outstanding messages are completed. */
+} fleet_t;
+
+
+/**
+ * @brief Waits for the outstanding messages of the simulated publishers, then disconnects them
+ * and stops their network threads.
+ */
+static void stop_publishers(publisher_t *publishers, unsigned int number_of_publishers, unsigned int timeout_ms)
+{
+    unsigned int i;
+
+    for (i = 0; i < number_of_publishers; i++)
+    {
+        if (publishers[i].started)
+        {
+            async_publisher_stop(&(publishers[i].client), timeout_ms);
+            publishers[i].started = false;
+        }
+    }
+}
+
+
+/**
+ * @brief Stops the simulated publishers and frees them.
+ */
+static void clean_up_publishers(publisher_t *publishers, unsigned int number_of_publishers)
+{
+    unsigned int i;
+
+    stop_publishers(publishers, number_of_publishers, 0);
+
+    for (i = 0; i < number_of_publishers; i++)
+    {
+        free(publishers[i].batch);
+    }
+
+    free(publishers);
+}
+
+
+/**
+ * @brief Prints the delivery counters and the time to acknowledgement of all simulated publishers
+ * as one JSON line.
+ */
+static void print_delivery_report(const start_arg_t *start_arg, const publisher_t *publishers, unsigned int number_of_publishers, uint64_t sent, double seconds)
+{
+    static histogram_t time_to_ack;         /**< Too big for the stack. */
+    unsigned long published = 0, completed = 0, failed = 0, window_full = 0, connections = 0;
+    unsigned int i;
+
+    histogram_init(&time_to_ack);
+
+    for (i = 0; i < number_of_publishers; i++)
+    {
+        published += publishers[i].client.published;
+        completed += publishers[i].client.completed;
+        failed += publishers[i].client.failed;
+        window_full += publishers[i].client.window_full;
+        connections += publishers[i].client.connections;
+        histogram_merge(&time_to_ack, &(publishers[i].client.time_to_ack));
+    }
+
+    printf("{\"publishers\":%u,\"qos\":%u,\"window\":%u,\"target_rate\":%u,\"sent\":%llu,\"seconds\":%.3f,\"rate\":%.1f,"
+           "\"published\":%lu,\"completed\":%lu,\"failed\":%lu,\"window_full\":%lu,\"reconnects\":%lu,"
+           "\"time_to_ack_ns\":{\"p50\":%llu,\"p99\":%llu,\"p999\":%llu,\"max\":%llu}}\n",
+                number_of_publishers, start_arg->qos, publishers[0].client.window, start_arg->publish_rate,
+                (unsigned long long) sent, seconds, sent / seconds,
+                published, completed, failed, window_full, connections - number_of_publishers,
+                (unsigned long long) histogram_percentile(&time_to_ack, 50),
+                (unsigned long long) histogram_percentile(&time_to_ack, 99),
+                (unsigned long long) histogram_percentile(&time_to_ack, 99.9),
+                (unsigned long long) time_to_ack.max);
+}
+
+
+/**
+ * @brief Publishes the readings collected by the publisher and empties its batch.
+ *
+ * @return MOSQ_ERR_SUCCESS on success, libmosquitto error code otherwise
+ */
+static int publish_batch(publisher_t *publisher)
+{
+    int rc = async_publish(&(publisher->client), publisher->topic, publisher->batch->buffer, (int) publisher->batch->length);
+
+    payload_batch_reset(publisher->batch);
+
+    return rc;
+}
+
+
+/**
+ * @brief Load generator. Publishes messages with probes from the simulated publishers at the given
+ * total rate, in round robin.
+ *
+ * Message k is due k / rate seconds after the start. The thread sleeps till the due time of the
+ * next message on the absolute monotonic clock and then publishes all messages that are due, so
+ * the average rate does not drift when a sleep takes longer.
+ *
+ * With batching every publisher collects its readings and publishes them when the batch is full
+ * or when its oldest reading reaches the batch latency. The rate is the rate of readings.
+ *
+ * With QoS 1/2 a publisher blocks while its in-flight window is full, so the achieved rate can
+ * stay below the target rate.
+ *
+ * @param[in] start_arg command line arguments
+ * @param[in] payload_format wire format of the published payload
+ *
+ * @return 0 on success, -1 if a publisher could not connect to the broker
+ */
+static int run_load_generator(const start_arg_t *start_arg, payload_format_t payload_format)
+{
+    publisher_t *publishers;
+    ambient_t ambient;
+    probe_t probe;
+    uint8_t payload[PAYLOAD_MAX_SIZE];
+    size_t payload_length;
+    struct timespec next_publish;
+    uint64_t start, now, end, next;
+    uint64_t due, sent = 0;
+    uint64_t next_flush = UINT64_MAX;       /**< Earliest deadline of the batches. */
+    uint64_t batch_latency_ns = start_arg->batch_latency_ms * 1000000ull;
+    unsigned int number_of_publishers = start_arg->number_of_publishers ? start_arg->number_of_publishers : 1;
+    unsigned int i;
+
+    publishers = calloc(number_of_publishers, sizeof(publisher_t));
+    if (!publishers)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < number_of_publishers; i++)
+    {
+        //Every simulated publisher has its own location
+        if (number_of_publishers > 1)
+        {
+            snprintf(publishers[i].location, sizeof(publishers[i].location), "%.50s_%u", start_arg->location, i);
+        }
+        else
+        {
+            snprintf(publishers[i].location, sizeof(publishers[i].location), "%s", start_arg->location);
+        }
+
+        snprintf(publishers[i].topic, sizeof(publishers[i].topic), "home/%s/ambient_data", publishers[i].location);
+
+        //Network thread of the publisher sends the queued messages and keepalives
+        if (async_publisher_start(&(publishers[i].client), start_arg->broker_hostname, start_arg->broker_port, start_arg->qos, start_arg->max_inflight))
+        {
+            printf("Error: connecting publisher %u to MQTT broker failed\n", i);
+            clean_up_publishers(publishers, number_of_publishers);
+            return -1;
+        }
+
+        publishers[i].started = true;
+
+        if (start_arg->batch_size > 1)
+        {
+            publishers[i].batch = malloc(sizeof(payload_batch_t));
+
+            if (!publishers[i].batch)
+            {
+                clean_up_publishers(publishers, number_of_publishers);
+                return -1;
+            }
+
+            payload_batch_init(publishers[i].batch, start_arg->batch_size, true);
+        }
+    }
+
+    memset(&ambient, 0, sizeof(ambient));
+    ambient.temperature = 25.3;
+    ambient.pressure = 995.3;
+    ambient.humidity = 33;
+
+    start = monotonic_time_ns();
+    end = start_arg->duration ? start + start_arg->duration * 1000000000ull : 0;
+
+    while (1)
+    {
+        now = monotonic_time_ns();
+
+        if (end && (now >= end))
+        {
+            break;
+        }
+
+        //Publish every message that is due by now
+        due = (uint64_t) ((now - start) / 1e9 * start_arg->publish_rate) + 1;
+
+        while (sent < due)
+        {
+            publisher_t *publisher = &publishers[sent % number_of_publishers];
+
+            //The compact payload takes the location from the topic
+            if (payload_format == PAYLOAD_FORMAT_LEGACY)
+            {
+                snprintf(ambient.location, sizeof(ambient.location), "%s", publisher->location);
+            }
+
+            probe.publisher = (uint32_t) (sent % number_of_publishers);
+            probe.sequence = publisher->sequence++;
+            probe.publish_time = monotonic_time_ns();
+
+            sent++;
+
+            if (publisher->batch)
+            {
+                if (payload_batch_add(publisher->batch, &ambient, &probe))
+                {
+                    publish_batch(publisher);
+                }
+                else if ((publisher->batch->number_of_readings == 1) && (publisher->batch->first_reading_time + batch_latency_ns < next_flush))
+                {
+                    next_flush = publisher->batch->first_reading_time + batch_latency_ns;
+                }
+
+                continue;
+            }
+
+            payload_length = encode_ambient(payload_format, &ambient, &probe, payload, sizeof(payload));
+
+            async_publish(&(publisher->client), publisher->topic, payload, (int) payload_length);
+        }
+
+        //Publish the batches that reached the latency limit and find the next deadline
+        if (monotonic_time_ns() >= next_flush)
+        {
+            now = monotonic_time_ns();
+            next_flush = UINT64_MAX;
+
+            for (i = 0; i < number_of_publishers; i++)
+            {
+                if (!publishers[i].batch->number_of_readings)
+                {
+                    continue;
+                }
+
+                if (publishers[i].batch->first_reading_time + batch_latency_ns <= now)
+                {
+                    publish_batch(&publishers[i]);
+                }
+                else if (publishers[i].batch->first_reading_time + batch_latency_ns < next_flush)
+                {
+                    next_flush = publishers[i].batch->first_reading_time + batch_latency_ns;
+                }
+            }
+        }
+
+        //Sleep till the next message or the next batch is due
+        next = start + (uint64_t) (sent * 1e9 / start_arg->publish_rate);
+        next = next < next_flush ? next : next_flush;
+        next_publish.tv_sec = next / 1000000000ull;
+        next_publish.tv_nsec = next % 1000000000ull;
+
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next_publish, NULL);
+    }
+
+    //Readings still waiting in the batches
+    for (i = 0; (start_arg->batch_size > 1) && (i < number_of_publishers); i++)
+    {
+        if (publishers[i].batch->number_of_readings)
+        {
+            publish_batch(&publishers[i]);
+        }
+    }
+
+    //Count the acknowledgements of the outstanding messages
+    stop_publishers(publishers, number_of_publishers, PUBLISHER_STOP_TIMEOUT);
+
+    print_delivery_report(start_arg, publishers, number_of_publishers, sent, (now - start) / 1e9);
+
+    clean_up_publishers(publishers, number_of_publishers);
+
+    return 0;
+}
+
+
+/**
+ * @brief Publishes one message of the virtual device and schedules its next one. Called by the
+ * timing wheel when the device is due.
+ */
+static void publish_device(timing_wheel_t *wheel, timing_wheel_timer_t *timer, void *context)
+{
+    fleet_t *fleet = (fleet_t *) context;
+    virtual_device_t *device = (virtual_device_t *) timer;
+    publisher_t *publisher = &(fleet->publishers[device->index % fleet->number_of_publishers]);
+    uint8_t payload[PAYLOAD_MAX_SIZE];
+    size_t payload_length;
+    probe_t probe;
+
+    //The compact payload takes the location from the topic, the legacy one carries it
+    memcpy(fleet->ambient.location, device->topic + FLEET_LOCATION_OFFSET, device->location_length);
+    fleet->ambient.location[device->location_length] = '\0';
+
+    probe.publisher = device->index;
+    probe.sequence = device->sequence++;
+    probe.publish_time = monotonic_time_ns();
+
+    payload_length = encode_ambient(fleet->payload_format, &(fleet->ambient), &probe, payload, sizeof(payload));
+
+    async_publish(&(publisher->client), device->topic, payload, (int) payload_length);
+    fleet->sent++;
+
+    //The next publish time follows the schedule of the device, a late message does not shift it
+    timing_wheel_add(wheel, timer, timer->due + device->period_ns);
+}
+
+
+/**
+ * @brief Prints the schedule of the fleet and the lateness of the publishes as one JSON line.
+ */
+static void print_fleet_report(unsigned int number_of_devices, unsigned int period_ms, double target_rate, const timing_wheel_t *wheel)
+{
+    printf("{\"devices\":%u,\"period_ms\":%u,\"target_rate\":%.1f,\"tick_ns\":%llu,\"ticks\":%lu,\"expired\":%lu,\"cascaded\":%lu,"
+           "\"lateness_ns\":{\"mean\":%llu,\"p50\":%llu,\"p99\":%llu,\"p999\":%llu,\"max\":%llu}}\n",
+                number_of_devices, period_ms, target_rate, (unsigned long long) wheel->tick_ns,
+                wheel->ticks, wheel->expired, wheel->cascaded,
+                (unsigned long long) histogram_mean(&(wheel->lateness)),
+                (unsigned long long) histogram_percentile(&(wheel->lateness), 50),
+                (unsigned long long) histogram_percentile(&(wheel->lateness), 99),
+                (unsigned long long) histogram_percentile(&(wheel->lateness), 99.9),
+                (unsigned long long) wheel->lateness.max);
+}
+
+
+/**
+ * @brief Publishes the due devices and sets the timer to the next tick with due devices. After
+ * the end of the simulation it waits for the outstanding messages and stops the event loop.
+ * Called by the event loop when the timer expires.
+ */
+static void run_schedule(event_loop_t *loop, event_loop_source_t *source, uint32_t events)
+{
+    fleet_t *fleet = (fleet_t *) source->context;
+    uint64_t now = monotonic_time_ns();
+    uint64_t next;
+    bool idle = true;
+    unsigned int i;
+
+    if (!fleet->draining && fleet->end && (now >= fleet->end))
+    {
+        fleet->draining = true;
+        fleet->stop_deadline = now + PUBLISHER_STOP_TIMEOUT * 1000000ull;
+    }
+
+    if (fleet->draining)
+    {
+        for (i = 0; idle && (i < fleet->number_of_publishers); i++)
+        {
+            idle = async_publisher_idle(&(fleet->publishers[i].client));
+        }
+
+        if (idle || (now >= fleet->stop_deadline))
+        {
+            event_loop_stop(loop);
+            return;
+        }
+
+        event_loop_set_timer(source, now + FLEET_TICK_NS, 0);
+        return;
+    }
+
+    timing_wheel_advance(&(fleet->wheel), now, publish_device, fleet);
+
+    next = timing_wheel_next_time(&(fleet->wheel));
+    next = (fleet->end && (fleet->end < next)) ? fleet->end : next;
+
+    event_loop_set_timer(source, next, 0);
+}
+
+
+/**
+ * @brief Fleet simulator. Publishes the messages of the virtual devices over the broker
+ * connections shared by them.
+ *
+ * Every device publishes on its own location <location>_<index>, with its own period within
+ * FLEET_PERIOD_SPREAD of the mean period and a random phase, so the messages of the fleet are
+ * spread evenly over time. The next publish time of every device is a timer in a hierarchical
+ * timing wheel, so one thread schedules any number of devices at a constant cost per message.
+ * Device k uses the connection k modulo the number of connections. Every message carries a probe
+ * with the device index as the publisher.
+ *
+ * The calling thread runs an event loop with all broker connections and a timerfd set to the
+ * next tick with due devices, so the fleet needs no network threads. With QoS 1/2 a message that
+ * does not fit into the in-flight window of its connection is dropped and counted in window_full.
+ *
+ * @param[in] start_arg command line arguments
+ * @param[in] payload_format wire format of the published payload
+ *
+ * @return 0 on success, -1 if a connection to the broker failed
+ */
+static int run_fleet(const start_arg_t *start_arg, payload_format_t payload_format)
+{
+    static fleet_t fleet;                   /**< Too big for the stack. */
+    event_loop_t loop;
+    event_loop_source_t schedule;
+    virtual_device_t *devices;
+    uint64_t start, now;
+    unsigned int period_ms = start_arg->sample_period_ms ? start_arg->sample_period_ms : FLEET_DEFAULT_PERIOD_MS;
+    unsigned int seed = 1;
+    double target_rate = 0;
+    unsigned int i;
+
+    fleet.start_arg = start_arg;
+    fleet.payload_format = payload_format;
+    fleet.number_of_publishers = start_arg->number_of_publishers ? start_arg->number_of_publishers : 1;
+
+    if (event_loop_init(&loop))
+    {
+        printf("Error: creating the event loop failed\n");
+        return -1;
+    }
+
+    devices = calloc(start_arg->number_of_devices, sizeof(virtual_device_t));
+    fleet.publishers = calloc(fleet.number_of_publishers, sizeof(publisher_t));
+
+    if (!devices || !fleet.publishers)
+    {
+        free(devices);
+        free(fleet.publishers);
+        event_loop_clean_up(&loop);
+        return -1;
+    }
+
+    //All connections are serviced by the event loop of this thread
+    for (i = 0; i < fleet.number_of_publishers; i++)
+    {
+        if (async_publisher_attach(&(fleet.publishers[i].client), &loop, start_arg->broker_hostname, start_arg->broker_port, start_arg->qos, start_arg->max_inflight))
+        {
+            printf("Error: connecting publisher %u to MQTT broker failed\n", i);
+            clean_up_publishers(fleet.publishers, fleet.number_of_publishers);
+            event_loop_clean_up(&loop);
+            free(devices);
+            return -1;
+        }
+
+        fleet.publishers[i].started = true;
+    }
+
+    fleet.ambient.temperature = 25.3;
+    fleet.ambient.pressure = 995.3;
+    fleet.ambient.humidity = 33;
+
+    start = monotonic_time_ns();
+    fleet.end = start_arg->duration ? start + start_arg->duration * 1000000000ull : 0;
+
+    timing_wheel_init(&(fleet.wheel), start, FLEET_TICK_NS);
+
+    //Same seed in every run, so the schedule of the fleet can be repeated
+    for (i = 0; i < start_arg->number_of_devices; i++)
+    {
+        devices[i].index = i;
+        devices[i].location_length = (uint32_t) snprintf(devices[i].topic, sizeof(devices[i].topic), "home/%.50s_%u/ambient_data", start_arg->location, i) - FLEET_LOCATION_OFFSET - strlen("/ambient_data");
+        devices[i].period_ns = (uint64_t) (period_ms * 1e6 * (1.0 + FLEET_PERIOD_SPREAD * (2.0 * rand_r(&seed) / RAND_MAX - 1.0)));
+        devices[i].period_ns = devices[i].period_ns ? devices[i].period_ns : 1;
+        target_rate += 1e9 / devices[i].period_ns;
+
+        timing_wheel_add(&(fleet.wheel), &(devices[i].timer), start + (uint64_t) ((double) rand_r(&seed) / RAND_MAX * (devices[i].period_ns - 1)));
+    }
+
+    if (event_loop_add_timer(&loop, &schedule, start, 0, run_schedule, &fleet))
+    {
+        clean_up_publishers(fleet.publishers, fleet.number_of_publishers);
+        event_loop_clean_up(&loop);
+        free(devices);
+        return -1;
+    }
+
+    event_loop_run(&loop);
+
+    now = monotonic_time_ns();
+
+    //The outstanding messages were completed in the loop before it stopped
+    stop_publishers(fleet.publishers, fleet.number_of_publishers, 0);
+
+    print_delivery_report(start_arg, fleet.publishers, fleet.number_of_publishers, fleet.sent, ((fleet.end ? fleet.end : now) - start) / 1e9);
+    print_fleet_report(start_arg->number_of_devices, period_ms, target_rate, &(fleet.wheel));
+
+    clean_up_publishers(fleet.publishers, fleet.number_of_publishers);
+    event_loop_remove(&loop, &schedule);
+    event_loop_clean_up(&loop);
+    free(devices);
+
+    return 0;
+}
 
 
 int main(int argc, char *argv[])
 {
-    struct mosquitto *mosq;     /**< Libmosquito MQTT client instance. */
+    static async_publisher_t publisher;     /**< Libmosquito MQTT client instance with its network thread. */
 
     ambient_t ambient;               /**< MQTT message payload. */
     
     char mqtt_channel_name[256];
 
+    uint8_t payload[PAYLOAD_MAX_SIZE];      /**< Payload encoded in the wire format. */
+    size_t payload_length;
+    payload_format_t payload_format;
+    static payload_batch_t batch;            /**< Readings waiting to be published in one message. */
+
 	start_arg_t start_arg = {   /**< Command line arguments will be stored here. */
 		.broker_hostname = "localhost",
 		.broker_port = 1883,
-        .location = "location"
+        .location = "location",
+        .batch_latency_ms = 10000
 	};
 
     //Process the program arguments
     process_arguments(argc, argv, &start_arg);
 
+    if (payload_format_from_string(start_arg.payload_format, &payload_format))
+    {
+        printf("Error: unknown payload format %s\n", start_arg.payload_format);
+        return -1;
+    }
+
+    if (start_arg.number_of_devices)
+    {
+        int rc;
+
+        mosquitto_lib_init();
+        rc = run_fleet(&start_arg, payload_format);
+        mosquitto_lib_cleanup();
+
+        return rc;
+    }
+
+    if (start_arg.publish_rate)
+    {
+        int rc;
+
+        mosquitto_lib_init();
+        rc = run_load_generator(&start_arg, payload_format);
+        mosquitto_lib_cleanup();
+
+        return rc;
+    }
+
 #ifdef __SHOW_MOSQUITTO_INFO__	
     int major, minor, revision;
 
@@ -48,18 +629,12 @@ int main(int argc, char *argv[])
     //libmosquitto initialization
     mosquitto_lib_init();
 
-    //Create new libmosquitto client instance
-    mosq = mosquitto_new(NULL, true, NULL);
-
-    if (!mosq)
-    {
-	printf("Error: failed to create mosquitto client\n");
-    }
-
-    //Connect to MQTT broker
-    if (mosquitto_connect(mosq, start_arg.broker_hostname, start_arg.broker_port, 60) != MOSQ_ERR_SUCCESS)
+    //Create new libmosquitto client instance, connect to MQTT broker and run its network loop in a separate thread
+    if (async_publisher_start(&publisher, start_arg.broker_hostname, start_arg.broker_port, start_arg.qos, start_arg.max_inflight))
     {
 	printf("Error: connecting to MQTT broker failed\n");
+        mosquitto_lib_cleanup();
+        return -1;
     }
 
     snprintf(ambient.location, sizeof(ambient.location), "%s", start_arg.location);
@@ -71,14 +646,32 @@ int main(int argc, char *argv[])
 
     sprintf(mqtt_channel_name, "home/%s/ambient_data", start_arg.location);
 
+    payload_length = encode_ambient(payload_format, &ambient, NULL, payload, sizeof(payload));
+
+    payload_batch_init(&batch, start_arg.batch_size, false);
+
     while(1)
     {
+        if (start_arg.batch_size > 1)
+        {
+            //Publish the batch when it is full or when the next reading would come too late
+            if (payload_batch_add(&batch, &ambient, NULL) ||
+                payload_batch_due(&batch, monotonic_time_ns() + 1000000000ull, start_arg.batch_latency_ms * 1000000ull))
+            {
+                async_publish(&publisher, mqtt_channel_name, batch.buffer, (int) batch.length);
+                payload_batch_reset(&batch);
+            }
+
+            sleep(1);
+            continue;
+        }
+
         //Publish the MQTT message 
-	    mosquitto_publish(mosq, NULL, mqtt_channel_name, sizeof(ambient_t), &ambient, MQTT_QOS_0, false);
+	    async_publish(&publisher, mqtt_channel_name, payload, (int) payload_length);
         sleep(1);
     }
 
     //Clean up/destroy objects created by libmosquitto
-    mosquitto_destroy(mosq);
+    async_publisher_stop(&publisher, PUBLISHER_STOP_TIMEOUT);
     mosquitto_lib_cleanup();
 }
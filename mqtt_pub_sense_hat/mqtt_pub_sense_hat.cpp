@@ -3,7 +3,8 @@
 *  
 *  @brief MQTT publisher code based on libmosquitto. 
 *  Readings from Pi Sense HAT sensors are used as 
-*  MQTT message payload.
+*  MQTT message payload. With -e simulated the readings
+*  come from simulated sensors, without any hardware.
 * 
 *  @date 10-Feb-2020
 *  @copyright GNU General Public License v3
@@ -11,73 +12,141 @@
 
 #include <iostream>
 #include <cstdint>
+#include <cerrno>
+#include <cstring>
 
-#include <unistd.h> // For sleep()
-
-#include "setila/setila_i2c.h"
-#include "setila/LPS25H.h"
-#include "setila/HTS221.h"
+#include <signal.h>
+#include <semaphore.h>
 
 
 extern "C" {
 #include "mosquitto.h"
 #include "mqtt_userdefs.h"
+#include "payload.h"
+#include "sampler.h"
+#include "sensor.h"
 }
 
-int main(int argc, char *argv[])
-{
-    Bus_Master_Device *i2c_bus_master = new Bus_Master_Device("/dev/i2c-1", BUS_TYPE::I2C_BUS);
+#define SENSE_HAT_SAMPLE_PERIOD_MS 3000     /**< Default period of the sensor readings. */
 
-    char mqtt_channel_name[256];
 
-    struct mosquitto *mosq = nullptr;
+static struct mosquitto *mosq = nullptr;    /**< Used only by the publishing thread after the connection. */
 
-    ambient_t ambient;
+static char mqtt_channel_name[256];
 
-    start_arg_t start_arg = { "localhost", 1883, "location" };
+static ambient_t ambient;
 
-    int status = 0;
+static payload_format_t payload_format;
 
-    process_arguments(argc, argv, &start_arg);
+static payload_batch_t *batch;
+
+static start_arg_t start_arg = { "localhost", 1883, "location" };
+
+static sampler_t sampler;
+
+static sensor_t sensor;     /**< Read only by the sampling thread while it runs. */
+
+static sem_t stop_semaphore;        /**< Posted by the signal handler to stop the publisher. */
+
+
+/**
+ * @brief Prints the sampling jitter so far and the deadlines without a published reading.
+ */
+static void print_sampling_stats(void)
+{
+    static histogram_t jitter;      /**< Snapshot, used only by one thread at a time. */
+
+    histogram_snapshot(&(sampler.jitter), &jitter);
+
+    std::cout << "Sampling jitter p50=" << histogram_percentile(&jitter, 50) / 1000
+              << " p99=" << histogram_percentile(&jitter, 99) / 1000
+              << " max=" << jitter.max / 1000 << "[us]"
+              << ", missed deadlines " << __atomic_load_n(&(sampler.missed), __ATOMIC_RELAXED)
+              << ", failed reads " << __atomic_load_n(&(sampler.failed), __ATOMIC_RELAXED)
+              << ", dropped readings " << __atomic_load_n(&(sampler.dropped), __ATOMIC_RELAXED) << std::endl;
+}
 
-    LPS25H *lps25h_sensor = new LPS25H(Slave_Device_Type::I2C_SLAVE_DEVICE, i2c_bus_master, 0x5C);
-    HTS221 *hts221_sensor = new HTS221(Slave_Device_Type::I2C_SLAVE_DEVICE, i2c_bus_master, 0x5F);
 
-    if (i2c_bus_master->open_bus() < 0)
+/**
+ * @brief Prints and publishes a reading, called in the publishing thread. The time spent
+ * here does not delay the next reading of the sensors.
+ */
+static int publish_reading(void *entry)
+{
+    const sampler_reading_t *reading = (const sampler_reading_t *) entry;
+    uint8_t payload[PAYLOAD_MAX_SIZE];
+    size_t payload_length;
+
+    std::cout << std::endl << "Readings from Pi Sense Hat sensors:" << std::endl << std::endl;
+    std::cout << "Pressure P=" << reading->pressure << "[hPa]" << std::endl;
+    std::cout << "Temperature T=" << reading->temperature << "[°C]" << std::endl;
+    std::cout << "Relative Humidity R=" << reading->humidity << "[%rH]" << std::endl;
+    std::cout << std::endl;
+    print_sampling_stats();
+
+    ambient.temperature = reading->temperature;
+    ambient.pressure = reading->pressure;
+    ambient.humidity = reading->humidity;
+
+    if (start_arg.batch_size > 1)
     {
-        std::cout << "Failed to open master bus" << std::endl;
-        return -1;
+        // Publish the batch when it is full or when the next reading would come too late
+        if (payload_batch_add(batch, &ambient, NULL) ||
+            payload_batch_due(batch, reading->deadline + sampler.period_ns, start_arg.batch_latency_ms * 1000000ull))
+        {
+            mosquitto_publish(mosq, NULL, mqtt_channel_name, batch->length, batch->buffer, MQTT_QOS_0, false);
+            payload_batch_reset(batch);
+        }
     }
-
-    // Set LPS25H internal temperature average to 16 and pressure to 32
-    status = lps25h_sensor->set_resolution(0x01, 0x01);
-    if (status)
+    else
     {
-        std::cout << "HTS221 sensor set resolution failed." << std::endl;
-        return status;
+        payload_length = encode_ambient(payload_format, &ambient, NULL, payload, sizeof(payload));
+
+        mosquitto_publish(mosq, NULL, mqtt_channel_name, payload_length, payload, MQTT_QOS_0, false);
     }
 
-    status = lps25h_sensor->set_mode_of_operation(ST_Sensor::MODE_OF_OPERATION::OP_FIFO_MEAN_MODE, ST_Sensor::OUTPUT_DATA_RATE::ODR_1_Hz, LPS25H_NBR_AVERAGED_SAMPLES::AVER_SAMPLES_4);
-    if (status)
+    return 0;
+}
+
+
+/**
+ * @brief Signal handler, stops the publisher.
+ */
+static void stop_publisher(int signal_number)
+{
+    sem_post(&stop_semaphore);
+}
+
+
+int main(int argc, char *argv[])
+{
+    struct sigaction stop_action;
+
+    batch = new payload_batch_t;
+
+    start_arg.batch_latency_ms = 10000;
+    start_arg.sample_period_ms = SENSE_HAT_SAMPLE_PERIOD_MS;
+
+    process_arguments(argc, argv, &start_arg);
+
+    payload_batch_init(batch, start_arg.batch_size, false);
+
+    if (payload_format_from_string(start_arg.payload_format, &payload_format))
     {
-        std::cout << "LPS25H sensor initialization failed." << std::endl;
-        return status;
+        std::cout << "Error: unknown payload format " << start_arg.payload_format << std::endl;
+        return -1;
     }
 
-    //Set HTS221 internal temperature average to 32 and humidity to 64
-    status = hts221_sensor->set_resolution(0x04, 0x04);
-    if (status)
+    if (!start_arg.sample_period_ms)
     {
-        std::cout << "HTS221 sensor set resolution failed." << std::endl;
-        return status;
+        std::cout << "Error: the sample period must be at least 1 ms" << std::endl;
+        return -1;
     }
 
-    // Configure HTS221 for ONE SHOT type of measurements
-    status = hts221_sensor->set_mode_of_operation(ST_Sensor::MODE_OF_OPERATION::OP_ONE_SHOT);
-    if (status)
+    if (sensor_open(&sensor, start_arg.sensor))
     {
-        std::cout << "HTS221 sensor initialization failed." << std::endl;
-        return status;
+        std::cout << "Error: opening the sensors failed" << std::endl;
+        return -1;
     }
 
     mosquitto_lib_init();
@@ -98,41 +167,40 @@ int main(int argc, char *argv[])
 
     sprintf(mqtt_channel_name, "home/%s/ambient_data", start_arg.location);
 
-    while(1)
-    {
-        if (lps25h_sensor->get_sensor_readings())
-        {
-            std::cout << "LPS25H pressure/temperature measurement failed." << std::endl;
-            return status;
-        }
+    sem_init(&stop_semaphore, 0, 0);
+    memset(&stop_action, 0, sizeof(stop_action));
+    stop_action.sa_handler = stop_publisher;
+    sigaction(SIGINT, &stop_action, NULL);
+    sigaction(SIGTERM, &stop_action, NULL);
 
-        if (hts221_sensor->get_sensor_readings())
-        {
-            std::cout << "HTS221 humidity/temperature measurement failed." << std::endl;
-            return -1;
-        }
-
-        std::cout << std::endl << "Readings from Pi Sense Hat sensors:" << std::endl << std::endl;
-        std::cout << "Pressure P=" << lps25h_sensor->pressure_reading() << "[hPa]" << std::endl;
-        std::cout << "Temperature T=" << lps25h_sensor->temperature_reading() << "[°C]" << std::endl;
-        std::cout << "Relative Humidity R=" << hts221_sensor->humidity_reading() << "[%rH]" << std::endl;
-        std::cout << std::endl;
+    // The sensors are read on a fixed schedule in their own thread, this thread only waits for the stop
+    if (sampler_start(&sampler, start_arg.sample_period_ms * 1000000ull, 0, sensor_read, &sensor, publish_reading, 0))
+    {
+        std::cout << "Error: starting the sampling thread failed" << std::endl;
+        return -1;
+    }
 
-        ambient.temperature = lps25h_sensor->temperature_reading();
-        ambient.pressure = lps25h_sensor->pressure_reading();
-        ambient.humidity = hts221_sensor->humidity_reading();
+    while (sem_wait(&stop_semaphore) && (errno == EINTR));
 
-        mosquitto_publish(mosq, NULL, mqtt_channel_name, sizeof(ambient_t), &ambient, MQTT_QOS_0, false);
+    sampler_stop(&sampler);
 
-        sleep(3);
+    // Publish the readings still waiting in the batch
+    if (batch->number_of_readings)
+    {
+        mosquitto_publish(mosq, NULL, mqtt_channel_name, batch->length, batch->buffer, MQTT_QOS_0, false);
     }
 
+    std::cout << std::endl << "Published " << sampler.samples << " readings." << std::endl;
+    print_sampling_stats();
+
     mosquitto_destroy(mosq);
     mosquitto_lib_cleanup();
 
-    delete lps25h_sensor;
-    delete hts221_sensor;
-    delete i2c_bus_master;
+    sem_destroy(&stop_semaphore);
+
+    sensor_close(&sensor);
+
+    delete batch;
 
     return 0;
 }
@@ -0,0 +1,188 @@
+ /**
+  * @file mqtt_replay.c
+  *
+  * @brief MQTT client based on libmosquitto. It republishes the messages recorded by mqtt_sub
+  * in a capture file, with the original timing, N times faster or as fast as possible, and
+  * reports the achieved publish rate.
+  *
+  * The messages are spread over several broker connections by their topic, so the messages of
+  * one location keep their order. The probes of the load generator messages get the current
+  * publish time, so mqtt_sub measures the latency of the replayed traffic.
+  *
+  * @date 17-Oct-2026
+  * @copyright GNU General Public License v3
+  *
+  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "mosquitto.h"
+
+#include "mqtt_userdefs.h"
+#include "payload.h"
+#include "capture.h"
+#include "async_publisher.h"
+
+#define REPLAY_STOP_TIMEOUT 5000        /**< Time in ms to wait for the outstanding messages at the end. */
+
+
+/**
+ * @brief Prints the result of the replay as one JSON line.
+ */
+static void print_replay_report(const start_arg_t *start_arg, const async_publisher_t *connections, unsigned int number_of_connections,
+                                    uint64_t sent, uint64_t capture_time, double seconds)
+{
+    static histogram_t time_to_ack;         /**< Too big for the stack. */
+    unsigned long published = 0, completed = 0, failed = 0, window_full = 0, reconnects = 0;
+    unsigned int i;
+
+    histogram_init(&time_to_ack);
+
+    for (i = 0; i < number_of_connections; i++)
+    {
+        published += connections[i].published;
+        completed += connections[i].completed;
+        failed += connections[i].failed;
+        window_full += connections[i].window_full;
+        reconnects += connections[i].connections - 1;
+        histogram_merge(&time_to_ack, &(connections[i].time_to_ack));
+    }
+
+    printf("{\"connections\":%u,\"speed\":%.3f,\"qos\":%u,\"sent\":%llu,\"capture_seconds\":%.3f,\"seconds\":%.3f,\"rate\":%.1f,"
+           "\"published\":%lu,\"completed\":%lu,\"failed\":%lu,\"window_full\":%lu,\"reconnects\":%lu,"
+           "\"time_to_ack_ns\":{\"p50\":%llu,\"p99\":%llu,\"p999\":%llu,\"max\":%llu}}\n",
+                number_of_connections, start_arg->replay_speed, start_arg->qos,
+                (unsigned long long) sent, capture_time / 1e9, seconds, seconds > 0 ? sent / seconds : 0.0,
+                published, completed, failed, window_full, reconnects,
+                (unsigned long long) histogram_percentile(&time_to_ack, 50),
+                (unsigned long long) histogram_percentile(&time_to_ack, 99),
+                (unsigned long long) histogram_percentile(&time_to_ack, 99.9),
+                (unsigned long long) time_to_ack.max);
+}
+
+
+/**
+ * @brief Republishes the captured messages. Message k is due at start + time_k / speed on the
+ * absolute monotonic clock, so late wakeups do not stretch the replay.
+ *
+ * @param[in] start_arg command line arguments
+ * @param[in, out] capture capture opened for reading
+ *
+ * @return 0 on success, -1 if the connections could not be established or the capture is damaged
+ */
+static int replay_capture(const start_arg_t *start_arg, capture_t *capture)
+{
+    async_publisher_t *connections;
+    struct timespec due_time;
+    uint64_t start, end, due, sent = 0;
+    unsigned int number_of_connections = start_arg->number_of_publishers ? start_arg->number_of_publishers : 1;
+    unsigned int i;
+    int rc;
+
+    connections = calloc(number_of_connections, sizeof(async_publisher_t));
+    if (!connections)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < number_of_connections; i++)
+    {
+        if (async_publisher_start(&connections[i], start_arg->broker_hostname, start_arg->broker_port, start_arg->qos, start_arg->max_inflight))
+        {
+            printf("Error: connecting to MQTT broker failed\n");
+
+            while (i--)
+            {
+                async_publisher_stop(&connections[i], 0);
+            }
+
+            free(connections);
+            return -1;
+        }
+    }
+
+    start = monotonic_time_ns();
+
+    while ((rc = capture_read(capture)) > 0)
+    {
+        if (start_arg->replay_speed > 0)
+        {
+            due = start + (uint64_t) (capture->time / start_arg->replay_speed);
+
+            if (due > monotonic_time_ns())
+            {
+                due_time.tv_sec = due / 1000000000ull;
+                due_time.tv_nsec = due % 1000000000ull;
+
+                clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due_time, NULL);
+            }
+        }
+
+        payload_set_publish_time(capture->payload, capture->payload_length, monotonic_time_ns());
+
+        //All messages of a topic go through the same connection and keep their order
+        async_publish(&connections[location_hash(capture->topic) % number_of_connections], capture->topic, capture->payload, (int) capture->payload_length);
+        sent++;
+    }
+
+    end = monotonic_time_ns();
+
+    if (rc < 0)
+    {
+        printf("Error: the capture is damaged after %lu messages\n", capture->messages);
+    }
+
+    //Count the acknowledgements of the outstanding messages
+    for (i = 0; i < number_of_connections; i++)
+    {
+        async_publisher_stop(&connections[i], REPLAY_STOP_TIMEOUT);
+    }
+
+    print_replay_report(start_arg, connections, number_of_connections, sent, capture->time, (end - start) / 1e9);
+
+    free(connections);
+
+    return rc < 0 ? -1 : 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+    static capture_t capture;        /**< Capture being replayed, too big for the stack. */
+    int rc;
+
+    start_arg_t start_arg = {        /**< Command line arguments will be stored here. */
+        .broker_hostname = "localhost",
+        .broker_port = 1883,
+        .replay_speed = 1
+    };
+
+    //Process the program arguments
+    process_arguments(argc, argv, &start_arg);
+
+    if (!start_arg.capture_file[0])
+    {
+        printf("Error: capture file is missing, use -C <file>\n");
+        return -1;
+    }
+
+    if (capture_open(&capture, start_arg.capture_file))
+    {
+        printf("Error: opening the capture file %s failed\n", start_arg.capture_file);
+        return -1;
+    }
+
+    //libmosquitto initialization
+    mosquitto_lib_init();
+
+    rc = replay_capture(&start_arg, &capture);
+
+    mosquitto_lib_cleanup();
+    capture_close(&capture);
+
+    return rc;
+}
@@ -4,6 +4,12 @@
   * @brief Mqtt client based on libmosquitto. Subscribes to topic 
   * /home/+/ambient_data for collecting environment data from the 
   * data publishers.
+  *
+  * The main thread runs an epoll event loop. It services the broker connections and the
+  * periodic reports, so the subscriber needs no libmosquitto network thread. With a list of
+  * brokers the subscriber keeps a connection to each of them and merges their messages into
+  * one worker pool. The received messages are dispatched by a topic router, which calls the
+  * handler of every topic filter matching the topic.
   * 
   * @date 10-Feb-2020
   * @copyright GNU General Public License v3
@@ -14,55 +20,284 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
-#include <semaphore.h>
 #include <stdint.h>
 #include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <sched.h>
+#include <pthread.h>
 
 #include "mosquitto.h"
 
 #include "mqtt_userdefs.h"
+#include "payload.h"
 #include "worker.h"
+#include "output_sink.h"
+#include "store.h"
+#include "capture.h"
+#include "aggregator.h"
+#include "event_loop.h"
+#include "topic_router.h"
+#include "location_dictionary.h"
+
+
+#define MEASURE_MAX_PUBLISHERS 65536     /**< Loss is tracked for the publishers with lower index. */
+#define MAX_BROKERS 64                   /**< Maximal number of brokers in the list given with -b. */
+#define SUBSCRIPTION "home/+/ambient_data"     /**< Topic filter of the readings. */
+#define MULTI_BROKER_OVERFLOW_TIMEOUT_MS 100     /**< Default longest wait for a free queue slot with more than one broker. */
+
+/**
+ * @brief Latency and loss of the messages with probes, collected in the measuring mode.
+ *
+ * The messages from one publisher share a topic and are processed by one worker, so only one
+ * thread updates the sequence state of a publisher.
+ */
+typedef struct {
+    histogram_t latency;                                  /**< Publish to process latency in ns. */
+    unsigned long received;                               /**< Messages with probe. */
+    unsigned long without_probe;                          /**< Messages without probe. */
+    unsigned long out_of_order;                           /**< Messages with lower sequence number than an earlier one. */
+    uint32_t next_sequence[MEASURE_MAX_PUBLISHERS];      /**< Highest received sequence number + 1. */
+    uint32_t received_from[MEASURE_MAX_PUBLISHERS];      /**< Number of received messages per publisher. */
+} measurement_t;
+
+static measurement_t measurement;
+
+
+/**
+ * @brief Connection to one broker of the list, with its counters. Updated only by the event loop.
+ */
+typedef struct {
+    char hostname[128];                 /**< Hostname/IP of the broker. */
+    int port;                           /**< Port of the broker. */
+    struct mosquitto *mosq;             /**< Libmosquitto client instance. */
+    event_loop_source_t source;         /**< Connection in the event loop. */
+    bool connected;                     /**< Broker accepted the connection and it was not lost since. */
+    unsigned long connections;          /**< Successful connections, including reconnects. */
+    unsigned long disconnects;          /**< Lost or closed connections. */
+    unsigned long messages;             /**< Received messages. */
+    unsigned long readings;             /**< Readings queued to the workers. */
+    unsigned long dropped;              /**< Readings discarded by the overflow policy of the queues. */
+    unsigned long unrouted;             /**< Messages matching no route. */
+    unsigned long bytes;                /**< Received payload bytes. */
+} broker_t;
+
+static broker_t *brokers;                /**< Brokers given with -b. */
+static unsigned int number_of_brokers;
 
 
 /**
- * @brief This function will be called by the worker thread for processing each entry from the 
- * queue of MQTT message payloads.
+ * @brief State of the periodic reports, run by the event loop every second.
+ */
+typedef struct {
+    const start_arg_t *start_arg;           /**< Command line arguments. */
+    worker_pool_t *processors;              /**< Workers processing the received messages. */
+    struct mosquitto *mosq;                 /**< Client publishing the statistics of the locations, on the first broker. */
+    unsigned int measure_interval;          /**< Period in seconds for printing the measurement. */
+    unsigned long elapsed_seconds;          /**< Seconds since the start of the periodic reports. */
+} periodic_reports_t;
+
+static output_sink_t output;         /**< Destination of the printed payloads. */
+
+static location_dictionary_t locations;      /**< Ids of the location names, interned by the event loop. */
+
+static store_t store;                /**< Store of the received readings. */
+static bool store_enabled;           /**< Readings are appended to the store. */
+
+static aggregator_t aggregator;      /**< Rolling window statistics of every location. */
+static bool aggregator_enabled;      /**< Readings are added to the aggregator. */
+
+static capture_t capture;            /**< Capture of the received messages. */
+static bool capture_enabled;         /**< Received messages are appended to the capture. */
+
+static event_loop_t loop;            /**< Event loop of the main thread, stopped by the signal handler. */
+
+static topic_router_t router;        /**< Handlers of the subscribed topic filters, used by the event loop. */
+
+
+/**
+ * @brief This function will be called by the worker thread for processing the entries taken
+ * from the queue of MQTT message payloads in one step.
  * 
- * @param[in] process this entry from the queue
+ * The batch is formatted into the output sink in one go, with the timestamp header cached by
+ * the sink. The sink writes the text from its own thread.
+ *
+ * @param[in] messages process these entries from the queue
+ * @param[in] number_of_messages number of entries in the batch
  */
-int process_message(void *message)
+int process_messages(void *messages, unsigned int number_of_messages)
 {
-    time_t local_time;
-    struct tm tm_result;
-    char time_stamp[32];
+    const char *time_stamp;
+    unsigned int i;
 
-    //Build the timestamp header
-    local_time = time(NULL);
-    localtime_r(&local_time, &tm_result);
-    strftime(time_stamp, sizeof(time_stamp), "%d.%h.%Y %H:%M:%S", &tm_result);
+    reading_t *ambient_data = (reading_t *) messages;
+
+    if (store_enabled)
+    {
+        store_append(&store, messages, number_of_messages, sizeof(reading_t));
+    }
 
-    ambient_t *ambient_data = (ambient_t *) message;
+    if (aggregator_enabled)
+    {
+        aggregator_add(&aggregator, messages, number_of_messages, sizeof(reading_t));
+    }
 
-    printf("%s [%s] t = %.2f[°C], p = %.2f[hPa], H = %.2f[%%rH]\n",
-                    time_stamp,
-                    ambient_data->location,
-                    ambient_data->temperature,
-                    ambient_data->pressure,
-                    ambient_data->humidity
-                );
+    output_sink_begin(&output);
 
-    fflush(stdout);
+    time_stamp = output_sink_time_stamp(&output);
+
+    for (i = 0; i < number_of_messages; i++, ambient_data++)
+    {
+        output_sink_printf(&output, "%s [%s] t = %.2f[°C], p = %.2f[hPa], H = %.2f[%%rH]\n",
+                        time_stamp,
+                        location_dictionary_name(&locations, ambient_data->location_id),
+                        ambient_data->temperature,
+                        ambient_data->pressure,
+                        ambient_data->humidity
+                    );
+    }
+
+    output_sink_end(&output);
 	
     return 0;
 }
 
 
+/**
+ * @brief Batch function of the workers in the measuring mode. Records the latency and the sequence
+ * numbers from the probes instead of printing the payloads.
+ *
+ * @param[in] messages process these entries from the queue
+ * @param[in] number_of_messages number of entries in the batch
+ */
+int measure_messages(void *messages, unsigned int number_of_messages)
+{
+    const probe_t *probe;
+    uint64_t now;
+    unsigned long received = 0;
+    unsigned int i;
+
+    //Stored first, so the latency includes the store
+    if (store_enabled)
+    {
+        store_append(&store, messages, number_of_messages, sizeof(reading_t) + sizeof(probe_t));
+    }
+
+    if (aggregator_enabled)
+    {
+        aggregator_add(&aggregator, messages, number_of_messages, sizeof(reading_t) + sizeof(probe_t));
+    }
+
+    for (i = 0; i < number_of_messages; i++)
+    {
+        probe = (const probe_t *) ((char *) messages + i * (sizeof(reading_t) + sizeof(probe_t)) + sizeof(reading_t));
+
+        if (!probe->publish_time)
+        {
+            __atomic_add_fetch(&measurement.without_probe, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        now = monotonic_time_ns();
+        histogram_record(&measurement.latency, now > probe->publish_time ? now - probe->publish_time : 0);
+        received++;
+
+        if (probe->publisher >= MEASURE_MAX_PUBLISHERS)
+        {
+            continue;
+        }
+
+        if (measurement.received_from[probe->publisher] && (probe->sequence < measurement.next_sequence[probe->publisher]))
+        {
+            __atomic_add_fetch(&measurement.out_of_order, 1, __ATOMIC_RELAXED);
+        }
+        else
+        {
+            __atomic_store_n(&measurement.next_sequence[probe->publisher], probe->sequence + 1, __ATOMIC_RELAXED);
+        }
+
+        __atomic_store_n(&measurement.received_from[probe->publisher], measurement.received_from[probe->publisher] + 1, __ATOMIC_RELAXED);
+    }
+
+    __atomic_add_fetch(&measurement.received, received, __ATOMIC_RELAXED);
+
+    return 0;
+}
+
+
+/**
+ * @brief Route handler of the readings, topic home/<location>/ambient_data.
+ *
+ * It decodes the payload in any of the wire formats and writes it into the working FIFO queue
+ * of a worker of the route. Every reading of a batch gets its own queue entry. The location is
+ * interned once per message, the queue entries carry only its id.
+ *
+ * @param[in, out] context worker pool of the route
+ * @param[in, out] message_context broker the message came from
+ * @param[in] match topic with the location matched by '+'
+ * @param[in] payload message payload
+ * @param[in] payload_length length of the payload
+ */
+static void queue_readings(void *context, void *message_context, const topic_match_t *match, const void *payload, size_t payload_length)
+{
+    worker_pool_t *mqtt_message_processors = (worker_pool_t *) context;
+    broker_t *broker = (broker_t *) message_context;
+    working_queue_t *mqtt_message_queue;
+    unsigned int number_of_readings = payload_readings(payload, payload_length);
+    reading_t first_reading;
+    const char *location;
+    size_t location_length;
+    int64_t location_id;
+    unsigned int i;
+
+    if (!number_of_readings)
+    {
+        return;
+    }
+
+    //All readings of a message come from one location
+    decode_reading(match->topic, payload, payload_length, 0, &first_reading, NULL, &location, &location_length);
+    location_id = location_dictionary_intern(&locations, location, location_length);
+
+    if (location_id < 0)
+    {
+        //The dictionary is full
+        broker->dropped += number_of_readings;
+        return;
+    }
+
+    //The topic carries the location, so all readings from one location go to the same worker
+    mqtt_message_queue = &(get_pool_worker(mqtt_message_processors, topic_segment_hash(match, 0))->working_queue);
+
+    for (i = 0; i < number_of_readings; i++)
+    {
+        //Write the reading directly in the slot at the tail of the FIFO queue
+        reading_t *ambient_data = reserve_work_entry(mqtt_message_queue);
+
+        if (!ambient_data)
+        {
+            //Queue is full and the overflow policy discarded the reading
+            broker->dropped++;
+            continue;
+        }
+
+        //Publishers may send any of the wire formats. The queue entry has room for the probe in the measuring mode.
+        decode_reading(match->topic, payload, payload_length, i, ambient_data,
+                            mqtt_message_queue->entry_size > sizeof(reading_t) ? (probe_t *) (ambient_data + 1) : NULL,
+                            &location, &location_length);
+        ambient_data->location_id = (uint32_t) location_id;
+        ambient_data->reserved = 0;
+
+        commit_work_entry(mqtt_message_queue);
+        broker->readings++;
+    }
+}
+
 /**
  * @brief Call back function for received MQTT message.
  * 
- * Libmosquitto thread will call this function for every received MQTT message.
- * It extracts the payload info from the MQTT message and writes it into the
- * working FIFO queue.
+ * Libmosquitto calls this function from the event loop for every received MQTT message.
+ * It captures the message and dispatches it to the handlers of the matching routes.
  * 
  * @param[in] pointer to libmoquitto MQTT client instance
  * @param[in,out] pointer to the data defined by the Libmosquitto user/caller
@@ -70,37 +305,463 @@ int process_message(void *message)
  */
 void my_message_callback(struct mosquitto *mosq, void *userdata, const struct mosquitto_message *message)
 {
-    ambient_t *ambient_data = calloc(1, sizeof(ambient_t));
+    broker_t *broker = (broker_t *) userdata;
+
+    broker->messages++;
+    broker->bytes += (unsigned long) message->payloadlen;
+
+    if (capture_enabled)
+    {
+        capture_write(&capture, message->topic, message->payload, (uint32_t) message->payloadlen);
+    }
+
+    if (!topic_router_dispatch(&router, message->topic, message->payload, (size_t) message->payloadlen, broker))
+    {
+        broker->unrouted++;
+    }
+}
+
+/**
+ * @brief Libmosquitto calls this function from the event loop when the broker answered the
+ * connection request. The subscription is renewed after every reconnect.
+ */
+static void on_connect(struct mosquitto *mosq, void *userdata, int result)
+{
+    broker_t *broker = (broker_t *) userdata;
+    uint32_t i;
+
+    if (result)
+    {
+        //The event loop keeps trying to reconnect
+        return;
+    }
+
+    broker->connected = true;
+    broker->connections++;
+
+    for (i = 0; i < router.number_of_routes; i++)
+    {
+        mosquitto_subscribe(mosq, NULL, router.routes[i].filter, 0);
+    }
+}
+
+/**
+ * @brief Libmosquitto calls this function from the event loop when the connection is closed.
+ */
+static void on_disconnect(struct mosquitto *mosq, void *userdata, int result)
+{
+    broker_t *broker = (broker_t *) userdata;
+
+    if (broker->connected)
+    {
+        broker->connected = false;
+        broker->disconnects++;
+    }
+}
+
+/**
+ * @brief Splits the comma separated list of brokers, each given as hostname[:port].
+ *
+ * An IPv6 address with a port is written in brackets, [address]:port. An address without
+ * brackets has more than one ':' and is taken without a port.
+ *
+ * @param[in] list list of brokers
+ * @param[in] default_port port of the brokers given without one
+ *
+ * @return 0 on success, -1 for an empty or too long list, an invalid port or an unclosed bracket
+ */
+static int parse_brokers(const char *list, int default_port)
+{
+    char copy[sizeof(((start_arg_t *) 0)->broker_hostname)];
+    char *entry, *port, *end, *save, *bracket;
+    long value;
+
+    brokers = calloc(MAX_BROKERS, sizeof(broker_t));
+    if (!brokers)
+    {
+        return -1;
+    }
+
+    snprintf(copy, sizeof(copy), "%s", list);
+
+    for (entry = strtok_r(copy, ",", &save); entry; entry = strtok_r(NULL, ",", &save))
+    {
+        if (number_of_brokers == MAX_BROKERS)
+        {
+            return -1;
+        }
+
+        brokers[number_of_brokers].port = default_port;
+
+        if (entry[0] == '[')
+        {
+            bracket = strchr(entry, ']');
+
+            if (!bracket || (bracket[1] && (bracket[1] != ':')))
+            {
+                return -1;
+            }
+
+            *bracket = '\0';
+            port = bracket[1] ? bracket + 1 : NULL;
+            entry++;
+        }
+        else
+        {
+            port = strchr(entry, ':');
+            port = (port && !strchr(port + 1, ':')) ? port : NULL;
+        }
+
+        if (port)
+        {
+            *port++ = '\0';
+            value = strtol(port, &end, 10);
+
+            if ((end == port) || *end || (value <= 0) || (value > 65535))
+            {
+                return -1;
+            }
+
+            brokers[number_of_brokers].port = (int) value;
+        }
+
+        if (!entry[0])
+        {
+            return -1;
+        }
+
+        snprintf(brokers[number_of_brokers].hostname, sizeof(brokers[number_of_brokers].hostname), "%s", entry);
+        number_of_brokers++;
+    }
+
+    return number_of_brokers ? 0 : -1;
+}
+
+/**
+ * @brief Conflation key hash of a queued payload: the location id of the reading.
+ */
+static unsigned int ambient_location_hash(const void *message)
+{
+    return ((const reading_t *) message)->location_id;
+}
 
-    memcpy(ambient_data, message->payload, message->payloadlen);
+/**
+ * @brief Tells if two queued payloads come from the same location.
+ */
+static bool ambient_same_location(const void *message, const void *other_message)
+{
+    return ((const reading_t *) message)->location_id == ((const reading_t *) other_message)->location_id;
+}
 
-    working_queue_t *mqtt_message_queue = (working_queue_t *)userdata;
+/**
+ * @brief Sets the queue mode and the overflow policy of the workers from the -o argument:
+ * block, drop-newest, drop-oldest or timeout:<ms>.
+ *
+ * @param[in] overflow_policy value of the -o argument
+ * @param[out] worker_attr worker attributes
+ *
+ * @return 0 on success, -1 for unknown policy
+ */
+static int set_overflow_policy(const char *overflow_policy, worker_attr_t *worker_attr)
+{
+    //The event loop of the main thread is the only producer, so the workers can use the lock-free queue
+    worker_attr->queue_mode = WORKING_QUEUE_MODE_SPSC;
 
-    //Append the message payload at the tail of the FIFO queue
-    add_work_entry(mqtt_message_queue, (void *)ambient_data);
+    if (!strcmp(overflow_policy, "block"))
+    {
+        worker_attr->overflow_policy = WORKING_QUEUE_OVERFLOW_BLOCK;
+    }
+    else if (!strcmp(overflow_policy, "drop-newest"))
+    {
+        worker_attr->overflow_policy = WORKING_QUEUE_OVERFLOW_DROP_NEWEST;
+    }
+    else if (!strcmp(overflow_policy, "drop-oldest"))
+    {
+        //Only the locked queue lets the producer remove waiting entries
+        worker_attr->overflow_policy = WORKING_QUEUE_OVERFLOW_DROP_OLDEST;
+        worker_attr->queue_mode = WORKING_QUEUE_MODE_LOCKED;
+    }
+    else if (!strncmp(overflow_policy, "timeout:", strlen("timeout:")))
+    {
+        worker_attr->overflow_policy = WORKING_QUEUE_OVERFLOW_BLOCK_TIMEOUT;
+        worker_attr->overflow_timeout_ms = (unsigned int) atoi(overflow_policy + strlen("timeout:"));
+    }
+    else
+    {
+        return -1;
+    }
 
-    free(ambient_data);
+    return 0;
 }
 
-static void clean_up_libmosquitto(struct mosquitto *mosq)
+/**
+ * @brief Prints the counters and histograms of every worker on the standard error output.
+ *
+ * @param[in] mqtt_message_processors pool of workers
+ */
+static void print_worker_stats(worker_pool_t *mqtt_message_processors)
 {
-    mosquitto_destroy(mosq);
+    static worker_stats_t stats;    /**< Too big for the stack of the main thread. */
+    unsigned int i;
+
+    for (i = 0; i < mqtt_message_processors->number_of_workers; i++)
+    {
+        get_worker_stats(mqtt_message_processors->workers[i], &stats);
+
+        fprintf(stderr, "worker %u: enqueued %lu, dequeued %lu, conflated %lu, dropped %lu/%lu/%lu (newest/oldest/timeout), "
+                        "depth max %u p50 %llu p99 %llu, blocked %lu times %.3f ms, "
+                        "latency p50 %.1f p99 %.1f p999 %.1f us, work p50 %.1f p99 %.1f max %.1f us\n",
+                    i,
+                    stats.enqueued, stats.dequeued, stats.conflated,
+                    stats.dropped_newest, stats.dropped_oldest, stats.timeouts,
+                    stats.high_water_mark,
+                    (unsigned long long) histogram_percentile(&stats.queue_depth, 50),
+                    (unsigned long long) histogram_percentile(&stats.queue_depth, 99),
+                    stats.blocked, stats.blocked_ns / 1e6,
+                    histogram_percentile(&stats.queue_latency, 50) / 1e3,
+                    histogram_percentile(&stats.queue_latency, 99) / 1e3,
+                    histogram_percentile(&stats.queue_latency, 99.9) / 1e3,
+                    histogram_percentile(&stats.processing_time, 50) / 1e3,
+                    histogram_percentile(&stats.processing_time, 99) / 1e3,
+                    stats.processing_time.max / 1e3
+                );
+    }
+
+    for (i = 0; i < number_of_brokers; i++)
+    {
+        //IPv6 addresses in brackets, as they are given with -b
+        fprintf(stderr, "broker %s%s%s:%d: %s, connections %lu, disconnects %lu, messages %lu, unrouted %lu, readings %lu, dropped %lu, bytes %lu\n",
+                    strchr(brokers[i].hostname, ':') ? "[" : "", brokers[i].hostname, strchr(brokers[i].hostname, ':') ? "]" : "", brokers[i].port, brokers[i].connected ? "connected" : "disconnected",
+                    brokers[i].connections, brokers[i].disconnects, brokers[i].messages, brokers[i].unrouted,
+                    brokers[i].readings, brokers[i].dropped, brokers[i].bytes
+                );
+    }
+
+    fprintf(stderr, "output: written %lu bytes in %lu writes, failed %lu, waited for the writer %lu times\n",
+                __atomic_load_n(&output.bytes, __ATOMIC_RELAXED),
+                __atomic_load_n(&output.writes, __ATOMIC_RELAXED),
+                __atomic_load_n(&output.errors, __ATOMIC_RELAXED),
+                __atomic_load_n(&output.stalls, __ATOMIC_RELAXED)
+            );
+
+    if (store_enabled)
+    {
+        fprintf(stderr, "store: appended %lu records, recovered %lu, segment %u, %u locations\n",
+                    __atomic_load_n(&store.appended, __ATOMIC_RELAXED),
+                    store.recovered,
+                    __atomic_load_n(&store.segment, __ATOMIC_RELAXED),
+                    __atomic_load_n(&store.number_of_locations, __ATOMIC_RELAXED)
+                );
+    }
+}
+
+/**
+ * @brief Prints the latency and loss measured since the start as one JSON line on the standard output.
+ *
+ * @param[in] interval seconds since the previous report
+ */
+static void print_measurement(unsigned int interval)
+{
+    static unsigned long previous_received;
+    unsigned long received = __atomic_load_n(&measurement.received, __ATOMIC_RELAXED);
+    unsigned long lost = 0;
+    unsigned int publishers = 0;
+    uint32_t next_sequence, received_from;
+    unsigned int i;
+
+    for (i = 0; i < MEASURE_MAX_PUBLISHERS; i++)
+    {
+        received_from = __atomic_load_n(&measurement.received_from[i], __ATOMIC_RELAXED);
+        next_sequence = __atomic_load_n(&measurement.next_sequence[i], __ATOMIC_RELAXED);
+
+        if (received_from)
+        {
+            publishers++;
+            lost += next_sequence > received_from ? next_sequence - received_from : 0;
+        }
+    }
+
+    printf("{\"publishers\":%u,\"received\":%lu,\"rate\":%.1f,\"lost\":%lu,\"out_of_order\":%lu,\"without_probe\":%lu,"
+           "\"latency_ns\":{\"p50\":%llu,\"p99\":%llu,\"p999\":%llu,\"max\":%llu}}\n",
+                publishers, received, (double) (received - previous_received) / interval, lost,
+                __atomic_load_n(&measurement.out_of_order, __ATOMIC_RELAXED),
+                __atomic_load_n(&measurement.without_probe, __ATOMIC_RELAXED),
+                (unsigned long long) histogram_percentile(&measurement.latency, 50),
+                (unsigned long long) histogram_percentile(&measurement.latency, 99),
+                (unsigned long long) histogram_percentile(&measurement.latency, 99.9),
+                (unsigned long long) __atomic_load_n(&measurement.latency.max, __ATOMIC_RELAXED)
+            );
+    fflush(stdout);
+
+    previous_received = received;
+}
+
+/**
+ * @brief Publishes the statistics of every aggregation window of every location as one JSON
+ * message on the topic home/<location>/ambient_stats. The messages are retained, so a new
+ * subscriber gets the latest statistics at once.
+ *
+ * @param[in] mosq libmosquitto client instance
+ */
+static void publish_aggregates(struct mosquitto *mosq)
+{
+    static const char *value_names[AGGREGATOR_VALUES] = { "temperature", "pressure", "humidity" };
+    aggregate_t aggregates[AGGREGATOR_MAX_WINDOWS];
+    const char *location;
+    char topic[sizeof(((ambient_t *) 0)->location) + 32];
+    char payload[2048];
+    size_t length;
+    unsigned int w, v;
+    uint32_t i, number_of_locations = location_dictionary_size(&locations);
+
+    for (i = 0; i < number_of_locations; i++)
+    {
+        if (aggregator_get(&aggregator, i, aggregates))
+        {
+            continue;
+        }
+
+        location = location_dictionary_name(&locations, i);
+        length = snprintf(payload, sizeof(payload), "{\"location\":\"%s\",\"windows\":[", location);
+
+        for (w = 0; (w < aggregator.number_of_windows) && (length < sizeof(payload)); w++)
+        {
+            length += snprintf(payload + length, sizeof(payload) - length, "%s{\"seconds\":%u,\"count\":%lu",
+                                    w ? "," : "", aggregates[w].seconds, aggregates[w].count);
+
+            for (v = 0; (v < AGGREGATOR_VALUES) && (length < sizeof(payload)); v++)
+            {
+                length += snprintf(payload + length, sizeof(payload) - length, ",\"%s\":{\"min\":%.2f,\"max\":%.2f,\"mean\":%.2f,\"stddev\":%.3f}",
+                                        value_names[v], aggregates[w].min[v], aggregates[w].max[v], aggregates[w].mean[v], aggregates[w].stddev[v]);
+            }
+
+            if (length < sizeof(payload))
+            {
+                length += snprintf(payload + length, sizeof(payload) - length, "}");
+            }
+        }
+
+        if (length < sizeof(payload))
+        {
+            length += snprintf(payload + length, sizeof(payload) - length, "]}");
+        }
+
+        //A location name too long for the payload or the topic is not published
+        if ((length >= sizeof(payload)) || (snprintf(topic, sizeof(topic), "home/%s/ambient_stats", location) >= (int) sizeof(topic)))
+        {
+            continue;
+        }
+
+        mosquitto_publish(mosq, NULL, topic, (int) length, payload, 0, true);
+    }
+}
+
+/**
+ * @brief Prints the reports and publishes the statistics that are due. Called by the event loop
+ * every second.
+ */
+static void run_periodic_reports(event_loop_t *loop, event_loop_source_t *source, uint32_t events)
+{
+    periodic_reports_t *reports = (periodic_reports_t *) source->context;
+    const start_arg_t *start_arg = reports->start_arg;
+
+    reports->elapsed_seconds++;
+
+    if (start_arg->stats_interval && !(reports->elapsed_seconds % start_arg->stats_interval))
+    {
+        print_worker_stats(reports->processors);
+    }
+
+    if (start_arg->measure && !(reports->elapsed_seconds % reports->measure_interval))
+    {
+        print_measurement(reports->measure_interval);
+    }
+
+    if (start_arg->aggregate_interval && !(reports->elapsed_seconds % start_arg->aggregate_interval))
+    {
+        publish_aggregates(reports->mosq);
+    }
+}
+
+/**
+ * @brief Handler of SIGINT and SIGTERM. Stops the event loop of the main thread, which then
+ * stops the subscriber.
+ */
+static void stop_subscriber(int signal_number)
+{
+    event_loop_stop(&loop);
+}
+
+/**
+ * @brief Writes the rest of the output, closes the store and frees the aggregator and the location
+ * dictionary. Called after the workers stopped.
+ */
+static void clean_up_output(void)
+{
+    output_sink_close(&output);
+
+    if (store_enabled)
+    {
+        store_close(&store);
+        store_enabled = false;
+    }
+
+    if (aggregator_enabled)
+    {
+        aggregator_clean_up(&aggregator);
+        aggregator_enabled = false;
+    }
+
+    location_dictionary_clean_up(&locations);
+}
+
+/**
+ * @brief Destroys the clients of all brokers and the routes of their subscriptions. Called after
+ * the clients were removed from the event loop.
+ */
+static void clean_up_libmosquitto(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < number_of_brokers; i++)
+    {
+        if (brokers[i].mosq)
+        {
+            mosquitto_destroy(brokers[i].mosq);
+        }
+    }
+
+    free(brokers);
+    brokers = NULL;
+    number_of_brokers = 0;
+
+    topic_router_clean_up(&router);
+
     mosquitto_lib_cleanup();
 }
 
 int main(int argc, char *argv[])
 {
-    struct mosquitto *mosq = NULL;  /**< Libmosquito MQTT client instance. */
 
-    sem_t blocking_sem;                         /**< Semaphore for blocking the main thread execution. */
+    struct sigaction stop_action;               /**< Handler of the signals stopping the subscriber. */
+    event_loop_source_t reports_timer;          /**< Timer of the periodic reports. */
+    periodic_reports_t reports;                 /**< State of the periodic reports. */
+    bool periodic;                           /**< Main thread wakes up every second for the periodic reports. */
+    unsigned int window_seconds[AGGREGATOR_MAX_WINDOWS];      /**< Lengths of the aggregation windows. */
+    int number_of_windows;
+    unsigned int i;
 
     start_arg_t start_arg = {                   /**< Command line arguments will be stored here. */
         .broker_hostname = "localhost",
-        .broker_port = 1883
+        .broker_port = 1883,
+        .number_of_workers = 1,
+        .queue_size = 32
     };
 	
-    worker_t *mqtt_message_processor = NULL;                   /**< Thread for processing received payload from all publishers. */
-    working_queue_t *mqtt_message_queue = NULL;         /**< FIFO queue for payloads.*/
+    worker_pool_t *mqtt_message_processors = NULL;        /**< Threads for processing received payload from all publishers. */
+    worker_attr_t worker_attr;                                       /**< Properties of the worker thread and its queue. */
+    worker_thread_attr_t network_thread;                             /**< Affinity and scheduling of the main thread running the event loop. */
+    output_sink_target_t output_target;                              /**< Destination of the printed payloads. */
 
 #ifdef __SHOW_MOSQUITTO_INFO__    
     int major, minor, revision;
@@ -113,68 +774,264 @@ int main(int argc, char *argv[])
     //Processing command line arguments if any
     process_arguments(argc, argv, &start_arg);
 
-    //Create a working thread used by the subscriber for processing the received MQTT messages. 
-    if (create_worker(&mqtt_message_processor, 32, sizeof(ambient_t), process_message))
+    worker_attr_init(&worker_attr);
+    worker_attr.working_queue_size = start_arg.queue_size;
+    worker_attr.working_queue_entry_size = sizeof(reading_t);
+    worker_attr.do_work_batch = process_messages;
+    worker_attr.collect_stats = (start_arg.stats_interval != 0);
+
+    if (start_arg.measure)
+    {
+        //The queue entries carry the probe behind the payload
+        worker_attr.working_queue_entry_size = sizeof(reading_t) + sizeof(probe_t);
+        worker_attr.do_work_batch = measure_messages;
+        histogram_init(&measurement.latency);
+    }
+
+    memset(&reports, 0, sizeof(reports));
+    reports.start_arg = &start_arg;
+    reports.measure_interval = start_arg.stats_interval ? start_arg.stats_interval : 1;
+    periodic = start_arg.stats_interval || start_arg.measure || start_arg.aggregate_interval;
+
+    //A blocked event loop stalls the reads and keepalives of every broker, so with a list of
+    //brokers a full queue is waited for only a bounded time by default
+    if (!start_arg.overflow_policy[0] && strchr(start_arg.broker_hostname, ','))
+    {
+        snprintf(start_arg.overflow_policy, sizeof(start_arg.overflow_policy), "timeout:%u", MULTI_BROKER_OVERFLOW_TIMEOUT_MS);
+    }
+    else if (!start_arg.overflow_policy[0])
+    {
+        snprintf(start_arg.overflow_policy, sizeof(start_arg.overflow_policy), "block");
+    }
+
+    if (set_overflow_policy(start_arg.overflow_policy, &worker_attr))
     {
-        printf("Error: creating worker thread for processing MQTT messages failed\n");
+        printf("Error: unknown queue overflow policy %s\n", start_arg.overflow_policy);
         return -1;
     }
 
-    //FIFO queue for the payload from MQTT messages received by the subscriber. Worker thread will process the items as they land in the queue.
-    mqtt_message_queue = &mqtt_message_processor->working_queue;
+    if (start_arg.conflate)
+    {
+        //A waiting reading is replaced by a newer one from the same location, so a slow
+        //consumer prints only the latest state. The producer has to reach waiting entries.
+        worker_attr.queue_mode = WORKING_QUEUE_MODE_LOCKED;
+        worker_attr.conflation_hash = ambient_location_hash;
+        worker_attr.conflation_equal = ambient_same_location;
+    }
+
+    //The workers are named mqtt_sub_w<index> in top -H. The event loop runs in the main thread,
+    //which keeps the name of the process.
+    memset(&network_thread, 0, sizeof(network_thread));
+    snprintf(worker_attr.thread.name, sizeof(worker_attr.thread.name), "mqtt_sub_w");
+
+    if (worker_cpus_from_string(start_arg.worker_cpus, &(worker_attr.thread)) ||
+        worker_cpus_from_string(start_arg.network_cpus, &network_thread))
+    {
+        printf("Error: invalid list of CPUs %s %s\n", start_arg.worker_cpus, start_arg.network_cpus);
+        return -1;
+    }
+
+    if (worker_scheduling_from_string(start_arg.scheduling, &(worker_attr.thread)) ||
+        worker_scheduling_from_string(start_arg.scheduling, &network_thread))
+    {
+        printf("Error: invalid scheduling %s, use fifo:<priority>, rr:<priority> or other\n", start_arg.scheduling);
+        return -1;
+    }
+
+    //The workers format the payloads into the sink, its own thread writes them out
+    output_sink_target_from_string(start_arg.output, &output_target);
+
+    if (location_dictionary_init(&locations))
+    {
+        printf("Error: creating the location dictionary failed\n");
+        return -1;
+    }
+
+    if (output_sink_open(&output, output_target, start_arg.output, 0, 0))
+    {
+        printf("Error: opening the output %s failed\n", start_arg.output);
+        location_dictionary_clean_up(&locations);
+        return -1;
+    }
+
+    if (start_arg.store_directory[0])
+    {
+        if (store_open(&store, start_arg.store_directory, 0, &locations))
+        {
+            printf("Error: opening the store in %s failed\n", start_arg.store_directory);
+            output_sink_close(&output);
+            location_dictionary_clean_up(&locations);
+            return -1;
+        }
+
+        store_enabled = true;
+    }
+
+    if (start_arg.aggregate_interval)
+    {
+        number_of_windows = aggregator_windows_from_string(start_arg.aggregate_windows, window_seconds);
+
+        if ((number_of_windows < 0) || aggregator_init(&aggregator, window_seconds, (unsigned int) number_of_windows))
+        {
+            printf("Error: invalid aggregation windows %s\n", start_arg.aggregate_windows);
+            clean_up_output();
+            return -1;
+        }
+
+        aggregator_enabled = true;
+    }
+
+    //Create working threads used by the subscriber for processing the received MQTT messages.
+    //Each of them has a FIFO queue for the payloads and processes the items as they land in it.
+    if (create_worker_pool(&mqtt_message_processors, start_arg.number_of_workers, &worker_attr, NULL))
+    {
+        printf("Error: creating worker threads for processing MQTT messages failed%s\n",
+                    worker_attr.thread.sched_policy != SCHED_OTHER ? ", real-time scheduling needs CAP_SYS_NICE or RLIMIT_RTPRIO" : "");
+        clean_up_output();
+        return -1;
+    }
+
+    //Set after the workers were created, so they do not inherit the affinity of the event loop
+    if (worker_thread_attr_apply(pthread_self(), &network_thread))
+    {
+        printf("Error: setting the CPUs or the scheduling of the event loop thread failed\n");
+        stop_worker_pool(mqtt_message_processors);
+        worker_pool_clean_up(&mqtt_message_processors);
+        clean_up_output();
+        return -1;
+    }
 
     //libmosquitto initialization
     mosquitto_lib_init();
 
-    //Init the semaphore
-    sem_init(&blocking_sem, 0, 0);
+    if (event_loop_init(&loop))
+    {
+        printf("Error: creating the event loop failed\n");
+        stop_worker_pool(mqtt_message_processors);
+        worker_pool_clean_up(&mqtt_message_processors);
+        clean_up_output();
+        mosquitto_lib_cleanup();
+        return -1;
+    }
+
+    //SIGINT and SIGTERM stop the event loop, then the main thread writes the rest of the output, the store and the capture
+    memset(&stop_action, 0, sizeof(stop_action));
+    stop_action.sa_handler = stop_subscriber;
+    sigaction(SIGINT, &stop_action, NULL);
+    sigaction(SIGTERM, &stop_action, NULL);
+
+    if (start_arg.capture_file[0])
+    {
+        if (capture_create(&capture, start_arg.capture_file))
+        {
+            printf("Error: creating the capture file %s failed\n", start_arg.capture_file);
+            event_loop_clean_up(&loop);
+            stop_worker_pool(mqtt_message_processors);
+            worker_pool_clean_up(&mqtt_message_processors);
+            clean_up_output();
+            return -1;
+        }
+
+        capture_enabled = true;
+    }
 	
-    //Create new libmosquitto client instance
-    mosq = mosquitto_new(NULL, true, mqtt_message_queue);
+    //The readings of every location go to the shared worker pool. Further routes, each with
+    //its own handler and workers, are added here and subscribed on every broker.
+    if (topic_router_init(&router) || topic_router_add(&router, SUBSCRIPTION, queue_readings, mqtt_message_processors))
+    {
+        printf("Error: creating the topic routes failed\n");
+        event_loop_clean_up(&loop);
+        stop_worker_pool(mqtt_message_processors);
+        worker_pool_clean_up(&mqtt_message_processors);
+        clean_up_output();
+        clean_up_libmosquitto();
+        return -1;
+    }
 
-    if (!mosq)
+    if (parse_brokers(start_arg.broker_hostname, start_arg.broker_port))
     {
-        printf("Error: failed to create mosquitto client\n");
+        printf("Error: invalid list of brokers %s\n", start_arg.broker_hostname);
+        event_loop_clean_up(&loop);
+        stop_worker_pool(mqtt_message_processors);
+        worker_pool_clean_up(&mqtt_message_processors);
+        clean_up_output();
+        clean_up_libmosquitto();
+        return -1;
     }
 
-    //Define a function which will be called by libmosquitto client every time when there is a new MQTT message
-    mosquitto_message_callback_set(mosq, my_message_callback);
-	
-    //Connect to MQTT broker
-    if (mosquitto_connect(mosq, start_arg.broker_hostname, start_arg.broker_port, 60) != MOSQ_ERR_SUCCESS)
+    //One client for every broker, all serviced by the event loop of the main thread
+    for (i = 0; i < number_of_brokers; i++)
     {
-        printf("Error: connecting to MQTT broker failed\n");
+        brokers[i].mosq = mosquitto_new(NULL, true, &brokers[i]);
 
-        stop_worker(mqtt_message_processor);
-        worker_clean_up(&mqtt_message_processor);
+        if (!brokers[i].mosq)
+        {
+            printf("Error: failed to create mosquitto client\n");
 
-        clean_up_libmosquitto(mosq);
+            for (; i > 0; i--)
+            {
+                event_loop_remove(&loop, &(brokers[i - 1].source));
+            }
 
-        exit(-1);
+            event_loop_clean_up(&loop);
+            stop_worker_pool(mqtt_message_processors);
+            worker_pool_clean_up(&mqtt_message_processors);
+            clean_up_output();
+            clean_up_libmosquitto();
+            return -1;
+        }
+
+        //Define a function which will be called by libmosquitto client every time when there is a new MQTT message
+        mosquitto_message_callback_set(brokers[i].mosq, my_message_callback);
+        mosquitto_connect_callback_set(brokers[i].mosq, on_connect);
+        mosquitto_disconnect_callback_set(brokers[i].mosq, on_disconnect);
+
+        //A broker that is not reachable now is retried by the event loop, the others are not held up
+        if (mosquitto_connect_async(brokers[i].mosq, brokers[i].hostname, brokers[i].port, 60) != MOSQ_ERR_SUCCESS)
+        {
+            printf("Warning: connecting to MQTT broker %s:%d failed, retrying\n", brokers[i].hostname, brokers[i].port);
+        }
+
+        event_loop_add_client(&loop, &(brokers[i].source), brokers[i].mosq);
     }
 
-    //Subscribe to any channel that ends with ambient_data
-    mosquitto_subscribe(mosq, NULL, "home/+/ambient_data", 0);
+    if (periodic)
+    {
+        reports.processors = mqtt_message_processors;
+        reports.mosq = brokers[0].mosq;
+        event_loop_add_timer(&loop, &reports_timer, monotonic_time_ns() + 1000000000ull, 1000000000ull, run_periodic_reports, &reports);
+    }
 
-    //Run libmosquitto client in a separate thread
-    mosquitto_loop_start(mosq);
-	
-    while(1)
+    event_loop_run(&loop);
+
+    //Stop receiving first, so no reading is queued to a stopped worker
+    for (i = 0; i < number_of_brokers; i++)
+    {
+        event_loop_remove(&loop, &(brokers[i].source));
+        mosquitto_disconnect(brokers[i].mosq);
+    }
+
+    if (periodic)
+    {
+        event_loop_remove(&loop, &reports_timer);
+    }
+
+    event_loop_clean_up(&loop);
+
+    if (capture_enabled)
     {
-        //Block the execution of the main thread
-        sem_wait(&blocking_sem);
-        break;
+        capture_close(&capture);
     }
 
-    //Stop the worker thread
-    stop_worker(mqtt_message_processor);
+    //Stop the worker threads, they process the readings left in their queues
+    stop_worker_pool(mqtt_message_processors);
 
-    //Stop libmosquitto cliet thread
-    mosquitto_loop_stop(mosq, true);
+    //Workers clean up
+    worker_pool_clean_up(&mqtt_message_processors);
 
-    //Worker clean up
-    worker_clean_up(&mqtt_message_processor);
+    //Write the rest of the output and the store
+    clean_up_output();
 
     //Clean up/destroy objects created by libmosquitto
-    clean_up_libmosquitto(mosq);
+    clean_up_libmosquitto();
 }
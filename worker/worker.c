@@ -19,103 +19,1068 @@
 * 
 */
 
+//CPU affinity and thread names are GNU extensions
+#define _GNU_SOURCE
+
 #include <pthread.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <sched.h>
 #include <errno.h>
+#include <time.h>
+
+#include "worker.h"
+
+
+/**
+ * @brief Woker thread function.
+ *  
+ * @param[in] arguments provided to the thread when created
+ * 
+ * @return void pointer
+ */
+static void *worker_thread(void *worker_thread_arguments);
+
+
+/**
+ * @brief Returns the monotonic time in ns.
+ */
+static inline uint64_t now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+
+int create_worker(worker_t **worker, unsigned int working_queue_size, unsigned int working_queue_entry_size, do_work_f do_work)
+{
+    worker_attr_t attr;
+
+    worker_attr_init(&attr);
+
+    attr.working_queue_size = working_queue_size;
+    attr.working_queue_entry_size = working_queue_entry_size;
+    attr.do_work = do_work;
+
+    return create_worker_with_attr(worker, &attr);
+}
+
+
+void worker_attr_init(worker_attr_t *attr)
+{
+    memset(attr, 0, sizeof(worker_attr_t));
+
+    attr->queue_mode = WORKING_QUEUE_MODE_LOCKED;
+    attr->overflow_policy = WORKING_QUEUE_OVERFLOW_BLOCK;
+}
+
+
+int worker_cpus_from_string(const char *list, worker_thread_attr_t *thread)
+{
+    unsigned long first, last;
+    char *end;
+
+    memset(thread->cpus, 0, sizeof(thread->cpus));
+
+    while (*list)
+    {
+        first = strtoul(list, &end, 10);
+        last = first;
+
+        if (end == list)
+        {
+            return -1;
+        }
+
+        if (*end == '-')
+        {
+            list = end + 1;
+            last = strtoul(list, &end, 10);
+
+            if ((end == list) || (last < first))
+            {
+                return -1;
+            }
+        }
+
+        if (last >= WORKER_MAX_CPUS)
+        {
+            return -1;
+        }
+
+        for (; first <= last; first++)
+        {
+            thread->cpus[first / 64] |= 1ull << (first % 64);
+        }
+
+        if (*end == ',')
+        {
+            end++;
+        }
+        else if (*end)
+        {
+            return -1;
+        }
+
+        list = end;
+    }
+
+    return 0;
+}
+
+
+int worker_scheduling_from_string(const char *scheduling, worker_thread_attr_t *thread)
+{
+    const char *priority;
+    char *end;
+    long value;
+
+    thread->sched_policy = SCHED_OTHER;
+    thread->sched_priority = 0;
+
+    if (!scheduling[0] || !strcmp(scheduling, "other"))
+    {
+        return 0;
+    }
+
+    if (!strncmp(scheduling, "fifo:", 5))
+    {
+        thread->sched_policy = SCHED_FIFO;
+    }
+    else if (!strncmp(scheduling, "rr:", 3))
+    {
+        thread->sched_policy = SCHED_RR;
+    }
+    else
+    {
+        return -1;
+    }
+
+    priority = strchr(scheduling, ':') + 1;
+    value = strtol(priority, &end, 10);
+
+    if ((end == priority) || *end || (value < sched_get_priority_min(thread->sched_policy)) || (value > sched_get_priority_max(thread->sched_policy)))
+    {
+        thread->sched_policy = SCHED_OTHER;
+        return -1;
+    }
+
+    thread->sched_priority = (int) value;
+
+    return 0;
+}
+
+
+/**
+ * @brief Converts the CPU mask of the thread attributes.
+ *
+ * @return true if the mask selects any CPU
+ */
+static bool thread_cpu_set(const worker_thread_attr_t *thread, cpu_set_t *cpu_set)
+{
+    unsigned int cpu;
+    bool any = false;
+
+    CPU_ZERO(cpu_set);
+
+    for (cpu = 0; (cpu < WORKER_MAX_CPUS) && (cpu < CPU_SETSIZE); cpu++)
+    {
+        if (thread->cpus[cpu / 64] & (1ull << (cpu % 64)))
+        {
+            CPU_SET(cpu, cpu_set);
+            any = true;
+        }
+    }
+
+    return any;
+}
+
+
+int worker_thread_attr_apply(pthread_t thread_id, const worker_thread_attr_t *thread)
+{
+    struct sched_param param;
+    cpu_set_t cpu_set;
+    int rc = 0;
+
+    if (thread_cpu_set(thread, &cpu_set) && pthread_setaffinity_np(thread_id, sizeof(cpu_set), &cpu_set))
+    {
+        rc = -1;
+    }
+
+    if (thread->sched_policy != SCHED_OTHER)
+    {
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = thread->sched_priority;
+
+        if (pthread_setschedparam(thread_id, thread->sched_policy, &param))
+        {
+            rc = -1;
+        }
+    }
+
+    if (thread->name[0] && pthread_setname_np(thread_id, thread->name))
+    {
+        rc = -1;
+    }
+
+    return rc;
+}
+
+
+/**
+ * @brief Returns the smallest power of two that is not less than the requested queue size.
+ * The size is at most WORKING_QUEUE_MAX_SIZE.
+ */
+static unsigned int queue_capacity(unsigned int working_queue_size)
+{
+    unsigned int capacity = 1;
+
+    while (capacity < working_queue_size)
+    {
+        capacity <<= 1;
+    }
+
+    return capacity;
+}
+
+
+/**
+ * @brief Frees the worker object together with the queue storage.
+ */
+static void free_worker_memory(worker_t *worker)
+{
+    free(worker->working_queue.entry);
+    free(worker->working_queue.enqueue_time);
+    free(worker->working_queue.entry_hash);
+    free(worker->working_queue.pending_index);
+    free(worker->working_queue.staging);
+    free(worker->batch);
+    free(worker);
+}
+
+
+int create_worker_with_attr(worker_t **worker, const worker_attr_t *attr)
+{
+    if (*worker)
+    {
+        //Worker already created/exists.
+        return -1;
+    }
+
+    if ((attr->queue_mode == WORKING_QUEUE_MODE_SPSC) && (attr->overflow_policy == WORKING_QUEUE_OVERFLOW_DROP_OLDEST))
+    {
+        //Only the worker thread moves the head of the SPSC ring
+        return -1;
+    }
+
+    if (attr->conflation_hash && ((attr->queue_mode == WORKING_QUEUE_MODE_SPSC) || !attr->conflation_equal))
+    {
+        //Producer can not overwrite the waiting entries of the SPSC ring
+        return -1;
+    }
+
+    if (attr->working_queue_size > WORKING_QUEUE_MAX_SIZE)
+    {
+        printf("Error: queue size %u is above the maximum %u\n", attr->working_queue_size, WORKING_QUEUE_MAX_SIZE);
+        return -1;
+    }
+
+    pthread_attr_t attr_thread;
+    pthread_condattr_t attr_cond;
+    struct sched_param param;
+    cpu_set_t cpu_set;
+	
+    int rc;
+
+    //Keep the SPSC indices on their own cache lines
+    if (posix_memalign((void **)worker, WORKING_QUEUE_CACHE_LINE_SIZE, sizeof(worker_t)))
+    {
+        *worker = NULL;
+        return -1;
+    }
+
+    memset(*worker, 0, sizeof(worker_t));
+
+    (*worker)->working_queue.mode = attr->queue_mode;
+    (*worker)->working_queue.overflow_policy = attr->overflow_policy;
+    (*worker)->working_queue.overflow_timeout_ms = attr->overflow_timeout_ms;
+    (*worker)->working_queue.head = 0;
+    (*worker)->working_queue.number_of_entries = 0;
+    (*worker)->working_queue.tail = 0;
+    (*worker)->working_queue.entry_size = attr->working_queue_entry_size;
+    (*worker)->working_queue.max_queue_size = queue_capacity(attr->working_queue_size);
+    (*worker)->working_queue.entry = calloc((*worker)->working_queue.max_queue_size, attr->working_queue_entry_size);
+    (*worker)->stop_working = false;
+    (*worker)->do_work = attr->do_work;
+    (*worker)->do_work_batch = attr->do_work_batch;
+    (*worker)->max_batch_size = (attr->max_batch_size && attr->max_batch_size < (*worker)->working_queue.max_queue_size) ? attr->max_batch_size : (*worker)->working_queue.max_queue_size;
+    (*worker)->collect_stats = attr->collect_stats;
+
+    if (attr->collect_stats)
+    {
+        (*worker)->working_queue.enqueue_time = calloc((*worker)->working_queue.max_queue_size, sizeof(uint64_t));
+    }
+
+    //Producers can remove waiting entries, so the worker has to take its entries out of the queue
+    if (attr->overflow_policy == WORKING_QUEUE_OVERFLOW_DROP_OLDEST)
+    {
+        (*worker)->batch = calloc((*worker)->max_batch_size, attr->working_queue_entry_size);
+    }
+
+    //Index of the waiting entries is kept at most half full
+    if (attr->conflation_hash)
+    {
+        (*worker)->working_queue.conflation_hash = attr->conflation_hash;
+        (*worker)->working_queue.conflation_equal = attr->conflation_equal;
+        (*worker)->working_queue.pending_index_size = (*worker)->working_queue.max_queue_size << 1;
+        (*worker)->working_queue.entry_hash = calloc((*worker)->working_queue.max_queue_size, sizeof(unsigned int));
+        (*worker)->working_queue.pending_index = calloc((*worker)->working_queue.pending_index_size, sizeof(pending_index_slot_t));
+        (*worker)->working_queue.staging = calloc(1, attr->working_queue_entry_size);
+    }
+
+    if (!(*worker)->working_queue.entry || ((attr->overflow_policy == WORKING_QUEUE_OVERFLOW_DROP_OLDEST) && !(*worker)->batch) || (attr->collect_stats && !(*worker)->working_queue.enqueue_time) ||
+        (attr->conflation_hash && (!(*worker)->working_queue.entry_hash || !(*worker)->working_queue.pending_index || !(*worker)->working_queue.staging)))
+    {
+        free_worker_memory(*worker);
+        *worker = NULL;
+        return -1;
+    }
+
+    //Init the objects for synchronisation of the threds
+    pthread_mutex_init(&((*worker)->working_queue.access), NULL);
+    pthread_cond_init(&((*worker)->working_queue.not_empty), NULL);
+    pthread_cond_init(&((*worker)->working_queue.empty), NULL);
+
+    //Timed waits for a free slot are measured on the monotonic clock
+    pthread_condattr_init(&attr_cond);
+    pthread_condattr_setclock(&attr_cond, CLOCK_MONOTONIC);
+    pthread_cond_init(&((*worker)->working_queue.not_full), &attr_cond);
+    pthread_condattr_destroy(&attr_cond);
+
+    pthread_attr_init(&attr_thread);
+
+    pthread_attr_setdetachstate(&attr_thread, PTHREAD_CREATE_JOINABLE);
+
+    //The thread inherits the scheduling of the calling thread, unless a real-time policy is given.
+    //The policy is set before the start, so the first entries are already processed with it.
+    if (attr->thread.sched_policy != SCHED_OTHER)
+    {
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = attr->thread.sched_priority;
+
+        pthread_attr_setinheritsched(&attr_thread, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&attr_thread, attr->thread.sched_policy);
+        pthread_attr_setschedparam(&attr_thread, &param);
+    }
+    else
+    {
+        pthread_attr_setinheritsched(&attr_thread, PTHREAD_INHERIT_SCHED);
+    }
+
+    if (thread_cpu_set(&(attr->thread), &cpu_set))
+    {
+        pthread_attr_setaffinity_np(&attr_thread, sizeof(cpu_set), &cpu_set);
+    }
+
+    //Start the worker thread
+    rc = pthread_create(&((*worker)->working_thread), &attr_thread, worker_thread, *worker);
+    if (rc != 0)
+    {
+        //pthread_create() returns the error instead of setting errno
+        printf("Error: creating the worker thread failed: %s\n", strerror(rc));
+        worker_clean_up(worker);
+        rc = -1;
+    }
+    else if (attr->thread.name[0])
+    {
+        //The name only helps the tools, a failure does not stop the worker
+        pthread_setname_np((*worker)->working_thread, attr->thread.name);
+    }
+
+    pthread_attr_destroy(&attr_thread);
+
+    return rc;
+}
+
+
+/**
+ * @brief Returns pointer to the slot for the entry with the given free running index.
+ */
+static inline void *queue_slot(const working_queue_t *working_queue, unsigned int index)
+{
+    //Queues of 4 GiB and more need the offset in size_t
+    return working_queue->entry + ((size_t) (index & (working_queue->max_queue_size - 1)) * working_queue->entry_size);
+}
+
+
+/**
+ * @brief Looks up the waiting entry with the same conflation key as the given entry. Caller holds the queue lock.
+ *
+ * @return index of the slot in the pending index, -1 if no entry with the key is waiting
+ */
+static int pending_index_find(const working_queue_t *working_queue, unsigned int hash, const void *entry)
+{
+    unsigned int mask = working_queue->pending_index_size - 1;
+    unsigned int i;
+
+    for (i = hash & mask; working_queue->pending_index[i].used; i = (i + 1) & mask)
+    {
+        if ((working_queue->pending_index[i].hash == hash) &&
+            working_queue->conflation_equal(queue_slot(working_queue, working_queue->pending_index[i].position), entry))
+        {
+            return (int) i;
+        }
+    }
+
+    return -1;
+}
+
+
+/**
+ * @brief Adds the entry with the given free running index to the pending index. Caller holds the queue lock.
+ */
+static void pending_index_insert(working_queue_t *working_queue, unsigned int hash, unsigned int position)
+{
+    unsigned int mask = working_queue->pending_index_size - 1;
+    unsigned int i;
+
+    for (i = hash & mask; working_queue->pending_index[i].used; i = (i + 1) & mask);
+
+    working_queue->entry_hash[position & (working_queue->max_queue_size - 1)] = hash;
+    working_queue->pending_index[i].hash = hash;
+    working_queue->pending_index[i].position = position;
+    working_queue->pending_index[i].used = true;
+}
+
+
+/**
+ * @brief Removes the entry with the given free running index from the pending index, if it is
+ * still there. Caller holds the queue lock.
+ *
+ * The following slots of the probe sequence are shifted back, so lookups need no tombstones.
+ */
+static void pending_index_remove(working_queue_t *working_queue, unsigned int position)
+{
+    pending_index_slot_t *index = working_queue->pending_index;
+    unsigned int mask = working_queue->pending_index_size - 1;
+    unsigned int i, j;
+
+    for (i = working_queue->entry_hash[position & (working_queue->max_queue_size - 1)] & mask; index[i].used; i = (i + 1) & mask)
+    {
+        if (index[i].position == position)
+        {
+            break;
+        }
+    }
+
+    if (!index[i].used)
+    {
+        return;
+    }
+
+    for (j = (i + 1) & mask; index[j].used; j = (j + 1) & mask)
+    {
+        //Move the slot into the hole unless the hole lies before its home slot
+        if (((j - (index[j].hash & mask)) & mask) >= ((j - i) & mask))
+        {
+            index[i] = index[j];
+            i = j;
+        }
+    }
+
+    index[i].used = false;
+}
+
+
+/**
+ * @brief Marks the entries taken from the head of a conflating queue as no longer waiting.
+ * Caller holds the queue lock.
+ */
+static void pending_index_take(working_queue_t *working_queue, unsigned int number_of_entries)
+{
+    unsigned int i;
+
+    for (i = 0; working_queue->conflation_hash && (i < number_of_entries); i++)
+    {
+        pending_index_remove(working_queue, working_queue->head + i);
+    }
+}
+
+
+/**
+ * @brief Overwrites the waiting entry that has the same conflation key as the new entry. Caller holds the queue lock.
+ *
+ * @return true if the new entry replaced a waiting one
+ */
+static bool conflate_work_entry(working_queue_t *working_queue, unsigned int hash, const void *entry)
+{
+    int i = pending_index_find(working_queue, hash, entry);
+    unsigned int position;
+
+    if (i < 0)
+    {
+        return false;
+    }
+
+    position = working_queue->pending_index[i].position;
+    memcpy(queue_slot(working_queue, position), entry, working_queue->entry_size);
+
+    //The waiting entry is as old as its latest value
+    if (working_queue->enqueue_time)
+    {
+        working_queue->enqueue_time[position & (working_queue->max_queue_size - 1)] = now_ns();
+    }
+
+    __atomic_store_n(&(working_queue->enqueued), working_queue->enqueued + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&(working_queue->conflated), working_queue->conflated + 1, __ATOMIC_RELAXED);
+
+    return true;
+}
+
+
+/**
+ * @brief Calculates the absolute time the producer gives up waiting for a free slot.
+ */
+static void overflow_deadline(const working_queue_t *working_queue, struct timespec *deadline)
+{
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+
+    deadline->tv_sec += working_queue->overflow_timeout_ms / 1000;
+    deadline->tv_nsec += (working_queue->overflow_timeout_ms % 1000) * 1000000L;
+
+    if (deadline->tv_nsec >= 1000000000L)
+    {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+
+/**
+ * @brief Blocks the producer until the worker thread frees a slot in the SPSC ring.
+ *
+ * Slow path of reserve_work_entry(), taken only when the ring is full.
+ *
+ * @return true if there is a free slot, false if the wait timed out
+ */
+static bool spsc_wait_not_full(working_queue_t *working_queue)
+{
+    struct timespec deadline;
+    bool timed_out = false;
+    bool full;
+    uint64_t start = now_ns();
+
+    if (working_queue->overflow_policy == WORKING_QUEUE_OVERFLOW_BLOCK_TIMEOUT)
+    {
+        overflow_deadline(working_queue, &deadline);
+    }
+
+    pthread_mutex_lock(&(working_queue->access));
+
+    //The flag has to be visible before the head is read again. Pairs with the fence in release_work_entries().
+    __atomic_store_n(&(working_queue->producer_waiting), 1, __ATOMIC_SEQ_CST);
+
+    while ((full = (working_queue->tail - (working_queue->cached_head = __atomic_load_n(&(working_queue->head), __ATOMIC_SEQ_CST)) == working_queue->max_queue_size)) && !timed_out)
+    {
+        if (working_queue->overflow_policy == WORKING_QUEUE_OVERFLOW_BLOCK_TIMEOUT)
+        {
+            timed_out = (pthread_cond_timedwait(&(working_queue->not_full), &(working_queue->access), &deadline) == ETIMEDOUT);
+        }
+        else
+        {
+            pthread_cond_wait(&(working_queue->not_full), &(working_queue->access));
+        }
+    }
+
+    __atomic_store_n(&(working_queue->producer_waiting), 0, __ATOMIC_RELAXED);
+
+    pthread_mutex_unlock(&(working_queue->access));
+
+    __atomic_store_n(&(working_queue->blocked), working_queue->blocked + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&(working_queue->blocked_ns), working_queue->blocked_ns + (now_ns() - start), __ATOMIC_RELAXED);
+
+    return !full;
+}
+
+
+/**
+ * @brief Applies the overflow policy of a full queue with WORKING_QUEUE_MODE_LOCKED. Caller holds the queue lock.
+ *
+ * @return true if there is a free slot at the tail, false if the new entry has to be discarded
+ */
+static bool locked_make_room(working_queue_t *working_queue)
+{
+    struct timespec deadline;
+    uint64_t start;
+    bool room;
+
+    switch (working_queue->overflow_policy)
+    {
+    case WORKING_QUEUE_OVERFLOW_DROP_NEWEST:
+        __atomic_add_fetch(&(working_queue->dropped_newest), 1, __ATOMIC_RELAXED);
+        return false;
+
+    case WORKING_QUEUE_OVERFLOW_DROP_OLDEST:
+        //The worker thread copies its entries out, so the head entry is never in use
+        pending_index_take(working_queue, 1);
+        working_queue->head++;
+        working_queue->number_of_entries--;
+        __atomic_add_fetch(&(working_queue->dropped_oldest), 1, __ATOMIC_RELAXED);
+        return true;
+
+    case WORKING_QUEUE_OVERFLOW_BLOCK_TIMEOUT:
+        start = now_ns();
+        overflow_deadline(working_queue, &deadline);
+
+        while (working_queue->number_of_entries == working_queue->max_queue_size)
+        {
+            if (pthread_cond_timedwait(&(working_queue->not_full), &(working_queue->access), &deadline) == ETIMEDOUT)
+            {
+                break;
+            }
+        }
+
+        room = (working_queue->number_of_entries < working_queue->max_queue_size);
+        if (!room)
+        {
+            __atomic_add_fetch(&(working_queue->timeouts), 1, __ATOMIC_RELAXED);
+        }
+        break;
+
+    default:
+        start = now_ns();
+
+        while (working_queue->number_of_entries == working_queue->max_queue_size)
+        {
+            pthread_cond_wait(&(working_queue->not_full), &(working_queue->access));
+        }
+
+        room = true;
+        break;
+    }
+
+    //Producers are serialised by the queue lock
+    __atomic_store_n(&(working_queue->blocked), working_queue->blocked + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&(working_queue->blocked_ns), working_queue->blocked_ns + (now_ns() - start), __ATOMIC_RELAXED);
+
+    return room;
+}
+
+
+void *reserve_work_entry(working_queue_t *working_queue)
+{
+    if (working_queue->mode == WORKING_QUEUE_MODE_SPSC)
+    {
+        //Read the head written by the worker thread only when the cached copy says the ring is full
+        if (working_queue->tail - working_queue->cached_head == working_queue->max_queue_size)
+        {
+            working_queue->cached_head = __atomic_load_n(&(working_queue->head), __ATOMIC_ACQUIRE);
+
+            if (working_queue->tail - working_queue->cached_head == working_queue->max_queue_size)
+            {
+                if (working_queue->overflow_policy == WORKING_QUEUE_OVERFLOW_DROP_NEWEST)
+                {
+                    __atomic_add_fetch(&(working_queue->dropped_newest), 1, __ATOMIC_RELAXED);
+                    return NULL;
+                }
+
+                if (!spsc_wait_not_full(working_queue))
+                {
+                    __atomic_add_fetch(&(working_queue->timeouts), 1, __ATOMIC_RELAXED);
+                    return NULL;
+                }
+            }
+        }
+
+        return queue_slot(working_queue, working_queue->tail);
+    }
+
+    //The lock is held until the entry is committed
+    pthread_mutex_lock(&(working_queue->access));
+
+    if ((working_queue->number_of_entries == working_queue->max_queue_size) && working_queue->conflation_hash && !working_queue->staging_in_use)
+    {
+        //The new entry may replace a waiting one, the overflow policy is applied at commit if it does not
+        working_queue->staging_in_use = true;
+        working_queue->reserved_entry = working_queue->staging;
+
+        return working_queue->staging;
+    }
+
+    if ((working_queue->number_of_entries == working_queue->max_queue_size) && !locked_make_room(working_queue))
+    {
+        pthread_mutex_unlock(&(working_queue->access));
+        return NULL;
+    }
+
+    working_queue->reserved_entry = queue_slot(working_queue, working_queue->tail);
+
+    return working_queue->reserved_entry;
+}
+
+
+/**
+ * @brief Conflates the reserved entry of a conflating queue or gets a slot at the tail for it.
+ * Caller holds the queue lock.
+ *
+ * @return true if the entry is at the tail of the queue and has to be appended
+ */
+static bool conflating_commit(working_queue_t *working_queue)
+{
+    void *entry = working_queue->reserved_entry;
+    unsigned int hash = working_queue->conflation_hash(entry);
+    bool append;
+
+    if (entry != working_queue->staging)
+    {
+        append = !conflate_work_entry(working_queue, hash, entry);
+    }
+    else
+    {
+        //Waiting for a free slot releases the lock, so the key is looked up again afterwards
+        append = !conflate_work_entry(working_queue, hash, entry) && locked_make_room(working_queue) && !conflate_work_entry(working_queue, hash, entry);
+
+        if (append)
+        {
+            memcpy(queue_slot(working_queue, working_queue->tail), entry, working_queue->entry_size);
+        }
+
+        working_queue->staging_in_use = false;
+    }
 
-#include "worker.h"
+    if (append)
+    {
+        pending_index_insert(working_queue, hash, working_queue->tail);
+    }
+
+    return append;
+}
+
+
+void commit_work_entry(working_queue_t *working_queue)
+{
+    if (working_queue->conflation_hash && !conflating_commit(working_queue))
+    {
+        pthread_mutex_unlock(&working_queue->access);
+        return;
+    }
+
+    //Only one producer at a time: the SPSC producer or the holder of the queue lock
+    if (working_queue->enqueue_time)
+    {
+        working_queue->enqueue_time[working_queue->tail & (working_queue->max_queue_size - 1)] = now_ns();
+    }
+
+    __atomic_store_n(&(working_queue->enqueued), working_queue->enqueued + 1, __ATOMIC_RELAXED);
+
+    if (working_queue->mode == WORKING_QUEUE_MODE_SPSC)
+    {
+        //Publish the new entry to the worker thread
+        __atomic_store_n(&(working_queue->tail), working_queue->tail + 1, __ATOMIC_RELEASE);
+
+        //Wake up the worker thread only if it went to sleep on an empty ring
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&(working_queue->consumer_waiting), __ATOMIC_RELAXED))
+        {
+            pthread_mutex_lock(&(working_queue->access));
+            pthread_cond_signal(&(working_queue->not_empty));
+            pthread_mutex_unlock(&(working_queue->access));
+        }
+
+        return;
+    }
+
+    working_queue->tail++;
+    working_queue->number_of_entries++;
+
+    pthread_cond_signal(&(working_queue->not_empty));
+
+    pthread_mutex_unlock(&working_queue->access);
+}
+
+
+int add_work_entry(working_queue_t *working_queue, void *working_entry)
+{
+    void *slot = reserve_work_entry(working_queue);
+
+    if (!slot)
+    {
+        return -1;
+    }
+
+    // Place the new work entry on the working queue
+    memcpy(slot, working_entry, working_queue->entry_size);
+    commit_work_entry(working_queue);
+
+    return 0;
+}
 
 
 /**
- * @brief Woker thread function.
- *  
- * @param[in] arguments provided to the thread when created
- * 
- * @return void pointer
+ * @brief Limits the number of ready entries to a run that does not wrap around the end of the ring.
  */
-static void *worker_thread(void *worker_thread_arguments);
+static inline unsigned int contiguous_entries(const working_queue_t *working_queue, unsigned int number_of_entries, unsigned int max_entries)
+{
+    unsigned int till_the_end = working_queue->max_queue_size - (working_queue->head & (working_queue->max_queue_size - 1));
 
+    if (number_of_entries > till_the_end)
+    {
+        number_of_entries = till_the_end;
+    }
 
-int create_worker(worker_t **worker, unsigned int working_queue_size, unsigned int working_queue_entry_size, do_work_f do_work)
+    return number_of_entries > max_entries ? max_entries : number_of_entries;
+}
+
+
+/**
+ * @brief Gives the slots of processed entries back to the producers. Caller holds the queue lock.
+ */
+static void locked_release_work_entries(working_queue_t *working_queue, unsigned int number_of_entries)
 {
-    if (*worker)
+    working_queue->head += number_of_entries;
+    working_queue->number_of_entries -= number_of_entries;
+    __atomic_store_n(&(working_queue->dequeued), working_queue->dequeued + number_of_entries, __ATOMIC_RELAXED);
+
+    //More than one producer can wait for a free slot
+    if (number_of_entries > 1)
     {
-        //Worker already created/exists.
-        return -1;
+        pthread_cond_broadcast(&(working_queue->not_full));
+    }
+    else
+    {
+        pthread_cond_signal(&(working_queue->not_full));
     }
 
-    pthread_attr_t attr_thread;
-	
-    int rc;
+    if (working_queue->number_of_entries == 0)
+    {
+        pthread_cond_signal(&(working_queue->empty));
+    }
+}
 
-    *worker = malloc(sizeof(worker_t));
 
-    (*worker)->working_queue.head = 0;
-    (*worker)->working_queue.number_of_entries = 0;
-    (*worker)->working_queue.tail = 0;
-    (*worker)->working_queue.entry_size = working_queue_entry_size;
-    (*worker)->working_queue.max_queue_size = working_queue_size > MAXIMUM_WORKING_QUEUE_LENGTH ? MAXIMUM_WORKING_QUEUE_LENGTH : working_queue_size;
-    (*worker)->working_queue.entry = calloc((*worker)->working_queue.max_queue_size, working_queue_entry_size);
-    (*worker)->stop_working = false;
-    (*worker)->do_work = do_work;
+void *peek_work_entries(working_queue_t *working_queue, unsigned int max_entries, unsigned int *number_of_entries)
+{
+    unsigned int ready;
 
-    //Init the objects for synchronisation of the threds
-    pthread_mutex_init(&((*worker)->working_queue.access), NULL);
-    pthread_cond_init(&((*worker)->working_queue.not_full), NULL);
-    pthread_cond_init(&((*worker)->working_queue.not_empty), NULL);
-    pthread_cond_init(&((*worker)->working_queue.empty), NULL);
+    if (working_queue->mode == WORKING_QUEUE_MODE_SPSC)
+    {
+        //Read the tail written by the producer only when the cached copy says the ring is empty
+        if (working_queue->head == working_queue->cached_tail)
+        {
+            working_queue->cached_tail = __atomic_load_n(&(working_queue->tail), __ATOMIC_ACQUIRE);
+        }
 
-    pthread_attr_init(&attr_thread);
+        ready = working_queue->cached_tail - working_queue->head;
+    }
+    else
+    {
+        pthread_mutex_lock(&(working_queue->access));
+        ready = contiguous_entries(working_queue, working_queue->number_of_entries, max_entries);
+        pending_index_take(working_queue, ready);
+        pthread_mutex_unlock(&(working_queue->access));
+    }
 
-    pthread_attr_setdetachstate(&attr_thread, PTHREAD_CREATE_JOINABLE);
+    *number_of_entries = contiguous_entries(working_queue, ready, max_entries);
 
-    //Inherit all of the thread scheduling properties from the calling thread.
-    pthread_attr_setinheritsched(&attr_thread, PTHREAD_EXPLICIT_SCHED);
+    return *number_of_entries ? queue_slot(working_queue, working_queue->head) : NULL;
+}
 
-    //Start the worker thread
-    rc = pthread_create(&((*worker)->working_thread), &attr_thread, worker_thread, *worker);
-    if (rc != 0)
+
+void release_work_entries(working_queue_t *working_queue, unsigned int number_of_entries)
+{
+    if (working_queue->mode == WORKING_QUEUE_MODE_SPSC)
     {
-        strerror(errno);
-        worker_clean_up(worker);
-        rc = -1;
+        __atomic_store_n(&(working_queue->dequeued), working_queue->dequeued + number_of_entries, __ATOMIC_RELAXED);
+        __atomic_store_n(&(working_queue->head), working_queue->head + number_of_entries, __ATOMIC_RELEASE);
+
+        //Wake up the producer only if it went to sleep on a full ring
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&(working_queue->producer_waiting), __ATOMIC_RELAXED))
+        {
+            pthread_mutex_lock(&(working_queue->access));
+            pthread_cond_signal(&(working_queue->not_full));
+            pthread_mutex_unlock(&(working_queue->access));
+        }
+
+        return;
     }
 
-    return 0;
+    pthread_mutex_lock(&(working_queue->access));
+    locked_release_work_entries(working_queue, number_of_entries);
+    pthread_mutex_unlock(&(working_queue->access));
 }
 
 
-void add_work_entry(working_queue_t *working_queue, void *working_entry)
+/**
+ * @brief Blocks the worker thread until the producer moves the tail away from the given position
+ * or until the worker is stopped.
+ *
+ * @return true if the ring is empty and the worker has to exit
+ */
+static bool spsc_wait_not_empty(worker_t *worker, unsigned int head)
 {
+    working_queue_t *working_queue = &(worker->working_queue);
+    bool stop;
+
     pthread_mutex_lock(&(working_queue->access));
 
-    while((working_queue->number_of_entries) == working_queue->max_queue_size)
+    //The flag has to be visible before the tail is read again. Pairs with the fence in commit_work_entry().
+    __atomic_store_n(&(working_queue->consumer_waiting), 1, __ATOMIC_SEQ_CST);
+
+    while (((working_queue->cached_tail = __atomic_load_n(&(working_queue->tail), __ATOMIC_SEQ_CST)) == head) && (!worker->stop_working))
     {
-        pthread_cond_wait(&(working_queue->not_full), &(working_queue->access));
+        pthread_cond_wait(&(working_queue->not_empty), &(working_queue->access));
     }
 
-    // Place the new work entry on the working queue
-    memcpy(working_queue->entry + working_queue->entry_size * working_queue->tail, working_entry, working_queue->entry_size);
-    working_queue->tail = (working_queue->tail + 1) % working_queue->max_queue_size;
-    working_queue->number_of_entries++;
+    __atomic_store_n(&(working_queue->consumer_waiting), 0, __ATOMIC_RELAXED);
 
-    pthread_cond_signal(&(working_queue->not_empty));
+    //Entries added before the stop request are processed first
+    stop = (working_queue->cached_tail == head) && worker->stop_working;
 
-    pthread_mutex_unlock(&working_queue->access);
+    pthread_mutex_unlock(&(working_queue->access));
+
+    return stop;
+}
+
+
+/**
+ * @brief Records the queue depth and the time the entries at the head of the queue spent waiting.
+ *
+ * Called by the worker thread before the entries are released.
+ *
+ * @param[in, out] worker worker object
+ * @param[in] depth number of entries in the queue
+ * @param[in] number_of_entries number of entries taken from the head of the queue
+ */
+static void record_dequeue_stats(worker_t *worker, unsigned int depth, unsigned int number_of_entries)
+{
+    working_queue_t *working_queue = &(worker->working_queue);
+    unsigned int i;
+    uint64_t now;
+
+    if (depth > working_queue->high_water_mark)
+    {
+        __atomic_store_n(&(working_queue->high_water_mark), depth, __ATOMIC_RELAXED);
+    }
+
+    if (!worker->collect_stats)
+    {
+        return;
+    }
+
+    histogram_record(&(worker->queue_depth), depth);
+
+    now = now_ns();
+    for (i = 0; i < number_of_entries; i++)
+    {
+        histogram_record(&(worker->queue_latency), now - working_queue->enqueue_time[(working_queue->head + i) & (working_queue->max_queue_size - 1)]);
+    }
+}
+
+
+/**
+ * @brief Passes the entries to the batch function or to do_work one by one. Entries are processed in place.
+ */
+static void process_batch(worker_t *worker, void *entries, unsigned int number_of_entries)
+{
+    unsigned int i;
+    uint64_t start = 0;
+
+    if (worker->do_work_batch)
+    {
+        if (worker->collect_stats)
+        {
+            start = now_ns();
+        }
+
+        worker->do_work_batch(entries, number_of_entries);
+
+        if (worker->collect_stats)
+        {
+            histogram_record(&(worker->processing_time), now_ns() - start);
+        }
+
+        return;
+    }
+
+    for (i = 0; i < number_of_entries; i++)
+    {
+        if (worker->collect_stats)
+        {
+            start = now_ns();
+        }
+
+        worker->do_work(entries + (i * worker->working_queue.entry_size));
+
+        if (worker->collect_stats)
+        {
+            histogram_record(&(worker->processing_time), now_ns() - start);
+        }
+    }
+}
+
+
+/**
+ * @brief Worker thread function for the lock-free SPSC queue.
+ */
+static void *spsc_worker_thread(worker_t *worker)
+{
+    working_queue_t *working_queue = &(worker->working_queue);
+    unsigned int number_of_entries;
+    void *entries;
+
+    while(1)
+    {
+        //Take everything the producer has written so far, up to the batch size
+        entries = peek_work_entries(working_queue, worker->max_batch_size, &number_of_entries);
+
+        if (!number_of_entries)
+        {
+            if (spsc_wait_not_empty(worker, working_queue->head))
+            {
+                break;
+            }
+
+            continue;
+        }
+
+        record_dequeue_stats(worker, working_queue->cached_tail - working_queue->head, number_of_entries);
+
+        //Process the entries from the working queue in place, then give the slots back to the producer
+        process_batch(worker, entries, number_of_entries);
+        release_work_entries(working_queue, number_of_entries);
+    }
+
+    pthread_exit(NULL);
 }
 
 
 void *worker_thread(void *worker_thread_arguments)
 {
     worker_t *worker = (worker_t *) worker_thread_arguments;
-    void *working_entry = NULL;
+    unsigned int number_of_entries;
+    unsigned int entries_in_use = 0;
+    void *entries;
+
+    if (worker->working_queue.mode == WORKING_QUEUE_MODE_SPSC)
+    {
+        return spsc_worker_thread(worker);
+    }
 
     while(1)
     {
         pthread_mutex_lock(&(worker->working_queue.access));
 
+        //Give back the entries processed in place in the previous step
+        if (entries_in_use)
+        {
+            locked_release_work_entries(&(worker->working_queue), entries_in_use);
+        }
+
         /* Check if the queue is empty. */
         while ((worker->working_queue.number_of_entries == 0) && (!worker->stop_working))
         {
@@ -126,47 +1091,58 @@ void *worker_thread(void *worker_thread_arguments)
         if (worker->stop_working)
         {
             pthread_mutex_unlock(&(worker->working_queue.access));
-            if (working_entry)
-            {
-                free(working_entry);
-            }
             pthread_exit(NULL);
         }
 
-        if (worker->working_queue.number_of_entries != 0)
-        {
-            working_entry = malloc(worker->working_queue.entry_size);
-            memcpy(working_entry, worker->working_queue.entry + (worker->working_queue.head * worker->working_queue.entry_size), worker->working_queue.entry_size);
-            worker->working_queue.head = (worker->working_queue.head + 1) % worker->working_queue.max_queue_size;
-            worker->working_queue.number_of_entries--;
-        }
+        //Take all queued entries, up to the batch size, under one lock acquisition
+        number_of_entries = contiguous_entries(&(worker->working_queue), worker->working_queue.number_of_entries, worker->max_batch_size);
+        entries = queue_slot(&(worker->working_queue), worker->working_queue.head);
+        entries_in_use = number_of_entries;
 
-        if (worker->working_queue.number_of_entries < worker->working_queue.max_queue_size)
-        {
-            pthread_cond_signal(&(worker->working_queue.not_full));
-        }
+        //Newer values for the same keys are queued after the entries being processed
+        pending_index_take(&(worker->working_queue), number_of_entries);
 
-        if (worker->working_queue.number_of_entries == 0)
+        record_dequeue_stats(worker, worker->working_queue.number_of_entries, number_of_entries);
+
+        if (worker->batch)
         {
-            pthread_cond_signal(&(worker->working_queue.empty));
+            //Producers may discard the waiting entries, so work on a copy
+            memcpy(worker->batch, entries, number_of_entries * worker->working_queue.entry_size);
+            locked_release_work_entries(&(worker->working_queue), number_of_entries);
+            entries = worker->batch;
+            entries_in_use = 0;
         }
 
         pthread_mutex_unlock(&(worker->working_queue.access));
 
-        //Process the entry from the working queue
-        if (working_entry)
-        {
-            worker->do_work(working_entry);
-            free(working_entry);
-            working_entry = NULL;
-
-        }
+        //Process the entries from the working queue. Entries processed in place stay reserved till the next step.
+        process_batch(worker, entries, number_of_entries);
     }
 
     pthread_exit((void *) 0);
 }
 
 
+void get_worker_stats(worker_t *worker, worker_stats_t *stats)
+{
+    working_queue_t *working_queue = &(worker->working_queue);
+
+    stats->enqueued = __atomic_load_n(&(working_queue->enqueued), __ATOMIC_RELAXED);
+    stats->dequeued = __atomic_load_n(&(working_queue->dequeued), __ATOMIC_RELAXED);
+    stats->dropped_newest = __atomic_load_n(&(working_queue->dropped_newest), __ATOMIC_RELAXED);
+    stats->dropped_oldest = __atomic_load_n(&(working_queue->dropped_oldest), __ATOMIC_RELAXED);
+    stats->timeouts = __atomic_load_n(&(working_queue->timeouts), __ATOMIC_RELAXED);
+    stats->conflated = __atomic_load_n(&(working_queue->conflated), __ATOMIC_RELAXED);
+    stats->high_water_mark = __atomic_load_n(&(working_queue->high_water_mark), __ATOMIC_RELAXED);
+    stats->blocked = __atomic_load_n(&(working_queue->blocked), __ATOMIC_RELAXED);
+    stats->blocked_ns = __atomic_load_n(&(working_queue->blocked_ns), __ATOMIC_RELAXED);
+
+    histogram_snapshot(&(worker->queue_depth), &(stats->queue_depth));
+    histogram_snapshot(&(worker->queue_latency), &(stats->queue_latency));
+    histogram_snapshot(&(worker->processing_time), &(stats->processing_time));
+}
+
+
 int stop_worker(worker_t *worker)
 {
     pthread_mutex_lock(&worker->working_queue.access);
@@ -177,6 +1153,18 @@ int stop_worker(worker_t *worker)
         return 0;
     }
 
+    if (worker->working_queue.mode == WORKING_QUEUE_MODE_SPSC)
+    {
+        //The worker thread drains the ring before it checks the flag and exits
+        worker->stop_working = true;
+        pthread_cond_broadcast(&worker->working_queue.not_empty);
+        pthread_mutex_unlock(&worker->working_queue.access);
+
+        pthread_join(worker->working_thread, NULL);
+
+        return 0;
+    }
+
     while(worker->working_queue.number_of_entries != 0)
     {
         pthread_cond_wait(&worker->working_queue.empty, &worker->working_queue.access);
@@ -202,9 +1190,112 @@ void worker_clean_up(worker_t **worker)
     {
         pthread_cond_destroy(&((*worker)->working_queue.not_full));
         pthread_cond_destroy(&((*worker)->working_queue.not_empty));
+        pthread_cond_destroy(&((*worker)->working_queue.empty));
         pthread_mutex_destroy(&((*worker)->working_queue.access));
-        free((*worker)->working_queue.entry);
-        free(*worker);
+        free_worker_memory(*worker);
         *worker = NULL;
     }
 }
+
+
+int create_worker_pool(worker_pool_t **pool, unsigned int number_of_workers, const worker_attr_t *attr, work_entry_hash_f hash)
+{
+    worker_attr_t worker_attr;
+    char index[12];
+    unsigned int i;
+
+    if (*pool || !number_of_workers)
+    {
+        return -1;
+    }
+
+    *pool = malloc(sizeof(worker_pool_t));
+    if (!*pool)
+    {
+        return -1;
+    }
+
+    (*pool)->number_of_workers = number_of_workers;
+    (*pool)->hash = hash;
+    (*pool)->workers = calloc(number_of_workers, sizeof(worker_t *));
+
+    if (!(*pool)->workers)
+    {
+        free(*pool);
+        *pool = NULL;
+        return -1;
+    }
+
+    worker_attr = *attr;
+
+    for (i = 0; i < number_of_workers; i++)
+    {
+        //The workers are told apart by their index, e.g. mqtt_sub_w0. Long names are cut off.
+        if (attr->thread.name[0])
+        {
+            snprintf(index, sizeof(index), "%u", i);
+            snprintf(worker_attr.thread.name, sizeof(worker_attr.thread.name), "%.*s%s",
+                     (int) (sizeof(worker_attr.thread.name) - 1 - strlen(index)), attr->thread.name, index);
+        }
+
+        if (create_worker_with_attr(&((*pool)->workers[i]), &worker_attr))
+        {
+            (*pool)->number_of_workers = i;
+            stop_worker_pool(*pool);
+            worker_pool_clean_up(pool);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+int add_pool_work_entry(worker_pool_t *pool, void *working_entry)
+{
+    unsigned int hash = 0;
+
+    if (pool->number_of_workers > 1)
+    {
+        hash = pool->hash(working_entry);
+    }
+
+    return add_work_entry(&(get_pool_worker(pool, hash)->working_queue), working_entry);
+}
+
+
+worker_t *get_pool_worker(worker_pool_t *pool, unsigned int hash)
+{
+    return pool->workers[hash % pool->number_of_workers];
+}
+
+
+int stop_worker_pool(worker_pool_t *pool)
+{
+    unsigned int i;
+
+    for (i = 0; i < pool->number_of_workers; i++)
+    {
+        stop_worker(pool->workers[i]);
+    }
+
+    return 0;
+}
+
+
+void worker_pool_clean_up(worker_pool_t **pool)
+{
+    unsigned int i;
+
+    if (*pool)
+    {
+        for (i = 0; i < (*pool)->number_of_workers; i++)
+        {
+            worker_clean_up(&((*pool)->workers[i]));
+        }
+
+        free((*pool)->workers);
+        free(*pool);
+        *pool = NULL;
+    }
+}